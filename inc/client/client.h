@@ -128,9 +128,16 @@ float V_CalcFov(float fov_x, float width, float height);
 
 #else // USE_CLIENT
 
+#if USE_LOADGEN
+void CL_Init(void);
+void CL_Shutdown(void);
+unsigned CL_Frame(unsigned msec);
+#else
 #define CL_Init()                       (void)0
-#define CL_Disconnect(type)             (void)0
 #define CL_Shutdown()                   (void)0
+#endif
+
+#define CL_Disconnect(type)             (void)0
 #define CL_UpdateUserinfo(var, from)    (void)0
 #define CL_ErrorEvent(from)             (void)0
 #define CL_RestartFilesystem(total)     FS_Restart(total)
@@ -18,23 +18,25 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
-#if USE_CLIENT
+typedef enum {
+    ASYNC_PRIO_NORMAL,
+    ASYNC_PRIO_HIGH,    // user is waiting for the result
+    ASYNC_PRIO_LOW,     // background indexing, etc
 
-typedef struct asyncwork_s {
+    ASYNC_PRIO_MAX
+} asyncprio_t;
+
+// work_cb is called from worker thread, done_cb from main thread
+typedef struct {
     void (*work_cb)(void *);
     void (*done_cb)(void *);
     void *cb_arg;
-    struct asyncwork_s *next;
+    asyncprio_t prio;
 } asyncwork_t;
 
+void Com_InitAsyncWork(void);
 void Com_QueueAsyncWork(asyncwork_t *work);
 void Com_CompleteAsyncWork(void);
+void Com_WaitAsyncWork(void);
 void Com_ShutdownAsyncWork(void);
 
-#else
-
-#define Com_QueueAsyncWork(work)    (void)0
-#define Com_CompleteAsyncWork()     (void)0
-#define Com_ShutdownAsyncWork()     (void)0
-
-#endif
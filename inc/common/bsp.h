@@ -144,11 +144,27 @@ typedef struct {
     mtexinfo_t          *texinfo;
 } mbrushside_t;
 
+// SSE brush clipping must give the same results as scalar code, which is
+// only guaranteed if scalar float math is done in SSE registers and multiply
+// and add are never fused
+#if defined(__GNUC__) && defined(__SSE_MATH__) && !defined(__FMA__)
+#define USE_CLIP_SSE        1
+#else
+#define USE_CLIP_SSE        0
+#endif
+
+// brush side planes are also stored in blocks of 4 sides for SIMD clipping,
+// each block is 4 normal[0], 4 normal[1], 4 normal[2] and 4 dist values
+#define MAX_CLIP_SIMD_SIDES 64
+#define CLIP_SIMD_BLOCK     16
+
 typedef struct {
     int                 contents;
     int                 numsides;
     mbrushside_t        *firstbrushside;
     unsigned            checkcount;         // to avoid repeated testings
+    float               *planes;            // SIMD side planes, may be NULL
+    vec3_t              mins, maxs;         // bounds from axial sides
 } mbrush_t;
 
 typedef struct {
@@ -168,6 +184,7 @@ typedef struct {
     int             area;
     int             numleafbrushes;
     mbrush_t        **firstleafbrush;
+    vec3_t          brushmins, brushmaxs;   // bounds of all leaf brushes
 #if USE_REF
     mface_t         **firstleafface;
     int             numleaffaces;
@@ -270,6 +287,8 @@ typedef struct {
     int             numvisibility;
     int             visrowsize;
     dvis_t          *vis;
+    byte            *vismatrix;     // decompressed PVS/PHS rows, may be NULL
+    float           *brushplanes;   // SIMD brush side planes, may be NULL
 
     int             numentitychars;
     char            *entitystring;
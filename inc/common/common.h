@@ -18,6 +18,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <setjmp.h>
+
 #include "common/cmd.h"
 #include "common/utils.h"
 
@@ -84,6 +86,18 @@ void        Com_EndRedirect(void);
 
 void        Com_AbortFunc(void (*func)(void *), void *arg);
 
+void        Com_SetWorkerThread(void);
+void        Com_FlushWorkerPrints(void);
+
+// error raised while trap is set is stored in it instead of being handled
+typedef struct {
+    jmp_buf         jmpbuf;
+    error_type_t    code;
+    char            msg[MAXERRORMSG];
+} errortrap_t;
+
+void        Com_SetErrorTrap(errortrap_t *trap);
+
 q_cold
 void        Com_SetLastError(const char *msg);
 
@@ -0,0 +1,45 @@
+/*
+Copyright (C) 2023 Andrey Nazarov
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "common/zone.h"
+
+#define MIN_SNAPSHOTS   64
+#define MAX_SNAPSHOTS   250000000
+
+// fake demo packet used to reconstruct state at the given frame
+typedef struct {
+    int         framenum;
+    unsigned    msglen;
+    int64_t     filepos;
+    byte        data[1];
+} demosnap_t;
+
+// identifies demo file the index was built for
+typedef struct {
+    int64_t     filelen;
+    int64_t     fileofs;    // offset of the first frame
+    uint32_t    checksum;   // of data preceding the first frame
+} demoinfo_t;
+
+int Com_GetDemoInfo(qhandle_t f, int64_t filelen, int64_t fileofs, demoinfo_t *info);
+int Com_LoadDemoIndex(const char *name, const demoinfo_t *info,
+                      demosnap_t ***snapshots, memtag_t tag);
+int Com_SaveDemoIndex(const char *name, const demoinfo_t *info,
+                      demosnap_t **snapshots, int numsnapshots);
@@ -60,6 +60,9 @@ int FS_RenameFile(const char *from, const char *to);
 int FS_CreatePath(char *path);
 
 int64_t FS_OpenFile(const char *filename, qhandle_t *f, unsigned mode);
+void    *FS_RawFile(qhandle_t f);
+int     FS_ReadRaw(void *raw, void *buffer, size_t len);
+int     FS_LoadRaw(void *raw, void **buffer);
 int     FS_CloseFile(qhandle_t f);
 qhandle_t FS_EasyOpenFile(char *buf, size_t size, unsigned mode,
                           const char *dir, const char *name, const char *ext);
@@ -100,7 +100,7 @@ typedef enum {
     MSG_ES_REMOVE       = BIT(9),   // entity is removed (MVD stream only)
 } msgEsFlags_t;
 
-extern sizebuf_t    msg_write;
+extern q_thread_local sizebuf_t msg_write;
 extern byte         msg_write_buffer[MAX_MSGLEN];
 
 extern sizebuf_t    msg_read;
@@ -122,7 +122,7 @@ void    MSG_WriteString(const char *s);
 void    MSG_WritePos(const vec3_t pos, bool extended);
 void    MSG_WriteIntPos(const int32_t pos[3], bool extended);
 void    MSG_WriteAngle(float f);
-#if USE_CLIENT
+#if USE_CLIENT || USE_LOADGEN
 void    MSG_FlushBits(void);
 void    MSG_WriteBits(int value, int bits);
 int     MSG_WriteDeltaUsercmd(const usercmd_t *from, const usercmd_t *cmd, int version);
@@ -168,7 +168,7 @@ void    MSG_ReadDeltaUsercmd_Hacked(const usercmd_t *from, usercmd_t *to);
 void    MSG_ReadDeltaUsercmd_Enhanced(const usercmd_t *from, usercmd_t *to);
 int     MSG_ParseEntityBits(uint64_t *bits, msgEsFlags_t flags);
 void    MSG_ParseDeltaEntity(entity_state_t *to, entity_state_extension_t *ext, int number, uint64_t bits, msgEsFlags_t flags);
-#if USE_CLIENT
+#if USE_CLIENT || USE_LOADGEN
 void    MSG_ParseDeltaPlayerstate_Default(const player_state_t *from, player_state_t *to, int flags, msgPsFlags_t psflags);
 void    MSG_ParseDeltaPlayerstate_Enhanced(const player_state_t *from, player_state_t *to, int flags, int extraflags, msgPsFlags_t psflags);
 #endif
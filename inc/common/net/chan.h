@@ -33,6 +33,9 @@ typedef struct {
     unsigned    maxpacketlen;
 
     netsrc_t    sock;
+#if USE_LOADGEN
+    struct pollfd   *socket;        // private socket to send on, overrides sock
+#endif
 
     unsigned    dropped;            // between last packet and previous
     unsigned    total_dropped;      // for statistics
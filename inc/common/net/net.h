@@ -193,6 +193,15 @@ bool        NET_GetAddress(netsrc_t sock, netadr_t *adr);
 void        NET_GetPackets(netsrc_t sock, void (*packet_cb)(void));
 bool        NET_SendPacket(netsrc_t sock, const void *data,
                            size_t len, const netadr_t *to);
+void        NET_FlushPackets(netsrc_t sock);
+
+#if USE_LOADGEN
+struct pollfd   *NET_OpenUdpSocket(netadrtype_t type);
+void            NET_CloseUdpSocket(struct pollfd *s);
+bool            NET_GetUdpPacket(struct pollfd *s);
+bool            NET_SendUdpPacket(struct pollfd *s, const void *data,
+                                  size_t len, const netadr_t *to);
+#endif
 
 const char  *NET_AdrToString(const netadr_t *a);
 bool        NET_StringToAdr(const char *s, netadr_t *a, int default_port);
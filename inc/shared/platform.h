@@ -127,6 +127,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #define q_forceinline       inline __attribute__((always_inline))
 
+#define q_thread_local      __thread
+
 #else /* __GNUC__ */
 
 #ifdef _MSC_VER
@@ -136,6 +138,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define q_alignof(t)        __alignof(t)
 #define q_unreachable()     __assume(0)
 #define q_forceinline       __forceinline
+#define q_thread_local      __declspec(thread)
 #else
 #define q_noreturn
 #define q_noinline
@@ -143,6 +146,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define q_alignof(t)        _Alignof(t)
 #define q_unreachable()     abort()
 #define q_forceinline       inline
+#define q_thread_local      _Thread_local
 #endif
 
 #define q_printf(f, a)
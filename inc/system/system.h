@@ -34,8 +34,16 @@ void    Sys_FreeLibrary(void *handle);
 void    *Sys_GetProcAddress(void *handle, const char *sym);
 
 unsigned    Sys_Milliseconds(void);
+uint64_t    Sys_Microseconds(void);
+
+// fills buffer from OS cryptographically secure random source
+bool        Sys_GetRandomBytes(void *buf, size_t len);
 void        Sys_Sleep(int msec);
 
+// maps first `size' bytes of file read-only, returns NULL on failure
+void    *Sys_MapFile(FILE *fp, size_t size);
+void    Sys_UnmapFile(void *data, size_t size);
+
 void    Sys_Init(void);
 void    Sys_AddDefaultConfig(void);
 
@@ -28,6 +28,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/cmodel.h"
 #include "common/common.h"
 #include "common/cvar.h"
+#include "common/demoindex.h"
 #include "common/field.h"
 #include "common/files.h"
 #include "common/math.h"
@@ -379,13 +380,6 @@ typedef struct {
     char        path[1];
 } dlqueue_t;
 
-typedef struct {
-    int         framenum;
-    unsigned    msglen;
-    int64_t     filepos;
-    byte        data[1];
-} demosnap_t;
-
 typedef struct {
     connstate_t state;
     keydest_t   key_dest;
@@ -482,6 +476,9 @@ typedef struct {
         sizebuf_t   buffer;
         demosnap_t  **snapshots;
         int         numsnapshots;
+        int         numindexed;         // number of snapshots in index file
+        demoinfo_t  index;              // valid if index is being built
+        char        path[MAX_OSPATH];
         bool        paused;
         bool        seeking;
         bool        eof;
@@ -658,6 +655,7 @@ void CL_ParsePlayerSkin(char *name, char *model, char *skin, const char *s);
 void CL_LoadClientinfo(clientinfo_t *ci, const char *s);
 void CL_LoadState(load_state_t state);
 void CL_RegisterSounds(void);
+void CL_LoadStats_f(void);
 void CL_RegisterBspModels(void);
 void CL_RegisterVWepModels(void);
 void CL_PrepRefresh(void);
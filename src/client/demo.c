@@ -25,6 +25,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 static byte     demo_buffer[MAX_MSGLEN];
 
 static cvar_t   *cl_demosnaps;
+static cvar_t   *cl_demoindex;
 static cvar_t   *cl_demomsglen;
 static cvar_t   *cl_demowait;
 static cvar_t   *cl_demosuspendtoggle;
@@ -752,6 +753,7 @@ static void CL_PlayDemo_f(void)
 
     cls.demo.playback = f;
     cls.demo.compat = !strcmp(Cmd_Argv(2), "compat");
+    Q_strlcpy(cls.demo.path, name, sizeof(cls.demo.path));
     cls.state = ca_connected;
     Q_strlcpy(cls.servername, COM_SkipPath(name), sizeof(cls.servername));
     cls.serverAddress.type = NA_LOOPBACK;
@@ -778,9 +780,6 @@ static void CL_Demo_c(genctx_t *ctx, int argnum)
     }
 }
 
-#define MIN_SNAPSHOTS   64
-#define MAX_SNAPSHOTS   250000000
-
 /*
 ====================
 CL_EmitDemoSnapshot
@@ -896,6 +895,49 @@ static demosnap_t *find_snapshot(int64_t dest, bool byte_seek)
     return cls.demo.snapshots[max(r, 0)];
 }
 
+/*
+====================
+load_demo_index
+
+Loads previously saved snapshots for the first map of the demo. Snapshots
+built during playback past the loaded ones are saved into the index when
+the map ends.
+====================
+*/
+static void load_demo_index(void)
+{
+    demosnap_t **snapshots;
+    int count;
+
+    // only first map is indexed
+    if (!cls.demo.path[0] || cls.demo.index.filelen)
+        return;
+
+    if (!cl_demoindex->integer || !cls.demo.file_size ||
+        Com_GetDemoInfo(cls.demo.playback, cls.demo.file_offset + cls.demo.file_size,
+                        cls.demo.file_offset, &cls.demo.index) < 0) {
+        cls.demo.path[0] = 0;
+        return;
+    }
+
+    count = Com_LoadDemoIndex(cls.demo.path, &cls.demo.index, &snapshots, TAG_GENERAL);
+    if (count > 0) {
+        Com_DPrintf("Loaded %d snapshots from index\n", count);
+        cls.demo.snapshots = snapshots;
+        cls.demo.numsnapshots = count;
+        cls.demo.numindexed = count;
+        cls.demo.last_snapshot = snapshots[count - 1]->framenum;
+    }
+}
+
+static void save_demo_index(void)
+{
+    if (cls.demo.numsnapshots > cls.demo.numindexed &&
+        Com_SaveDemoIndex(cls.demo.path, &cls.demo.index, cls.demo.snapshots,
+                          cls.demo.numsnapshots) == 0)
+        cls.demo.numindexed = cls.demo.numsnapshots;
+}
+
 /*
 ====================
 CL_FirstDemoFrame
@@ -928,6 +970,8 @@ void CL_FirstDemoFrame(void)
 
     // force initial snapshot
     cls.demo.last_snapshot = INT_MIN;
+
+    load_demo_index();
 }
 
 /*
@@ -937,6 +981,14 @@ CL_FreeDemoSnapshots
 */
 void CL_FreeDemoSnapshots(void)
 {
+    // index is complete once the first map ends
+    if (cls.demo.index.filelen) {
+        save_demo_index();
+        memset(&cls.demo.index, 0, sizeof(cls.demo.index));
+        cls.demo.numindexed = 0;
+        cls.demo.path[0] = 0;
+    }
+
     for (int i = 0; i < cls.demo.numsnapshots; i++)
         Z_Free(cls.demo.snapshots[i]);
     cls.demo.numsnapshots = 0;
@@ -946,82 +998,19 @@ void CL_FreeDemoSnapshots(void)
 
 /*
 ====================
-CL_Seek_f
+seek_demo
+
+Seeks to destination frame or file position. If `wait' is true, stops at
+the end of demo instead of finishing it.
 ====================
 */
-static void CL_Seek_f(void)
+static void seek_demo(int64_t dest, bool byte_seek, bool back_seek, bool wait)
 {
     demosnap_t *snap;
-    int i, j, ret, index, frames, prev;
-    int64_t dest;
-    bool byte_seek, back_seek;
+    int i, j, ret, index, prev;
     char *from, *to;
 
-    if (Cmd_Argc() < 2) {
-        Com_Printf("Usage: %s [+-]<timespec|percent>[%%]\n", Cmd_Argv(0));
-        return;
-    }
-
-#if USE_MVD_CLIENT
-    if (sv_running->integer == ss_broadcast) {
-        Cbuf_InsertText(&cmd_buffer, va("mvdseek \"%s\" @@\n", Cmd_Argv(1)));
-        return;
-    }
-#endif
-
-    if (!cls.demo.playback) {
-        Com_Printf("Not playing a demo.\n");
-        return;
-    }
-
-    to = Cmd_Argv(1);
-
-    if (strchr(to, '%')) {
-        char *suf;
-        float percent = strtof(to, &suf);
-        if (suf == to || strcmp(suf, "%") || !isfinite(percent)) {
-            Com_Printf("Invalid percentage.\n");
-            return;
-        }
-
-        if (!cls.demo.file_size) {
-            Com_Printf("Unknown file size, can't seek.\n");
-            return;
-        }
-
-        percent = Q_clipf(percent, 0, 100);
-        dest = cls.demo.file_offset + cls.demo.file_size * percent / 100;
-
-        byte_seek = true;
-        back_seek = dest < FS_Tell(cls.demo.playback);
-    } else {
-        if (*to == '-' || *to == '+') {
-            // relative to current frame
-            if (!Com_ParseTimespec(to + 1, &frames)) {
-                Com_Printf("Invalid relative timespec.\n");
-                return;
-            }
-            if (*to == '-')
-                frames = -frames;
-            dest = cls.demo.frames_read + frames;
-        } else {
-            // relative to first frame
-            if (!Com_ParseTimespec(to, &i)) {
-                Com_Printf("Invalid absolute timespec.\n");
-                return;
-            }
-            dest = i;
-            frames = i - cls.demo.frames_read;
-        }
-
-        if (!frames)
-            return; // already there
-
-        byte_seek = false;
-        back_seek = frames < 0;
-    }
-
-    if (!back_seek && cls.demo.eof && cl_demowait->integer)
+    if (!back_seek && cls.demo.eof && wait)
         return; // already at end
 
     // disable effects processing
@@ -1083,7 +1072,7 @@ static void CL_Seek_f(void)
             break;
 
         ret = read_next_message(cls.demo.playback);
-        if (ret == 0 && cl_demowait->integer) {
+        if (ret == 0 && wait) {
             cls.demo.eof = true;
             break;
         }
@@ -1138,6 +1127,123 @@ done:
     cls.demo.seeking = false;
 }
 
+/*
+====================
+CL_Seek_f
+====================
+*/
+static void CL_Seek_f(void)
+{
+    int i, frames;
+    int64_t dest;
+    bool byte_seek, back_seek;
+    char *to;
+
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s [+-]<timespec|percent>[%%]\n", Cmd_Argv(0));
+        return;
+    }
+
+#if USE_MVD_CLIENT
+    if (sv_running->integer == ss_broadcast) {
+        Cbuf_InsertText(&cmd_buffer, va("mvdseek \"%s\" @@\n", Cmd_Argv(1)));
+        return;
+    }
+#endif
+
+    if (!cls.demo.playback) {
+        Com_Printf("Not playing a demo.\n");
+        return;
+    }
+
+    to = Cmd_Argv(1);
+
+    if (strchr(to, '%')) {
+        char *suf;
+        float percent = strtof(to, &suf);
+        if (suf == to || strcmp(suf, "%") || !isfinite(percent)) {
+            Com_Printf("Invalid percentage.\n");
+            return;
+        }
+
+        if (!cls.demo.file_size) {
+            Com_Printf("Unknown file size, can't seek.\n");
+            return;
+        }
+
+        percent = Q_clipf(percent, 0, 100);
+        dest = cls.demo.file_offset + cls.demo.file_size * percent / 100;
+
+        byte_seek = true;
+        back_seek = dest < FS_Tell(cls.demo.playback);
+    } else {
+        if (*to == '-' || *to == '+') {
+            // relative to current frame
+            if (!Com_ParseTimespec(to + 1, &frames)) {
+                Com_Printf("Invalid relative timespec.\n");
+                return;
+            }
+            if (*to == '-')
+                frames = -frames;
+            dest = cls.demo.frames_read + frames;
+        } else {
+            // relative to first frame
+            if (!Com_ParseTimespec(to, &i)) {
+                Com_Printf("Invalid absolute timespec.\n");
+                return;
+            }
+            dest = i;
+            frames = i - cls.demo.frames_read;
+        }
+
+        if (!frames)
+            return; // already there
+
+        byte_seek = false;
+        back_seek = frames < 0;
+    }
+
+    seek_demo(dest, byte_seek, back_seek, cl_demowait->integer);
+}
+
+/*
+====================
+CL_DemoIndex_f
+
+Parses the rest of the first map of the demo to build all snapshots, saves
+them into index file and returns to the current frame.
+====================
+*/
+static void CL_DemoIndex_f(void)
+{
+    int frame;
+
+    if (!cls.demo.playback) {
+        Com_Printf("Not playing a demo.\n");
+        return;
+    }
+
+    if (!cls.demo.index.filelen) {
+        Com_Printf("This demo can't be indexed.\n");
+        return;
+    }
+
+    if (cl_demosnaps->integer <= 0) {
+        Com_Printf("Demo snapshots are disabled.\n");
+        return;
+    }
+
+    frame = cls.demo.frames_read;
+    seek_demo(INT64_MAX, false, false, true);
+    if (!cls.demo.playback || !cls.demo.index.filelen)
+        return;
+
+    save_demo_index();
+    Com_Printf("%d snapshots in demo index.\n", cls.demo.numindexed);
+
+    seek_demo(frame, false, true, true);
+}
+
 static void parse_info_string(demoInfo_t *info, int clientNum, int index, const cs_remap_t *csr)
 {
     char string[MAX_QPATH], *p;
@@ -1336,6 +1442,7 @@ static const cmdreg_t c_demo[] = {
     { "suspend", CL_Suspend_f },
     { "resume", CL_Resume_f },
     { "seek", CL_Seek_f },
+    { "demoindex", CL_DemoIndex_f },
 
     { NULL }
 };
@@ -1348,6 +1455,7 @@ CL_InitDemos
 void CL_InitDemos(void)
 {
     cl_demosnaps = Cvar_Get("cl_demosnaps", "10", 0);
+    cl_demoindex = Cvar_Get("cl_demoindex", "1", 0);
     cl_demomsglen = Cvar_Get("cl_demomsglen", va("%d", MAX_PACKETLEN_WRITABLE_DEFAULT), 0);
     cl_demowait = Cvar_Get("cl_demowait", "0", 0);
     cl_demosuspendtoggle = Cvar_Get("cl_demosuspendtoggle", "1", 0);
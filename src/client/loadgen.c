@@ -0,0 +1,834 @@
+/*
+Copyright (C) 2023 Andrey Nazarov
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// loadgen.c -- headless simulated clients for server load testing
+//
+// Each client gets its own UDP socket and speaks vanilla protocol 34 over
+// old netchan. Server frames are parsed and thrown away, only timing and
+// loss statistics are kept.
+//
+
+#include "shared/shared.h"
+#include "common/cmd.h"
+#include "common/common.h"
+#include "common/crc.h"
+#include "common/cvar.h"
+#include "common/files.h"
+#include "common/intreadwrite.h"
+#include "common/msg.h"
+#include "common/net/chan.h"
+#include "common/net/net.h"
+#include "common/protocol.h"
+#include "common/zone.h"
+#include "client/client.h"
+#include "system/system.h"
+
+#define MAX_BOTS            512
+
+#define CONNECT_RETRY       1000    // msec
+#define CONNECT_ATTEMPTS    10
+#define BOT_TIMEOUT         10000   // msec
+
+typedef enum {
+    BS_QUEUED,          // waiting for its turn to connect
+    BS_CHALLENGING,     // sent getchallenge
+    BS_CONNECTING,      // sent connect
+    BS_CONNECTED,       // netchan established, receiving gamestate
+    BS_PRIMED,          // sent begin, waiting for first frame
+    BS_ACTIVE,          // receiving frames, sending moves
+    BS_DROPPED
+} botstate_t;
+
+typedef struct {
+    unsigned    duration;   // msec
+    short       forwardmove, sidemove, upmove;
+    float       pitch, yaw;
+    byte        buttons;
+} botmove_t;
+
+typedef struct {
+    int             number;
+    botstate_t      state;
+    struct pollfd   *socket;
+    netchan_t       netchan;
+    int             qport;
+
+    unsigned        challenge;
+    unsigned        connect_time;
+    int             connect_count;
+
+    int             serverframe;        // last frame received, -1 if none
+    unsigned        last_ack;           // last acknowledged outgoing sequence
+    unsigned        last_rcvd;
+    unsigned        next_send;
+    uint64_t        sent[CMD_BACKUP];   // usec, indexed by outgoing sequence
+
+    usercmd_t       cmds[4];
+    unsigned        cmdnum;
+    botmove_t       move;
+    unsigned        move_end;
+    int             script_pos;
+
+    // statistics
+    unsigned        frames;
+    unsigned        unparsed;
+    unsigned        bytes;
+    unsigned        rtt_count;
+    unsigned        rtt_max;            // usec
+    uint64_t        rtt_total;          // usec
+    uint64_t        last_frame;         // usec
+    unsigned        gap_max;            // usec
+    char            reason[MAX_QPATH];
+} bot_t;
+
+static struct {
+    netadr_t    address;
+    bot_t       *bots;
+    int         numbots;
+    int         packetrate;
+    char        prefix[MAX_CLIENT_NAME];
+    botmove_t   *script;
+    int         scriptlen;
+    unsigned    start_time;
+} lg;
+
+static const char bot_states[][10] = {
+    "queued", "challenge", "connect", "connected", "primed", "active", "dropped"
+};
+
+static void drop_bot(bot_t *b, const char *reason)
+{
+    if (b->state >= BS_CONNECTED) {
+        // send disconnect a few times in case one is lost
+        MSG_WriteByte(clc_stringcmd);
+        MSG_WriteString("disconnect");
+        for (int i = 0; i < 3; i++)
+            Netchan_Transmit(&b->netchan, msg_write.cursize, msg_write.data, 1);
+        SZ_Clear(&msg_write);
+    }
+
+    Netchan_Close(&b->netchan);
+    b->state = BS_DROPPED;
+    Q_strlcpy(b->reason, reason, sizeof(b->reason));
+
+    Com_DPrintf("%s%d dropped: %s\n", lg.prefix, b->number, reason);
+}
+
+static void add_string_cmd(bot_t *b, const char *s)
+{
+    MSG_WriteByte(clc_stringcmd);
+    MSG_WriteString(s);
+    MSG_FlushTo(&b->netchan.message);
+}
+
+// map change, server wants gamestate to be requested again
+static void restart_bot(bot_t *b)
+{
+    b->state = BS_CONNECTED;
+    b->serverframe = -1;
+    add_string_cmd(b, "new");
+}
+
+static void next_move(bot_t *b, unsigned now)
+{
+    botmove_t *m = &b->move;
+
+    if (lg.script) {
+        *m = lg.script[b->script_pos];
+        b->script_pos = (b->script_pos + 1) % lg.scriptlen;
+    } else {
+        // wander around, shooting and jumping now and then
+        m->duration = 500 + Q_rand_uniform(1500);
+        m->forwardmove = Q_rand_uniform(5) ? 400 : 0;
+        m->sidemove = (Q_rand_uniform(3) - 1) * 200;
+        m->upmove = Q_rand_uniform(10) ? 0 : 200;
+        m->pitch = 0;
+        m->yaw = anglemod(m->yaw + crand() * 120);
+        m->buttons = Q_rand_uniform(5) ? 0 : BUTTON_ATTACK;
+    }
+
+    b->move_end = now + m->duration;
+}
+
+static void build_cmd(bot_t *b, unsigned now)
+{
+    usercmd_t *cmd = &b->cmds[++b->cmdnum & 3];
+
+    while (now >= b->move_end)
+        next_move(b, b->move_end ? b->move_end : now);
+
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->msec = min(1000 / lg.packetrate, 250);
+    cmd->buttons = b->move.buttons;
+    cmd->angles[PITCH] = ANGLE2SHORT(b->move.pitch);
+    cmd->angles[YAW] = ANGLE2SHORT(b->move.yaw);
+    cmd->forwardmove = b->move.forwardmove;
+    cmd->sidemove = b->move.sidemove;
+    cmd->upmove = b->move.upmove;
+}
+
+static void send_packet(bot_t *b, unsigned now)
+{
+    usercmd_t *cmd, *oldcmd = NULL;
+    int i, checksumIndex;
+
+    b->sent[b->netchan.outgoing_sequence & CMD_MASK] = Sys_Microseconds();
+
+    if (b->state == BS_ACTIVE) {
+        build_cmd(b, now);
+
+        MSG_WriteByte(clc_move);
+
+        // save the position for a checksum byte
+        checksumIndex = msg_write.cursize;
+        SZ_GetSpace(&msg_write, 1);
+
+        // let the server delta compress from the last frame we got
+        MSG_WriteLong(b->serverframe);
+
+        // send this and the previous cmds in the message, so
+        // if the last packet was dropped, it can be recovered
+        for (i = 2; i >= 0; i--) {
+            cmd = &b->cmds[(b->cmdnum - i) & 3];
+            MSG_WriteDeltaUsercmd(oldcmd, cmd, 0);
+            MSG_WriteByte(0);   // lightlevel
+            oldcmd = cmd;
+        }
+
+        msg_write.data[checksumIndex] = COM_BlockSequenceCRCByte(
+            msg_write.data + checksumIndex + 1,
+            msg_write.cursize - checksumIndex - 1,
+            b->netchan.outgoing_sequence);
+    }
+
+    Netchan_Transmit(&b->netchan, msg_write.cursize, msg_write.data, 1);
+    SZ_Clear(&msg_write);
+}
+
+static void parse_stufftext(bot_t *b, char *text)
+{
+    char *s, *p;
+
+    for (s = text; *s; s = p) {
+        p = Q_strchrnul(s, '\n');
+        if (*p)
+            *p++ = 0;
+
+        // expands $version and friends like real client would
+        Cmd_TokenizeString(s, true);
+
+        if (!strcmp(Cmd_Argv(0), "cmd")) {
+            add_string_cmd(b, Cmd_RawArgs());
+        } else if (!strcmp(Cmd_Argv(0), "precache")) {
+            add_string_cmd(b, va("begin %s", Cmd_Argv(1)));
+            b->state = BS_PRIMED;
+        } else if (!strcmp(Cmd_Argv(0), "reconnect")) {
+            restart_bot(b);
+        } else if (!strcmp(Cmd_Argv(0), "changing")) {
+            b->state = BS_CONNECTED;
+            b->serverframe = -1;
+        } else if (!strcmp(Cmd_Argv(0), "disconnect")) {
+            drop_bot(b, "disconnected by server");
+        }
+    }
+}
+
+static bool parse_serverdata(bot_t *b)
+{
+    int protocol = MSG_ReadLong();
+
+    if (protocol != PROTOCOL_VERSION_DEFAULT) {
+        drop_bot(b, va("unsupported protocol %d", protocol));
+        return false;
+    }
+
+    MSG_ReadLong();             // spawncount
+    MSG_ReadByte();             // attractloop
+    MSG_ReadString(NULL, 0);    // gamedir
+    MSG_ReadShort();            // clientnum
+    MSG_ReadString(NULL, 0);    // levelname
+    return true;
+}
+
+// returns entity number, or -1 if message is malformed
+static int parse_entity(void)
+{
+    entity_state_t es;
+    entity_state_extension_t ext;
+    uint64_t bits;
+    int number;
+
+    number = MSG_ParseEntityBits(&bits, 0);
+    if (number < 0 || number >= MAX_EDICTS)
+        return -1;
+
+    if (number && !(bits & U_REMOVE))
+        MSG_ParseDeltaEntity(&es, &ext, number, bits, 0);
+    return number;
+}
+
+static bool parse_frame(bot_t *b)
+{
+    player_state_t ps;
+    uint64_t now;
+    unsigned gap, rtt;
+    int framenum, number;
+
+    framenum = MSG_ReadLong();
+    MSG_ReadLong();             // deltaframe
+    MSG_ReadByte();             // suppresscount
+    MSG_ReadData(MSG_ReadByte());
+
+    if (MSG_ReadByte() != svc_playerinfo)
+        return false;
+    MSG_ParseDeltaPlayerstate_Default(NULL, &ps, MSG_ReadWord(), 0);
+
+    if (MSG_ReadByte() != svc_packetentities)
+        return false;
+    while ((number = parse_entity()) > 0)
+        ;
+    if (number < 0)
+        return false;
+
+    if (msg_read.readcount > msg_read.cursize)
+        return false;
+
+    now = Sys_Microseconds();
+
+    if (b->state == BS_PRIMED)
+        b->state = BS_ACTIVE;
+    b->serverframe = framenum;
+    b->frames++;
+
+    if (b->last_frame) {
+        gap = now - b->last_frame;
+        b->gap_max = max(b->gap_max, gap);
+    }
+    b->last_frame = now;
+
+    // time from sending a move until the frame that has seen it arrives
+    if (b->netchan.incoming_acknowledged != b->last_ack) {
+        b->last_ack = b->netchan.incoming_acknowledged;
+        rtt = now - b->sent[b->last_ack & CMD_MASK];
+        b->rtt_total += rtt;
+        b->rtt_max = max(b->rtt_max, rtt);
+        b->rtt_count++;
+    }
+
+    return true;
+}
+
+static void parse_message(bot_t *b)
+{
+    char buffer[MAX_STRING_CHARS];
+    int cmd;
+
+    while (1) {
+        if (msg_read.readcount > msg_read.cursize) {
+            b->unparsed++;
+            return;
+        }
+
+        if ((cmd = MSG_ReadByte()) == -1)
+            return;
+
+        switch (cmd) {
+        case svc_nop:
+            break;
+
+        case svc_disconnect:
+            drop_bot(b, "disconnected by server");
+            return;
+
+        case svc_reconnect:
+            Netchan_Close(&b->netchan);
+            b->state = BS_QUEUED;
+            return;
+
+        case svc_print:
+            MSG_ReadByte();
+            // fall through
+        case svc_centerprint:
+        case svc_layout:
+            MSG_ReadString(NULL, 0);
+            break;
+
+        case svc_stufftext:
+            MSG_ReadString(buffer, sizeof(buffer));
+            parse_stufftext(b, buffer);
+            if (b->state == BS_DROPPED)
+                return;
+            break;
+
+        case svc_serverdata:
+            if (!parse_serverdata(b))
+                return;
+            break;
+
+        case svc_configstring:
+            MSG_ReadWord();
+            MSG_ReadString(NULL, 0);
+            break;
+
+        case svc_spawnbaseline:
+            if (parse_entity() <= 0) {
+                b->unparsed++;
+                return;
+            }
+            break;
+
+        case svc_inventory:
+            MSG_ReadData(MAX_ITEMS * 2);
+            break;
+
+        case svc_frame:
+            // the rest are unreliable effects, not worth parsing
+            if (!parse_frame(b))
+                b->unparsed++;
+            return;
+
+        default:
+            // can't skip over this, give up on the rest of packet
+            b->unparsed++;
+            return;
+        }
+    }
+}
+
+static void connectionless_packet(bot_t *b)
+{
+    char string[MAX_STRING_CHARS];
+    char *c;
+
+    MSG_BeginReading();
+    MSG_ReadLong();     // skip the -1
+
+    if (MSG_ReadStringLine(string, sizeof(string)) >= sizeof(string))
+        return;
+
+    Cmd_TokenizeString(string, false);
+    c = Cmd_Argv(0);
+
+    if (!strcmp(c, "challenge")) {
+        if (b->state == BS_CHALLENGING) {
+            b->challenge = Q_atoi(Cmd_Argv(1));
+            b->state = BS_CONNECTING;
+            b->connect_time = 0;    // fire immediately
+            b->connect_count = 0;
+        }
+        return;
+    }
+
+    if (!strcmp(c, "client_connect")) {
+        if (b->state == BS_CONNECTING) {
+            Netchan_Setup(&b->netchan, NS_CLIENT, NETCHAN_OLD, &lg.address,
+                          b->qport, 1024, PROTOCOL_VERSION_DEFAULT);
+            b->netchan.socket = b->socket;
+            b->last_rcvd = Sys_Milliseconds();
+            restart_bot(b);
+        }
+        return;
+    }
+
+    if (!strcmp(c, "print")) {
+        // connection rejected
+        if (b->state == BS_CHALLENGING || b->state == BS_CONNECTING) {
+            MSG_ReadString(string, sizeof(string));
+            drop_bot(b, COM_TrimSpace(string));
+        }
+        return;
+    }
+}
+
+static void read_packets(bot_t *b)
+{
+    while (NET_GetUdpPacket(b->socket)) {
+        if (!NET_IsEqualAdr(&net_from, &lg.address))
+            continue;
+        if (b->state == BS_DROPPED || b->state == BS_QUEUED)
+            continue;
+
+        b->bytes += msg_read.cursize;
+
+        if (msg_read.cursize >= 4 && RL32(msg_read.data) == -1) {
+            connectionless_packet(b);
+            continue;
+        }
+
+        if (b->state < BS_CONNECTED)
+            continue;
+        if (!Netchan_Process(&b->netchan))
+            continue;
+
+        b->last_rcvd = Sys_Milliseconds();
+        parse_message(b);
+    }
+}
+
+// challenges are tracked per IP address on the server,
+// so only one client may go through connection process at a time
+static void run_connect(unsigned now)
+{
+    char userinfo[MAX_INFO_STRING];
+    char data[MAX_PACKETLEN_DEFAULT];
+    size_t len;
+    bot_t *b;
+    int i;
+
+    for (i = 0, b = lg.bots; i < lg.numbots; i++, b++)
+        if (b->state > BS_QUEUED && b->state < BS_CONNECTED)
+            break;
+
+    if (i == lg.numbots) {
+        for (i = 0, b = lg.bots; i < lg.numbots; i++, b++)
+            if (b->state == BS_QUEUED)
+                break;
+        if (i == lg.numbots)
+            return;
+        b->state = BS_CHALLENGING;
+        b->connect_time = 0;
+        b->connect_count = 0;
+    }
+
+    if (b->connect_time && now - b->connect_time < CONNECT_RETRY)
+        return;
+
+    if (b->connect_count++ == CONNECT_ATTEMPTS) {
+        drop_bot(b, "connection timed out");
+        return;
+    }
+
+    b->connect_time = now;
+
+    if (b->state == BS_CHALLENGING) {
+        NET_SendUdpPacket(b->socket, CONST_STR_LEN("\xff\xff\xff\xffgetchallenge\n"), &lg.address);
+        return;
+    }
+
+    Q_snprintf(userinfo, sizeof(userinfo),
+               "\\name\\%s%d\\skin\\male/grunt\\rate\\25000\\msg\\1\\hand\\2\\fov\\90",
+               lg.prefix, b->number);
+    len = Q_snprintf(data, sizeof(data), "\xff\xff\xff\xff" "connect %d %d %u \"%s\"\n",
+                     PROTOCOL_VERSION_DEFAULT, b->qport, b->challenge, userinfo);
+    if (len < sizeof(data))
+        NET_SendUdpPacket(b->socket, data, len, &lg.address);
+}
+
+static void free_bots(void)
+{
+    bot_t *b;
+    int i;
+
+    for (i = 0, b = lg.bots; i < lg.numbots; i++, b++) {
+        if (b->state != BS_DROPPED)
+            drop_bot(b, "stopped");
+        NET_CloseUdpSocket(b->socket);
+    }
+
+    Z_Freep(&lg.bots);
+    Z_Freep(&lg.script);
+    lg.numbots = 0;
+    lg.scriptlen = 0;
+}
+
+/*
+==================
+CL_Frame
+
+Runs simulated clients. Returns number of milliseconds until
+next client needs to send a packet.
+==================
+*/
+unsigned CL_Frame(unsigned msec)
+{
+    unsigned now, interval, remaining = 100;
+    bot_t *b;
+    int i;
+
+    if (!lg.numbots)
+        return remaining;
+
+    for (i = 0, b = lg.bots; i < lg.numbots; i++, b++)
+        read_packets(b);
+
+    // sample time after reading, so that last_rcvd is never ahead of it
+    now = Sys_Milliseconds();
+    interval = 1000 / lg.packetrate;
+
+    run_connect(now);
+
+    for (i = 0, b = lg.bots; i < lg.numbots; i++, b++) {
+        if (b->state < BS_CONNECTED || b->state == BS_DROPPED)
+            continue;
+
+        if (now - b->last_rcvd > BOT_TIMEOUT) {
+            drop_bot(b, "server timed out");
+            continue;
+        }
+
+        if ((int)(now - b->next_send) >= 0) {
+            send_packet(b, now);
+            // don't try to catch up if running late
+            b->next_send += interval;
+            if ((int)(now - b->next_send) >= 0)
+                b->next_send = now + interval;
+        }
+
+        remaining = min(remaining, b->next_send - now);
+    }
+
+    return remaining;
+}
+
+static bool load_script(const char *name)
+{
+    char *data, *s, *p;
+    botmove_t *m;
+    int ret, count;
+
+    ret = FS_LoadFile(name, (void **)&data);
+    if (!data) {
+        Com_Printf("Couldn't load %s: %s\n", name, Q_ErrorString(ret));
+        return false;
+    }
+
+    // one move per line: <msec> <forward> <side> <up> <pitch> <yaw> [buttons]
+    count = 0;
+    for (s = data; *s; s = p) {
+        p = Q_strchrnul(s, '\n');
+        if (*p)
+            *p++ = 0;
+
+        Cmd_TokenizeString(s, false);
+        if (Cmd_Argc() < 6)
+            continue;
+
+        lg.script = Z_Realloc(lg.script, sizeof(*m) * (count + 1));
+        m = &lg.script[count++];
+        m->duration = max(Q_atoi(Cmd_Argv(0)), 1);
+        m->forwardmove = Q_clip_int16(Q_atoi(Cmd_Argv(1)));
+        m->sidemove = Q_clip_int16(Q_atoi(Cmd_Argv(2)));
+        m->upmove = Q_clip_int16(Q_atoi(Cmd_Argv(3)));
+        m->pitch = Q_atof(Cmd_Argv(4));
+        m->yaw = Q_atof(Cmd_Argv(5));
+        m->buttons = Q_atoi(Cmd_Argv(6));
+    }
+
+    FS_FreeFile(data);
+
+    if (!count) {
+        Com_Printf("%s has no moves\n", name);
+        return false;
+    }
+
+    lg.scriptlen = count;
+    return true;
+}
+
+static const cmd_option_t o_loadgen[] = {
+    { "h", "help", "display this message" },
+    { "n:count", "clients", "connect <count> clients (default 8)" },
+    { "p:name", "prefix", "name clients <name>0, <name>1, ... (default bot)" },
+    { "r:rate", "rate", "send <rate> packets per second (default 30)" },
+    { "s:file", "script", "play moves from <file> instead of random ones" },
+    { NULL }
+};
+
+static void CL_LoadGen_c(genctx_t *ctx, int argnum)
+{
+    Cmd_Option_c(o_loadgen, Com_Address_g, ctx, argnum);
+}
+
+static void CL_LoadGen_f(void)
+{
+    char *script = NULL, *prefix = "bot";
+    int count = 8, rate = 30;
+    netadr_t adr;
+    bot_t *b;
+    int i, c;
+
+    while ((c = Cmd_ParseOptions(o_loadgen)) != -1) {
+        switch (c) {
+        case 'h':
+            Cmd_PrintUsage(o_loadgen, "<address[:port]>");
+            Com_Printf("Connect simulated clients to the specified server.\n");
+            Cmd_PrintHelp(o_loadgen);
+            return;
+        case 'n':
+            count = Q_atoi(cmd_optarg);
+            if (count < 1 || count > MAX_BOTS) {
+                Com_Printf("Number of clients must be between 1 and %d.\n", MAX_BOTS);
+                return;
+            }
+            break;
+        case 'p':
+            prefix = cmd_optarg;
+            break;
+        case 'r':
+            rate = Q_atoi(cmd_optarg);
+            if (rate < 1 || rate > 250) {
+                Com_Printf("Packet rate must be between 1 and 250.\n");
+                return;
+            }
+            break;
+        case 's':
+            script = cmd_optarg;
+            break;
+        default:
+            return;
+        }
+    }
+
+    if (!cmd_optarg[0]) {
+        Com_Printf("Missing address argument.\n");
+        Cmd_PrintHint();
+        return;
+    }
+
+    if (lg.numbots) {
+        Com_Printf("Load generator is already running.\n");
+        return;
+    }
+
+    if (!NET_StringToAdr(cmd_optarg, &adr, PORT_SERVER)) {
+        Com_Printf("Bad server address: %s\n", cmd_optarg);
+        return;
+    }
+
+    lg.address = adr;
+    lg.packetrate = rate;
+    Q_strlcpy(lg.prefix, prefix, sizeof(lg.prefix));
+
+    if (script) {
+        // tokenizing script clobbers command arguments
+        char name[MAX_QPATH];
+
+        Q_strlcpy(name, script, sizeof(name));
+        if (!load_script(name))
+            return;
+    }
+
+    lg.bots = Z_Mallocz(sizeof(lg.bots[0]) * count);
+    for (i = 0, b = lg.bots; i < count; i++, b++) {
+        b->socket = NET_OpenUdpSocket(adr.type);
+        if (!b->socket) {
+            Com_Printf("Couldn't open socket for client %d.\n", i);
+            break;
+        }
+        b->number = i;
+        b->state = BS_QUEUED;
+        b->qport = 1 + Q_rand_uniform(0xffff);
+        b->serverframe = -1;
+        b->next_send = i * 1000 / (count * rate);   // spread packets out
+        b->move.yaw = frand() * 360;
+        if (lg.scriptlen)
+            b->script_pos = i % lg.scriptlen;
+    }
+
+    lg.numbots = i;
+    lg.start_time = Sys_Milliseconds();
+
+    if (!lg.numbots) {
+        free_bots();
+        return;
+    }
+
+    for (i = 0, b = lg.bots; i < lg.numbots; i++, b++)
+        b->next_send += lg.start_time;
+
+    Com_Printf("Connecting %d clients to %s.\n", lg.numbots, NET_AdrToString(&adr));
+}
+
+static void CL_LoadGenStop_f(void)
+{
+    if (!lg.numbots) {
+        Com_Printf("Load generator is not running.\n");
+        return;
+    }
+
+    free_bots();
+}
+
+static void CL_LoadGenStats_f(void)
+{
+    unsigned frames = 0, rtt_count = 0, rtt_max = 0, dropped = 0, received = 0;
+    uint64_t rtt_total = 0;
+    unsigned secs, active = 0;
+    const bot_t *b;
+    int i;
+
+    if (!lg.numbots) {
+        Com_Printf("Load generator is not running.\n");
+        return;
+    }
+
+    secs = max((Sys_Milliseconds() - lg.start_time) / 1000, 1);
+
+    Com_Printf(
+        "num state     frames  loss  rtt avg  rtt max  max gap  kB/s\n"
+        "--- --------- ------ ----- -------- -------- -------- -----\n");
+
+    for (i = 0, b = lg.bots; i < lg.numbots; i++, b++) {
+        const netchan_t *chan = &b->netchan;
+
+        Com_Printf("%3d %-9s %6u %5.1f %8.1f %8.1f %8.1f %5u",
+                   b->number, bot_states[b->state], b->frames,
+                   chan->total_received ? chan->total_dropped * 100.0 / chan->total_received : 0.0,
+                   b->rtt_count ? b->rtt_total * 0.001 / b->rtt_count : 0.0,
+                   b->rtt_max * 0.001, b->gap_max * 0.001, b->bytes / 1000 / secs);
+        if (b->state == BS_DROPPED)
+            Com_Printf(" %s", b->reason);
+        if (b->unparsed)
+            Com_Printf(" (%u unparsed)", b->unparsed);
+        Com_Printf("\n");
+
+        if (b->state == BS_ACTIVE)
+            active++;
+        frames += b->frames;
+        dropped += chan->total_dropped;
+        received += chan->total_received;
+        rtt_total += b->rtt_total;
+        rtt_count += b->rtt_count;
+        rtt_max = max(rtt_max, b->rtt_max);
+    }
+
+    Com_Printf("%u of %d clients active, %u frames, %.1f%% loss, "
+               "%.1f msec average rtt, %.1f max\n",
+               active, lg.numbots, frames, received ? dropped * 100.0 / received : 0.0,
+               rtt_count ? rtt_total * 0.001 / rtt_count : 0.0, rtt_max * 0.001);
+}
+
+static const cmdreg_t c_loadgen[] = {
+    { "loadgen", CL_LoadGen_f, CL_LoadGen_c },
+    { "loadgen_stop", CL_LoadGenStop_f },
+    { "loadgen_stats", CL_LoadGenStats_f },
+
+    { NULL }
+};
+
+void CL_Init(void)
+{
+    Cmd_Register(c_loadgen);
+}
+
+void CL_Shutdown(void)
+{
+    if (lg.numbots)
+        free_bots();
+}
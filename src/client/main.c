@@ -2672,6 +2672,7 @@ static const cmdreg_t c_client[] = {
     { "writeconfig", CL_WriteConfig_f, CL_WriteConfig_c },
     { "vid_restart", CL_RestartRefresh_f },
     { "r_reload", CL_ReloadRefresh_f },
+    { "loadstats", CL_LoadStats_f },
 
     //
     // forward to server commands
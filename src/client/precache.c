@@ -22,6 +22,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "client.h"
 
+// timing of the last map load, by asset type
+static struct {
+    unsigned    msec[LOAD_SOUNDS + 1];
+    int         count[LOAD_SOUNDS + 1];
+} load_stats;
+
 /*
 ================
 CL_ParsePlayerSkin
@@ -198,6 +204,9 @@ void CL_RegisterSounds(void)
 {
     int i;
     char    *s;
+    unsigned start;
+
+    start = Sys_Milliseconds();
 
     S_BeginRegistration();
     CL_RegisterTEntSounds();
@@ -208,6 +217,9 @@ void CL_RegisterSounds(void)
         cl.sound_precache[i] = S_RegisterSound(s);
     }
     S_EndRegistration();
+
+    load_stats.count[LOAD_SOUNDS] = i - 1;
+    load_stats.msec[LOAD_SOUNDS] = Sys_Milliseconds() - start;
 }
 
 /*
@@ -318,27 +330,104 @@ void CL_SetSky(void)
 
 /*
 =================
-CL_RegisterImage
+CL_ImageType
 
 Hack to handle RF_CUSTOMSKIN for remaster
 =================
 */
-static qhandle_t CL_RegisterImage(const char *s)
+static imagetype_t CL_ImageType(const char *s, imageflags_t *flags)
 {
+    *flags = IF_NONE;
+
     // if it's in a subdir and has an extension, it's either a sprite or a skin
     // allow /some/pic.pcx escape syntax
     if (cl.csr.extended && *s != '/' && *s != '\\' && *COM_FileExtension(s)) {
-        if (!FS_pathcmpn(s, CONST_STR_LEN("sprites/psx_flare")))
-            return R_RegisterImage(s, IT_SPRITE, IF_DEFAULT_FLARE);
+        if (!FS_pathcmpn(s, CONST_STR_LEN("sprites/psx_flare"))) {
+            *flags = IF_DEFAULT_FLARE;
+            return IT_SPRITE;
+        }
 
         if (!FS_pathcmpn(s, CONST_STR_LEN("sprites/")))
-            return R_RegisterSprite(s);
+            return IT_SPRITE;
 
         if (strchr(s, '/'))
-            return R_RegisterSkin(s);
+            return IT_SKIN;
+    }
+
+    return IT_PIC;
+}
+
+static qhandle_t CL_RegisterImage(const char *s)
+{
+    imageflags_t flags;
+    imagetype_t type = CL_ImageType(s, &flags);
+
+    return R_RegisterImage(s, type, flags);
+}
+
+// start decoding images and player skins on worker threads, while models
+// are being registered
+static void CL_PrefetchImages(void)
+{
+    char name[MAX_QPATH], model[MAX_QPATH], skin[MAX_QPATH];
+    char path[MAX_QPATH];
+    imageflags_t flags;
+    imagetype_t type;
+    const char *s;
+    int i;
+
+    for (i = 1; i < cl.csr.max_images; i++) {
+        s = cl.configstrings[cl.csr.images + i];
+        if (!s[0])
+            break;
+        type = CL_ImageType(s, &flags);
+        R_PrefetchImage(s, type, flags);
+    }
+
+    for (i = 0; i < MAX_CLIENTS; i++) {
+        s = cl.configstrings[cl.csr.playerskins + i];
+        if (!s[0])
+            continue;
+        CL_ParsePlayerSkin(name, model, skin, s);
+        if (Q_concat(path, sizeof(path), "players/", model, "/", skin, ".pcx") < sizeof(path))
+            R_PrefetchImage(path, IT_SKIN, IF_NONE);
     }
+}
+
+// returns msec elapsed since *start and resets it
+static unsigned CL_LoadTime(unsigned *start)
+{
+    unsigned now = Sys_Milliseconds();
+    unsigned msec = now - *start;
 
-    return R_RegisterTempPic(s);
+    *start = now;
+    return msec;
+}
+
+/*
+=================
+CL_LoadStats_f
+
+Prints time spent registering each asset type during the last map load.
+=================
+*/
+void CL_LoadStats_f(void)
+{
+    static const char names[LOAD_SOUNDS + 1][8] = {
+        [LOAD_MAP]     = "world",
+        [LOAD_MODELS]  = "models",
+        [LOAD_IMAGES]  = "images",
+        [LOAD_CLIENTS] = "clients",
+        [LOAD_SOUNDS]  = "sounds",
+    };
+    unsigned total = 0;
+    int i;
+
+    for (i = LOAD_MAP; i <= LOAD_SOUNDS; i++) {
+        Com_Printf("%5d %-8s %6u ms\n", load_stats.count[i], names[i], load_stats.msec[i]);
+        total += load_stats.msec[i];
+    }
+    Com_Printf("%5s %-8s %6u ms\n", "", "total", total);
 }
 
 /*
@@ -350,7 +439,8 @@ Call before entering a new level, or after changing dlls
 */
 void CL_PrepRefresh(void)
 {
-    int         i;
+    int         i, count;
+    unsigned    start;
     char        *name;
 
     if (!cls.ref_initialized)
@@ -358,14 +448,20 @@ void CL_PrepRefresh(void)
     if (!cl.mapname[0])
         return;     // no map loaded
 
+    start = Sys_Milliseconds();
+
     // register models, pics, and skins
     R_BeginRegistration(cl.mapname);
+    load_stats.msec[LOAD_MAP] = CL_LoadTime(&start);
+    load_stats.count[LOAD_MAP] = 1;
+
+    CL_PrefetchImages();
 
     CL_LoadState(LOAD_MODELS);
 
     CL_RegisterTEntModels();
 
-    for (i = 2; i < cl.csr.max_models; i++) {
+    for (i = 2, count = 0; i < cl.csr.max_models; i++) {
         name = cl.configstrings[cl.csr.models + i];
         if (!name[0] && i != MODELINDEX_PLAYER) {
             break;
@@ -374,27 +470,36 @@ void CL_PrepRefresh(void)
             continue;
         }
         cl.model_draw[i] = R_RegisterModel(name);
+        count++;
     }
+    load_stats.msec[LOAD_MODELS] = CL_LoadTime(&start);
+    load_stats.count[LOAD_MODELS] = count;
 
     CL_LoadState(LOAD_IMAGES);
-    for (i = 1; i < cl.csr.max_images; i++) {
+    for (i = 1, count = 0; i < cl.csr.max_images; i++) {
         name = cl.configstrings[cl.csr.images + i];
         if (!name[0]) {
             break;
         }
         cl.image_precache[i] = CL_RegisterImage(name);
+        count++;
     }
+    load_stats.msec[LOAD_IMAGES] = CL_LoadTime(&start);
+    load_stats.count[LOAD_IMAGES] = count;
 
     CL_LoadState(LOAD_CLIENTS);
-    for (i = 0; i < MAX_CLIENTS; i++) {
+    for (i = 0, count = 0; i < MAX_CLIENTS; i++) {
         name = cl.configstrings[cl.csr.playerskins + i];
         if (!name[0]) {
             continue;
         }
         CL_LoadClientinfo(&cl.clientinfo[i], name);
+        count++;
     }
 
     CL_LoadClientinfo(&cl.baseclientinfo, "unnamed\\male/grunt");
+    load_stats.msec[LOAD_CLIENTS] = CL_LoadTime(&start);
+    load_stats.count[LOAD_CLIENTS] = count;
 
     // set sky textures and speed
     CL_SetSky();
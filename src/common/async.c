@@ -18,101 +18,311 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "shared/shared.h"
 #include "common/async.h"
+#include "common/cmd.h"
+#include "common/common.h"
+#include "common/cvar.h"
 #include "common/zone.h"
 #include "system/pthread.h"
+#include "system/system.h"
 
-static bool work_initialized;
-static bool work_terminate;
-static pthread_mutex_t work_lock;
-static pthread_cond_t work_cond;
-static pthread_t work_thread;
-static asyncwork_t *pend_head;
-static asyncwork_t *done_head;
+#define MAX_ASYNC_THREADS   8
 
-static void append_work(asyncwork_t **head, asyncwork_t *work)
+typedef struct asyncjob_s {
+    asyncwork_t         work;
+    unsigned            queued;     // Sys_Milliseconds() when queued
+    struct asyncjob_s   *next;
+} asyncjob_t;
+
+typedef struct {
+    asyncjob_t  *head;
+    asyncjob_t  **tail;
+} asyncqueue_t;
+
+// order in which pending queues are serviced
+static const asyncprio_t prio_order[ASYNC_PRIO_MAX] = {
+    ASYNC_PRIO_HIGH, ASYNC_PRIO_NORMAL, ASYNC_PRIO_LOW
+};
+
+static cvar_t *com_async_threads;
+
+static struct {
+    bool            initialized;
+    bool            terminate;
+    int             numthreads;
+    pthread_t       threads[MAX_ASYNC_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pthread_cond_t  done_cond;  // signaled when job is finished
+
+    asyncqueue_t    pend[ASYNC_PRIO_MAX];
+    asyncqueue_t    done;
+    int             numpending[ASYNC_PRIO_MAX];
+    int             numrunning;
+    unsigned        numstarted;
+    unsigned        total_wait, max_wait;
+
+    // main thread only
+    asyncjob_t      *free;
+    unsigned        numqueued, numdone;
+    unsigned        total_time, max_time;
+} async;
+
+static void init_queue(asyncqueue_t *q)
+{
+    q->head = NULL;
+    q->tail = &q->head;
+}
+
+static void append_job(asyncqueue_t *q, asyncjob_t *job)
 {
-    asyncwork_t *c, **p;
-    for (p = head, c = *head; c; p = &c->next, c = c->next)
-        ;
-    work->next = NULL;
-    *p = work;
+    job->next = NULL;
+    *q->tail = job;
+    q->tail = &job->next;
+}
+
+static asyncjob_t *remove_job(asyncqueue_t *q)
+{
+    asyncjob_t *job = q->head;
+
+    if (job && !(q->head = job->next))
+        q->tail = &q->head;
+
+    return job;
+}
+
+// called with lock held
+static asyncjob_t *next_job(void)
+{
+    for (int i = 0; i < ASYNC_PRIO_MAX; i++) {
+        asyncjob_t *job = remove_job(&async.pend[prio_order[i]]);
+        if (job) {
+            async.numpending[job->work.prio]--;
+            return job;
+        }
+    }
+
+    return NULL;
 }
 
 static void *work_func(void *arg)
 {
-    pthread_mutex_lock(&work_lock);
+    asyncjob_t *job;
+    unsigned wait;
+
+    Com_SetWorkerThread();
+
+    pthread_mutex_lock(&async.lock);
     while (1) {
-        while (!pend_head && !work_terminate)
-            pthread_cond_wait(&work_cond, &work_lock);
+        job = next_job();
+        if (!job) {
+            // finish all pending work before exiting
+            if (async.terminate)
+                break;
+            pthread_cond_wait(&async.cond, &async.lock);
+            continue;
+        }
 
-        asyncwork_t *work = pend_head;
-        if (!work)
-            break;
-        pend_head = work->next;
+        wait = Sys_Milliseconds() - job->queued;
+        async.total_wait += wait;
+        async.max_wait = max(async.max_wait, wait);
+        async.numstarted++;
+        async.numrunning++;
 
-        pthread_mutex_unlock(&work_lock);
-        work->work_cb(work->cb_arg);
-        pthread_mutex_lock(&work_lock);
+        pthread_mutex_unlock(&async.lock);
+        job->work.work_cb(job->work.cb_arg);
+        pthread_mutex_lock(&async.lock);
 
-        append_work(&done_head, work);
+        async.numrunning--;
+        append_job(&async.done, job);
+        pthread_cond_signal(&async.done_cond);
     }
-    pthread_mutex_unlock(&work_lock);
+    pthread_mutex_unlock(&async.lock);
 
     return NULL;
 }
 
-void Com_QueueAsyncWork(asyncwork_t *work)
+static void start_threads(void)
 {
-    if (!work_initialized) {
-        pthread_mutex_init(&work_lock, NULL);
-        pthread_cond_init(&work_cond, NULL);
-        if (pthread_create(&work_thread, NULL, work_func, NULL))
+    int i;
+
+    pthread_mutex_init(&async.lock, NULL);
+    pthread_cond_init(&async.cond, NULL);
+    pthread_cond_init(&async.done_cond, NULL);
+
+    for (i = 0; i < ASYNC_PRIO_MAX; i++)
+        init_queue(&async.pend[i]);
+    init_queue(&async.done);
+
+    async.terminate = false;
+    async.numthreads = Cvar_ClampInteger(com_async_threads, 1, MAX_ASYNC_THREADS);
+    for (i = 0; i < async.numthreads; i++)
+        if (pthread_create(&async.threads[i], NULL, work_func, NULL))
             Com_Error(ERR_FATAL, "Couldn't create async work thread");
-        work_initialized = true;
-    }
 
-    pthread_mutex_lock(&work_lock);
-    append_work(&pend_head, Z_CopyStruct(work));
-    pthread_mutex_unlock(&work_lock);
+    async.initialized = true;
+}
+
+void Com_QueueAsyncWork(asyncwork_t *work)
+{
+    asyncjob_t *job;
+
+    Q_assert(work->prio < ASYNC_PRIO_MAX);
 
-    pthread_cond_signal(&work_cond);
+    if (!async.initialized)
+        start_threads();
+
+    if ((job = async.free))
+        async.free = job->next;
+    else
+        job = Z_Malloc(sizeof(*job));
+
+    job->work = *work;
+    job->queued = Sys_Milliseconds();
+    async.numqueued++;
+
+    pthread_mutex_lock(&async.lock);
+    append_job(&async.pend[work->prio], job);
+    async.numpending[work->prio]++;
+    pthread_mutex_unlock(&async.lock);
+
+    pthread_cond_signal(&async.cond);
+}
+
+// called with lock held
+static bool work_pending(void)
+{
+    for (int i = 0; i < ASYNC_PRIO_MAX; i++)
+        if (async.numpending[i])
+            return true;
+
+    return async.numrunning;
+}
+
+static void complete_jobs(asyncjob_t *job)
+{
+    asyncjob_t *next;
+    unsigned time;
+
+    for (; job; job = next) {
+        next = job->next;
+        if (job->work.done_cb)
+            job->work.done_cb(job->work.cb_arg);
+
+        time = Sys_Milliseconds() - job->queued;
+        async.total_time += time;
+        async.max_time = max(async.max_time, time);
+        async.numdone++;
+
+        job->next = async.free;
+        async.free = job;
+    }
+
+    // print anything workers had to say
+    Com_FlushWorkerPrints();
 }
 
 void Com_CompleteAsyncWork(void)
 {
-    asyncwork_t *work, *next;
+    asyncjob_t *job;
 
-    if (!work_initialized)
+    if (!async.initialized)
         return;
-    if (pthread_mutex_trylock(&work_lock))
+    if (pthread_mutex_trylock(&async.lock))
         return;
-    if (q_unlikely(done_head)) {
-        for (work = done_head; work; work = next) {
-            next = work->next;
-            if (work->done_cb)
-                work->done_cb(work->cb_arg);
-            Z_Free(work);
-        }
-        done_head = NULL;
-    }
-    pthread_mutex_unlock(&work_lock);
+    job = async.done.head;
+    init_queue(&async.done);
+    pthread_mutex_unlock(&async.lock);
+
+    complete_jobs(job);
+}
+
+/*
+==================
+Com_WaitAsyncWork
+
+Blocks until at least one job is finished, then completes all finished jobs.
+Returns immediately if no jobs are queued.
+==================
+*/
+void Com_WaitAsyncWork(void)
+{
+    asyncjob_t *job;
+
+    if (!async.initialized)
+        return;
+
+    pthread_mutex_lock(&async.lock);
+    while (!async.done.head && work_pending())
+        pthread_cond_wait(&async.done_cond, &async.lock);
+    job = async.done.head;
+    init_queue(&async.done);
+    pthread_mutex_unlock(&async.lock);
+
+    complete_jobs(job);
 }
 
 void Com_ShutdownAsyncWork(void)
 {
-    if (!work_initialized)
+    asyncjob_t *job, *next;
+
+    if (!async.initialized)
         return;
 
-    pthread_mutex_lock(&work_lock);
-    work_terminate = true;
-    pthread_mutex_unlock(&work_lock);
+    pthread_mutex_lock(&async.lock);
+    async.terminate = true;
+    pthread_mutex_unlock(&async.lock);
 
-    pthread_cond_signal(&work_cond);
+    pthread_cond_broadcast(&async.cond);
 
-    Q_assert(!pthread_join(work_thread, NULL));
+    for (int i = 0; i < async.numthreads; i++)
+        Q_assert(!pthread_join(async.threads[i], NULL));
     Com_CompleteAsyncWork();
 
-    pthread_mutex_destroy(&work_lock);
-    pthread_cond_destroy(&work_cond);
-    work_initialized = false;
+    for (job = async.free; job; job = next) {
+        next = job->next;
+        Z_Free(job);
+    }
+    async.free = NULL;
+
+    pthread_mutex_destroy(&async.lock);
+    pthread_cond_destroy(&async.cond);
+    pthread_cond_destroy(&async.done_cond);
+    async.initialized = false;
+}
+
+static void Com_AsyncStats_f(void)
+{
+    static const char names[ASYNC_PRIO_MAX][8] = { "normal", "high", "low" };
+    int i, pending[ASYNC_PRIO_MAX], running;
+    unsigned started, total_wait, max_wait;
+
+    if (!async.initialized) {
+        Com_Printf("Async work pool is not running\n");
+        return;
+    }
+
+    pthread_mutex_lock(&async.lock);
+    memcpy(pending, async.numpending, sizeof(pending));
+    running = async.numrunning;
+    started = async.numstarted;
+    total_wait = async.total_wait;
+    max_wait = async.max_wait;
+    pthread_mutex_unlock(&async.lock);
+
+    Com_Printf("%d threads, %d running\n", async.numthreads, running);
+    for (i = 0; i < ASYNC_PRIO_MAX; i++)
+        Com_Printf("%8d pending %s\n", pending[i], names[i]);
+    Com_Printf("%8u queued\n", async.numqueued);
+    Com_Printf("%8u completed\n", async.numdone);
+    if (started)
+        Com_Printf("%8u msec average wait, %u max\n", total_wait / started, max_wait);
+    if (async.numdone)
+        Com_Printf("%8u msec average latency, %u max\n", async.total_time / async.numdone, async.max_time);
+}
+
+void Com_InitAsyncWork(void)
+{
+    com_async_threads = Cvar_Get("com_async_threads", "2", CVAR_NOSET);
+
+    Cmd_AddCommand("asyncstats", Com_AsyncStats_f);
 }
@@ -36,6 +36,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 extern mtexinfo_t nulltexinfo;
 
 static cvar_t *map_visibility_patch;
+static cvar_t *map_visibility_cache;
 
 /*
 ===============================================================================
@@ -157,6 +158,8 @@ static void BSP_PrintStats(const bsp_t *bsp)
 
     if (bsp->vis)
         Com_Printf("%8u : clusters\n", bsp->vis->numclusters);
+    if (bsp->vismatrix)
+        Com_Printf("%8d : vis cache bytes\n", bsp->visrowsize * bsp->vis->numclusters * 2);
 
 #if USE_REF
     const lightgrid_t *grid = &bsp->lightgrid;
@@ -333,6 +336,8 @@ void BSP_Free(bsp_t *bsp)
     Q_assert(bsp->refcount > 0);
     if (--bsp->refcount == 0) {
         Hunk_Free(&bsp->hunk);
+        Z_Free(bsp->vismatrix);
+        Z_Free(bsp->brushplanes);
         List_Remove(&bsp->entry);
         Z_Free(bsp);
     }
@@ -739,6 +744,162 @@ static void BSP_MergeLeafContents(bsp_t *bsp)
             leaf->contents[1] |= leaf->firstleafbrush[j]->contents;
 }
 
+// computes brush bounds from axial sides, which all properly built brushes
+// have. bounds stay infinite along the axis if a side is missing.
+static void BSP_CalcBrushBounds(bsp_t *bsp)
+{
+    mbrush_t *brush;
+    mleaf_t *leaf;
+    int i, j, k;
+
+    for (i = 0, brush = bsp->brushes; i < bsp->numbrushes; i++, brush++) {
+        VectorSet(brush->mins, -1e30f, -1e30f, -1e30f);
+        VectorSet(brush->maxs, 1e30f, 1e30f, 1e30f);
+
+        for (j = 0; j < brush->numsides; j++) {
+            const cplane_t *plane = brush->firstbrushside[j].plane;
+            const vec_t *n = plane->normal;
+
+            for (k = 0; k < 3; k++) {
+                if (n[(k + 1) % 3] || n[(k + 2) % 3])
+                    continue;
+                if (n[k] == 1)
+                    brush->maxs[k] = min(brush->maxs[k], plane->dist);
+                else if (n[k] == -1)
+                    brush->mins[k] = max(brush->mins[k], -plane->dist);
+            }
+        }
+    }
+
+    for (i = 0, leaf = bsp->leafs; i < bsp->numleafs; i++, leaf++) {
+        VectorSet(leaf->brushmins, 1e30f, 1e30f, 1e30f);
+        VectorSet(leaf->brushmaxs, -1e30f, -1e30f, -1e30f);
+
+        for (j = 0; j < leaf->numleafbrushes; j++) {
+            brush = leaf->firstleafbrush[j];
+            for (k = 0; k < 3; k++) {
+                leaf->brushmins[k] = min(leaf->brushmins[k], brush->mins[k]);
+                leaf->brushmaxs[k] = max(leaf->brushmaxs[k], brush->maxs[k]);
+            }
+        }
+    }
+}
+
+static void BSP_DecompressVis(const bsp_t *bsp, byte *out, int cluster, int vis)
+{
+    const byte  *in, *in_end;
+    byte        *out_end;
+    int         c;
+
+    // decompress vis
+    in_end = (const byte *)bsp->vis + bsp->numvisibility;
+    in = (const byte *)bsp->vis + bsp->vis->bitofs[cluster][vis];
+    out_end = out + bsp->visrowsize;
+    do {
+        if (in >= in_end) {
+            goto overrun;
+        }
+        if (*in) {
+            *out++ = *in++;
+            continue;
+        }
+
+        if (in + 1 >= in_end) {
+            goto overrun;
+        }
+        c = in[1];
+        in += 2;
+        if (c > out_end - out) {
+overrun:
+            c = out_end - out;
+        }
+        while (c--) {
+            *out++ = 0;
+        }
+    } while (out < out_end);
+}
+
+/*
+==================
+BSP_BuildVisMatrix
+
+Decompresses all PVS and PHS rows at load time if they fit into the memory
+budget. The matrix is read-only afterwards, so BSP_ClusterVis can be called
+from multiple threads.
+==================
+*/
+static void BSP_BuildVisMatrix(bsp_t *bsp)
+{
+    size_t size, rowsize;
+    int i, numclusters;
+
+    if (!bsp->vis)
+        return;
+
+    numclusters = bsp->vis->numclusters;
+    rowsize = bsp->visrowsize;
+    size = rowsize * numclusters * 2;
+    if (!size || size > (size_t)max(map_visibility_cache->integer, 0) << 20) {
+        Com_DPrintf("%s: not caching %zu bytes of vis\n", bsp->name, size);
+        return;
+    }
+
+    bsp->vismatrix = Z_TagMalloc(size, TAG_CMODEL);
+    for (i = 0; i < numclusters * 2; i++)
+        BSP_DecompressVis(bsp, bsp->vismatrix + i * rowsize, i >> 1, i & 1);
+}
+
+/*
+==================
+BSP_BuildBrushPlanes
+
+Stores brush side planes in SIMD friendly layout. Unused lanes of the last
+block get a plane that is never in front of any point.
+==================
+*/
+static void BSP_BuildBrushPlanes(bsp_t *bsp)
+{
+#if USE_CLIP_SSE
+    mbrush_t *brush;
+    float *out;
+    size_t size;
+    int i, j;
+
+    size = 0;
+    for (i = 0, brush = bsp->brushes; i < bsp->numbrushes; i++, brush++)
+        if (brush->numsides <= MAX_CLIP_SIMD_SIDES)
+            size += (brush->numsides + 3) >> 2;
+
+    if (!size)
+        return;
+
+    bsp->brushplanes = out = Z_TagMalloc(size * CLIP_SIMD_BLOCK * sizeof(float), TAG_CMODEL);
+    for (i = 0, brush = bsp->brushes; i < bsp->numbrushes; i++, brush++) {
+        if (brush->numsides > MAX_CLIP_SIMD_SIDES) {
+            brush->planes = NULL;
+            continue;
+        }
+
+        brush->planes = out;
+        for (j = 0; j < Q_ALIGN(brush->numsides, 4); j++) {
+            float *block = out + (j >> 2) * CLIP_SIMD_BLOCK + (j & 3);
+
+            if (j < brush->numsides) {
+                const cplane_t *plane = brush->firstbrushside[j].plane;
+                block[0] = plane->normal[0];
+                block[4] = plane->normal[1];
+                block[8] = plane->normal[2];
+                block[12] = plane->dist;
+            } else {
+                block[0] = block[4] = block[8] = 0;
+                block[12] = 1e30f;
+            }
+        }
+        out += ((brush->numsides + 3) >> 2) * CLIP_SIMD_BLOCK;
+    }
+#endif
+}
+
 /*
 ==================
 BSP_Load
@@ -886,9 +1047,13 @@ int BSP_Load(const char *name, bsp_t **bsp_p)
 #endif
 
     BSP_MergeLeafContents(bsp);
+    BSP_CalcBrushBounds(bsp);
 
     Hunk_End(&bsp->hunk);
 
+    BSP_BuildVisMatrix(bsp);
+    BSP_BuildBrushPlanes(bsp);
+
     List_Append(&bsp_cache, &bsp->entry);
 
     FS_FreeFile(buf);
@@ -1038,10 +1203,6 @@ void BSP_TransformedLightPoint(lightpoint_t *point, const vec3_t start, const ve
 
 void BSP_ClusterVis(const bsp_t *bsp, visrow_t *mask, int cluster, int vis)
 {
-    const byte  *in, *in_end;
-    byte        *out, *out_end;
-    int         c;
-
     Q_assert(vis == DVIS_PVS || vis == DVIS_PHS);
 
     if (!bsp || !bsp->vis) {
@@ -1056,33 +1217,10 @@ void BSP_ClusterVis(const bsp_t *bsp, visrow_t *mask, int cluster, int vis)
         Com_Error(ERR_DROP, "%s: bad cluster", __func__);
     }
 
-    // decompress vis
-    in_end = (const byte *)bsp->vis + bsp->numvisibility;
-    in = (const byte *)bsp->vis + bsp->vis->bitofs[cluster][vis];
-    out_end = mask->b + bsp->visrowsize;
-    out = mask->b;
-    do {
-        if (in >= in_end) {
-            goto overrun;
-        }
-        if (*in) {
-            *out++ = *in++;
-            continue;
-        }
-
-        if (in + 1 >= in_end) {
-            goto overrun;
-        }
-        c = in[1];
-        in += 2;
-        if (c > out_end - out) {
-overrun:
-            c = out_end - out;
-        }
-        while (c--) {
-            *out++ = 0;
-        }
-    } while (out < out_end);
+    if (bsp->vismatrix)
+        memcpy(mask->b, bsp->vismatrix + (cluster * 2 + vis) * bsp->visrowsize, bsp->visrowsize);
+    else
+        BSP_DecompressVis(bsp, mask->b, cluster, vis);
 
     // apply our ugly PVS patches
     if (map_visibility_patch->integer) {
@@ -1160,6 +1298,7 @@ const mmodel_t *BSP_InlineModel(const bsp_t *bsp, const char *name)
 void BSP_Init(void)
 {
     map_visibility_patch = Cvar_Get("map_visibility_patch", "1", 0);
+    map_visibility_cache = Cvar_Get("map_visibility_cache", "16", 0);
 
     Cmd_AddCommand("bsplist", BSP_List_f);
 
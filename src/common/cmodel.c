@@ -30,6 +30,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/zone.h"
 #include "system/hunk.h"
 
+#if USE_CLIP_SSE
+#include <xmmintrin.h>
+#endif
+
 mtexinfo_t nulltexinfo;
 
 const mleaf_t       nullleaf = { .cluster = -1 };
@@ -39,6 +43,7 @@ static unsigned     checkcount;
 
 static cvar_t       *map_noareas;
 static cvar_t       *map_override_path;
+static cvar_t       *map_trace_stats;
 
 static void    FloodAreaConnections(const cm_t *cm);
 
@@ -265,6 +270,9 @@ static mbrush_t *box_leafbrush;
 static mbrushside_t box_brushsides[6];
 static mleaf_t  box_leaf;
 static mleaf_t  box_emptyleaf;
+#if USE_CLIP_SSE
+static float    box_brushplanes[CLIP_SIMD_BLOCK * 2];
+#endif
 
 /*
 ===================
@@ -321,6 +329,24 @@ static void CM_InitBoxHull(void)
         p->signbits = 1 << (i >> 1);
         p->normal[i >> 1] = -1;
     }
+
+#if USE_CLIP_SSE
+    // dist values are filled in by CM_HeadnodeForBox
+    box_brush.planes = box_brushplanes;
+    for (i = 0; i < 8; i++) {
+        float *block = box_brushplanes + (i >> 2) * CLIP_SIMD_BLOCK + (i & 3);
+
+        if (i < 6) {
+            p = box_brushsides[i].plane;
+            block[0] = p->normal[0];
+            block[4] = p->normal[1];
+            block[8] = p->normal[2];
+        } else {
+            block[0] = block[4] = block[8] = 0;
+            block[12] = 1e30f;
+        }
+    }
+#endif
 }
 
 /*
@@ -346,6 +372,16 @@ const mnode_t *CM_HeadnodeForBox(const vec3_t mins, const vec3_t maxs)
     box_planes[10].dist = mins[2];
     box_planes[11].dist = -mins[2];
 
+    VectorCopy(mins, box_brush.mins);
+    VectorCopy(maxs, box_brush.maxs);
+    VectorCopy(mins, box_leaf.brushmins);
+    VectorCopy(maxs, box_leaf.brushmaxs);
+
+#if USE_CLIP_SSE
+    for (int i = 0; i < 6; i++)
+        box_brushplanes[(i >> 2) * CLIP_SIMD_BLOCK + 12 + (i & 3)] = box_brushsides[i].plane->dist;
+#endif
+
     return box_headnode;
 }
 
@@ -356,31 +392,34 @@ CM_BoxLeafnums
 Fills in a list of all the leafs touched
 =============
 */
-static int              leaf_count, leaf_maxcount;
-static const mleaf_t    **leaf_list;
-static const vec_t      *leaf_mins, *leaf_maxs;
-static const mnode_t    *leaf_topnode;
-
-static void CM_BoxLeafs_r(const mnode_t *node)
+// kept on stack, this is called from multiple threads by server
+typedef struct {
+    int             count, maxcount;
+    const mleaf_t   **list;
+    const vec_t     *mins, *maxs;
+    const mnode_t   *topnode;
+} boxleafs_t;
+
+static void CM_BoxLeafs_r(boxleafs_t *b, const mnode_t *node)
 {
     while (node->plane) {
-        box_plane_t s = BoxOnPlaneSideFast(leaf_mins, leaf_maxs, node->plane);
+        box_plane_t s = BoxOnPlaneSideFast(b->mins, b->maxs, node->plane);
         if (s == BOX_INFRONT) {
             node = node->children[0];
         } else if (s == BOX_BEHIND) {
             node = node->children[1];
         } else {
             // go down both
-            if (!leaf_topnode) {
-                leaf_topnode = node;
+            if (!b->topnode) {
+                b->topnode = node;
             }
-            CM_BoxLeafs_r(node->children[0]);
+            CM_BoxLeafs_r(b, node->children[0]);
             node = node->children[1];
         }
     }
 
-    if (leaf_count < leaf_maxcount) {
-        leaf_list[leaf_count++] = (const mleaf_t *)node;
+    if (b->count < b->maxcount) {
+        b->list[b->count++] = (const mleaf_t *)node;
     }
 }
 
@@ -388,20 +427,19 @@ int CM_BoxLeafs_headnode(const vec3_t mins, const vec3_t maxs,
                          const mleaf_t **list, int listsize,
                          const mnode_t *headnode, const mnode_t **topnode)
 {
-    leaf_list = list;
-    leaf_count = 0;
-    leaf_maxcount = listsize;
-    leaf_mins = mins;
-    leaf_maxs = maxs;
-
-    leaf_topnode = NULL;
+    boxleafs_t b = {
+        .maxcount = listsize,
+        .list = list,
+        .mins = mins,
+        .maxs = maxs,
+    };
 
-    CM_BoxLeafs_r(headnode);
+    CM_BoxLeafs_r(&b, headnode);
 
     if (topnode)
-        *topnode = leaf_topnode;
+        *topnode = b.topnode;
 
-    return leaf_count;
+    return b.count;
 }
 
 /*
@@ -448,12 +486,143 @@ BOX TRACING
 static vec3_t   trace_start, trace_end;
 static vec3_t   trace_offsets[8];
 static vec3_t   trace_extents;
+static vec3_t   trace_absmins, trace_absmaxs;   // bounds of entire move
 
 static trace_t  *trace_trace;
 static int      trace_contents;
 static bool     trace_ispoint;      // optimized case
 static bool     trace_extended;     // remaster fixes
 
+static struct {
+    unsigned    traces;
+    unsigned    leafs;
+    unsigned    leafs_rejected;
+    unsigned    brushes;
+    unsigned    brushes_rejected;
+} trace_stats;
+
+#define TRACE_STAT(x) \
+    do { if (map_trace_stats->integer) trace_stats.x++; } while (0)
+
+// returns true if bounds don't intersect bounds of entire move,
+// so nothing inside them can possibly be hit
+static inline bool CM_TraceOutside(const vec3_t mins, const vec3_t maxs)
+{
+    return mins[0] > trace_absmaxs[0] || maxs[0] < trace_absmins[0]
+        || mins[1] > trace_absmaxs[1] || maxs[1] < trace_absmins[1]
+        || mins[2] > trace_absmaxs[2] || maxs[2] < trace_absmins[2];
+}
+
+#if USE_CLIP_SSE
+
+/*
+================
+CM_BrushDistances
+
+Computes distances of start and end points to all brush side planes pushed
+out for box size, 4 sides at once. Operations are done in the same order as
+in scalar code, so results are bit identical. Returns true if both points
+are in front of any side, and brush can't be hit.
+================
+*/
+static bool CM_BrushDistances(const vec3_t p1, const vec3_t p2, const mbrush_t *brush,
+                              float *d1, float *d2)
+{
+    const float *block = brush->planes;
+    const __m128 zero = _mm_setzero_ps();
+    __m128 nx, ny, nz, dist, neg, ox, oy, oz, t1, t2;
+    int i;
+
+    for (i = 0; i < brush->numsides; i += 4, block += CLIP_SIMD_BLOCK) {
+        nx = _mm_loadu_ps(block + 0);
+        ny = _mm_loadu_ps(block + 4);
+        nz = _mm_loadu_ps(block + 8);
+        dist = _mm_loadu_ps(block + 12);
+
+        if (!trace_ispoint) {
+            // select mins or maxs by normal sign, like trace_offsets[signbits]
+            neg = _mm_cmplt_ps(nx, zero);
+            ox = _mm_or_ps(_mm_and_ps(neg, _mm_set1_ps(trace_offsets[7][0])),
+                           _mm_andnot_ps(neg, _mm_set1_ps(trace_offsets[0][0])));
+            neg = _mm_cmplt_ps(ny, zero);
+            oy = _mm_or_ps(_mm_and_ps(neg, _mm_set1_ps(trace_offsets[7][1])),
+                           _mm_andnot_ps(neg, _mm_set1_ps(trace_offsets[0][1])));
+            neg = _mm_cmplt_ps(nz, zero);
+            oz = _mm_or_ps(_mm_and_ps(neg, _mm_set1_ps(trace_offsets[7][2])),
+                           _mm_andnot_ps(neg, _mm_set1_ps(trace_offsets[0][2])));
+
+            t1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, nx), _mm_mul_ps(oy, ny)), _mm_mul_ps(oz, nz));
+            dist = _mm_sub_ps(dist, t1);
+        }
+
+        t1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p1[0]), nx),
+                                   _mm_mul_ps(_mm_set1_ps(p1[1]), ny)),
+                        _mm_mul_ps(_mm_set1_ps(p1[2]), nz));
+        t1 = _mm_sub_ps(t1, dist);
+
+        t2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p2[0]), nx),
+                                   _mm_mul_ps(_mm_set1_ps(p2[1]), ny)),
+                        _mm_mul_ps(_mm_set1_ps(p2[2]), nz));
+        t2 = _mm_sub_ps(t2, dist);
+
+        // completely in front of face?
+        if (_mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(t1, zero), _mm_cmpge_ps(t2, t1))))
+            return true;
+
+        _mm_storeu_ps(d1 + i, t1);
+        _mm_storeu_ps(d2 + i, t2);
+    }
+
+    return false;
+}
+
+/*
+================
+CM_BrushInFront
+
+Returns true if point is in front of any brush side pushed out for box size.
+================
+*/
+static bool CM_BrushInFront(const vec3_t p1, const mbrush_t *brush)
+{
+    const float *block = brush->planes;
+    const __m128 zero = _mm_setzero_ps();
+    __m128 nx, ny, nz, dist, neg, ox, oy, oz, t1;
+    int i;
+
+    for (i = 0; i < brush->numsides; i += 4, block += CLIP_SIMD_BLOCK) {
+        nx = _mm_loadu_ps(block + 0);
+        ny = _mm_loadu_ps(block + 4);
+        nz = _mm_loadu_ps(block + 8);
+        dist = _mm_loadu_ps(block + 12);
+
+        neg = _mm_cmplt_ps(nx, zero);
+        ox = _mm_or_ps(_mm_and_ps(neg, _mm_set1_ps(trace_offsets[7][0])),
+                       _mm_andnot_ps(neg, _mm_set1_ps(trace_offsets[0][0])));
+        neg = _mm_cmplt_ps(ny, zero);
+        oy = _mm_or_ps(_mm_and_ps(neg, _mm_set1_ps(trace_offsets[7][1])),
+                       _mm_andnot_ps(neg, _mm_set1_ps(trace_offsets[0][1])));
+        neg = _mm_cmplt_ps(nz, zero);
+        oz = _mm_or_ps(_mm_and_ps(neg, _mm_set1_ps(trace_offsets[7][2])),
+                       _mm_andnot_ps(neg, _mm_set1_ps(trace_offsets[0][2])));
+
+        t1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, nx), _mm_mul_ps(oy, ny)), _mm_mul_ps(oz, nz));
+        dist = _mm_sub_ps(dist, t1);
+
+        t1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p1[0]), nx),
+                                   _mm_mul_ps(_mm_set1_ps(p1[1]), ny)),
+                        _mm_mul_ps(_mm_set1_ps(p1[2]), nz));
+        t1 = _mm_sub_ps(t1, dist);
+
+        if (_mm_movemask_ps(_mm_cmpgt_ps(t1, zero)))
+            return true;
+    }
+
+    return false;
+}
+
+#endif // USE_CLIP_SSE
+
 /*
 ================
 CM_ClipBoxToBrush
@@ -469,10 +638,18 @@ static void CM_ClipBoxToBrush(const vec3_t p1, const vec3_t p2, trace_t *trace,
     bool        getout, startout;
     float       f;
     const mbrushside_t  *side, *leadside;
+#if USE_CLIP_SSE
+    float       dists[2][MAX_CLIP_SIMD_SIDES];
+#endif
 
     if (!brush->numsides)
         return;
 
+#if USE_CLIP_SSE
+    if (brush->planes && CM_BrushDistances(p1, p2, brush, dists[0], dists[1]))
+        return;
+#endif
+
     enterfrac = -1;
     leavefrac = 1;
     clipplane = NULL;
@@ -485,19 +662,27 @@ static void CM_ClipBoxToBrush(const vec3_t p1, const vec3_t p2, trace_t *trace,
     for (i = 0; i < brush->numsides; i++, side++) {
         plane = side->plane;
 
-        // FIXME: special case for axial
-        if (!trace_ispoint) {
-            // general box case
-            // push the plane out appropriately for mins/maxs
-            dist = DotProduct(trace_offsets[plane->signbits], plane->normal);
-            dist = plane->dist - dist;
-        } else {
-            // special point case
-            dist = plane->dist;
-        }
+#if USE_CLIP_SSE
+        if (brush->planes) {
+            d1 = dists[0][i];
+            d2 = dists[1][i];
+        } else
+#endif
+        {
+            // FIXME: special case for axial
+            if (!trace_ispoint) {
+                // general box case
+                // push the plane out appropriately for mins/maxs
+                dist = DotProduct(trace_offsets[plane->signbits], plane->normal);
+                dist = plane->dist - dist;
+            } else {
+                // special point case
+                dist = plane->dist;
+            }
 
-        d1 = DotProduct(p1, plane->normal) - dist;
-        d2 = DotProduct(p2, plane->normal) - dist;
+            d1 = DotProduct(p1, plane->normal) - dist;
+            d2 = DotProduct(p2, plane->normal) - dist;
+        }
 
         if (d2 > 0)
             getout = true; // endpoint is not in solid
@@ -571,6 +756,14 @@ static void CM_TestBoxInBrush(const vec3_t p1, trace_t *trace, const mbrush_t *b
     if (!brush->numsides)
         return;
 
+#if USE_CLIP_SSE
+    if (brush->planes) {
+        if (CM_BrushInFront(p1, brush))
+            return;
+        goto inside;
+    }
+#endif
+
     side = brush->firstbrushside;
     for (i = 0; i < brush->numsides; i++, side++) {
         plane = side->plane;
@@ -588,6 +781,9 @@ static void CM_TestBoxInBrush(const vec3_t p1, trace_t *trace, const mbrush_t *b
             return;
     }
 
+#if USE_CLIP_SSE
+inside:
+#endif
     // inside this brush
     trace->startsolid = trace->allsolid = true;
     trace->fraction = 0;
@@ -606,6 +802,11 @@ static void CM_TraceToLeaf(const mleaf_t *leaf)
 
     if (!(leaf->contents[trace_extended] & trace_contents))
         return;
+    TRACE_STAT(leafs);
+    if (CM_TraceOutside(leaf->brushmins, leaf->brushmaxs)) {
+        TRACE_STAT(leafs_rejected);
+        return;
+    }
     // trace line against all brushes in the leaf
     leafbrush = leaf->firstleafbrush;
     for (k = 0; k < leaf->numleafbrushes; k++, leafbrush++) {
@@ -616,6 +817,11 @@ static void CM_TraceToLeaf(const mleaf_t *leaf)
 
         if (!(b->contents & trace_contents))
             continue;
+        TRACE_STAT(brushes);
+        if (CM_TraceOutside(b->mins, b->maxs)) {
+            TRACE_STAT(brushes_rejected);
+            continue;
+        }
         CM_ClipBoxToBrush(trace_start, trace_end, trace_trace, b);
         if (!trace_trace->fraction)
             return;
@@ -634,6 +840,11 @@ static void CM_TestInLeaf(const mleaf_t *leaf)
 
     if (!(leaf->contents[trace_extended] & trace_contents))
         return;
+    TRACE_STAT(leafs);
+    if (CM_TraceOutside(leaf->brushmins, leaf->brushmaxs)) {
+        TRACE_STAT(leafs_rejected);
+        return;
+    }
     // trace line against all brushes in the leaf
     leafbrush = leaf->firstleafbrush;
     for (k = 0; k < leaf->numleafbrushes; k++, leafbrush++) {
@@ -644,6 +855,11 @@ static void CM_TestInLeaf(const mleaf_t *leaf)
 
         if (!(b->contents & trace_contents))
             continue;
+        TRACE_STAT(brushes);
+        if (CM_TraceOutside(b->mins, b->maxs)) {
+            TRACE_STAT(brushes_rejected);
+            continue;
+        }
         CM_TestBoxInBrush(trace_start, trace_trace, b);
         if (!trace_trace->fraction)
             return;
@@ -774,6 +990,15 @@ void CM_BoxTrace(trace_t *trace,
         for (j = 0; j < 3; j++)
             trace_offsets[i][j] = bounds[(i >> j) & 1][j];
 
+    // brushes within DIST_EPSILON of the move can still be hit,
+    // so expand by a safe margin
+    for (i = 0; i < 3; i++) {
+        trace_absmins[i] = min(start[i], end[i]) + mins[i] - 1;
+        trace_absmaxs[i] = max(start[i], end[i]) + maxs[i] + 1;
+    }
+
+    TRACE_STAT(traces);
+
     //
     // check for position test special case
     //
@@ -1137,6 +1362,32 @@ void CM_FatPVS(const cm_t *cm, visrow_t *mask, const vec3_t org)
     }
 }
 
+/*
+=============
+CM_TraceStats_f
+=============
+*/
+static void CM_TraceStats_f(void)
+{
+    unsigned traces = max(trace_stats.traces, 1);
+
+    if (!map_trace_stats->integer) {
+        Com_Printf("Set map_trace_stats to 1 to collect trace statistics.\n");
+        return;
+    }
+
+    Com_Printf("%u traces, per trace:\n", trace_stats.traces);
+    Com_Printf("%8.1f leafs tested, %.1f rejected by bounds\n",
+               (double)trace_stats.leafs / traces,
+               (double)trace_stats.leafs_rejected / traces);
+    Com_Printf("%8.1f brushes tested, %.1f rejected by bounds\n",
+               (double)trace_stats.brushes / traces,
+               (double)trace_stats.brushes_rejected / traces);
+
+    if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "reset"))
+        memset(&trace_stats, 0, sizeof(trace_stats));
+}
+
 /*
 =============
 CM_Init
@@ -1148,4 +1399,7 @@ void CM_Init(void)
 
     map_noareas = Cvar_Get("map_noareas", "0", 0);
     map_override_path = Cvar_Get("map_override_path", "", 0);
+    map_trace_stats = Cvar_Get("map_trace_stats", "0", 0);
+
+    Cmd_AddCommand("tracestats", CM_TraceStats_f);
 }
@@ -48,6 +48,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "server/server.h"
 #include "system/system.h"
 #include "system/hunk.h"
+#include "system/pthread.h"
 
 #if USE_DEBUG
 #include "features.h"
@@ -65,6 +66,13 @@ static char     com_errorMsg[MAXERRORMSG]; // from Com_Printf/Com_Error
 
 static int      com_printEntered;
 
+// messages printed from worker threads are queued here
+static q_thread_local bool  com_workerThread;
+static q_thread_local errortrap_t   *com_errorTrap;
+static pthread_mutex_t      com_printLock = PTHREAD_MUTEX_INITIALIZER;
+static char                 com_printQueue[0x4000];
+static size_t               com_printQueueLen;
+
 static qhandle_t    com_logFile;
 static bool         com_logNewline;
 #if USE_SYSCON
@@ -401,6 +409,10 @@ void Com_SetColor(color_index_t color)
 
 void Com_SetLastError(const char *msg)
 {
+    // buffer is shared, worker threads report errors by return value only
+    if (com_workerThread)
+        return;
+
     if (msg) {
         Q_strlcpy(com_errorMsg, msg, sizeof(com_errorMsg));
     } else {
@@ -421,12 +433,81 @@ Both client and server can use this, and it will output
 to the appropriate place.
 =============
 */
+/*
+=============
+Com_SetWorkerThread
+
+Called by worker threads before they can print anything.
+Their output is queued and printed later by main thread.
+=============
+*/
+void Com_SetWorkerThread(void)
+{
+    com_workerThread = true;
+}
+
+/*
+=============
+Com_SetErrorTrap
+
+Sets error trap for the current thread, or clears it if NULL. Instead of
+being handled, next Com_Error call stores error code and message in the
+trap, clears it and longjmps to trap->jmpbuf. This lets worker threads
+return errors to main thread, which can raise them again.
+=============
+*/
+void Com_SetErrorTrap(errortrap_t *trap)
+{
+    com_errorTrap = trap;
+}
+
+static void queue_print(print_type_t type, const char *msg, size_t len)
+{
+    pthread_mutex_lock(&com_printLock);
+    // type, message and terminating NUL
+    if (len + 2 <= sizeof(com_printQueue) - com_printQueueLen) {
+        char *p = com_printQueue + com_printQueueLen;
+        p[0] = type;
+        memcpy(p + 1, msg, len + 1);
+        com_printQueueLen += len + 2;
+    }
+    pthread_mutex_unlock(&com_printLock);
+}
+
+/*
+=============
+Com_FlushWorkerPrints
+
+Prints messages queued by worker threads.
+=============
+*/
+void Com_FlushWorkerPrints(void)
+{
+    size_t i, len;
+
+    pthread_mutex_lock(&com_printLock);
+    for (i = 0; i < com_printQueueLen; i += len + 2) {
+        len = strlen(com_printQueue + i + 1);
+        Com_LPrintf(com_printQueue[i], "%s", com_printQueue + i + 1);
+    }
+    com_printQueueLen = 0;
+    pthread_mutex_unlock(&com_printLock);
+}
+
 void Com_LPrintf(print_type_t type, const char *fmt, ...)
 {
     va_list     argptr;
     char        msg[MAXPRINTMSG];
     size_t      len;
 
+    if (q_unlikely(com_workerThread)) {
+        va_start(argptr, fmt);
+        len = Q_vscnprintf(msg, sizeof(msg), fmt, argptr);
+        va_end(argptr);
+        queue_print(type, msg, len);
+        return;
+    }
+
     // may be entered recursively only once
     if (com_printEntered >= 2) {
         return;
@@ -514,6 +595,17 @@ void Com_Error(error_type_t code, const char *fmt, ...)
     char            msg[MAXERRORMSG];
     va_list         argptr;
     size_t          len;
+    errortrap_t     *trap = com_errorTrap;
+
+    // return to the code that set the trap
+    if (trap) {
+        com_errorTrap = NULL;
+        trap->code = code;
+        va_start(argptr, fmt);
+        Q_vsnprintf(trap->msg, sizeof(trap->msg), fmt, argptr);
+        va_end(argptr);
+        longjmp(trap->jmpbuf, -1);
+    }
 
     // may not be entered recursively
     if (com_errorEntered) {
@@ -1011,6 +1103,7 @@ void Qcommon_Init(int argc, char **argv)
     NET_Init();
     BSP_Init();
     CM_Init();
+    Com_InitAsyncWork();
     SV_Init();
     CL_Init();
     TST_Init();
@@ -1072,6 +1165,7 @@ void Qcommon_Frame(void)
     }
 
     Com_CompleteAsyncWork();
+    Com_FlushWorkerPrints();
 
 #if USE_CLIENT
     time_before = time_event = time_between = time_after = 0;
@@ -1136,6 +1230,14 @@ void Qcommon_Frame(void)
 
     remaining = SV_Frame(msec);
 
+    // send UDP packets queued by server
+    NET_FlushPackets(NS_SERVER);
+
+#if USE_LOADGEN
+    // run simulated clients
+    remaining = min(remaining, CL_Frame(msec));
+#endif
+
 #if USE_CLIENT
     if (host_speeds->integer)
         time_between = Sys_Milliseconds();
@@ -72,7 +72,7 @@ uint16_t CRC_Block(const byte *start, size_t count)
     return crc;
 }
 
-#if USE_CLIENT
+#if USE_CLIENT || USE_LOADGEN
 
 static const byte chktbl[1024] = {
     0x84, 0x47, 0x51, 0xc1, 0x93, 0x22, 0x21, 0x24, 0x2f, 0x66, 0x60, 0x4d, 0xb0, 0x7c, 0xda,
@@ -182,4 +182,4 @@ byte COM_BlockSequenceCRCByte(const byte *base, size_t length, int sequence)
     return crc;
 }
 
-#endif // USE_CLIENT
+#endif // USE_CLIENT || USE_LOADGEN
@@ -0,0 +1,241 @@
+/*
+Copyright (C) 2023 Andrey Nazarov
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// demoindex.c -- persistent demo seek index
+//
+// Index file is stored next to the demo with `.idx' extension appended and
+// contains snapshots built during demo playback, so that seeking doesn't
+// require parsing the demo from the beginning next time it is played.
+// Snapshots always form a prefix of the demo, later playback may extend it.
+//
+
+#include "shared/shared.h"
+#include "common/common.h"
+#include "common/demoindex.h"
+#include "common/files.h"
+#include "common/intreadwrite.h"
+#include "common/mdfour.h"
+#include "common/protocol.h"
+
+#define DEMOINDEX_IDENT     MakeLittleLong('D','I','D','X')
+#define DEMOINDEX_VERSION   1
+
+#define DEMOINDEX_HEADER    32
+#define DEMOINDEX_SNAPHDR   16
+
+// only the beginning of demo header is checksummed
+#define DEMOINDEX_CHECKLEN  0x10000
+
+/*
+==================
+Com_GetDemoInfo
+
+Fills in information identifying the demo file. File position is preserved.
+==================
+*/
+int Com_GetDemoInfo(qhandle_t f, int64_t filelen, int64_t fileofs, demoinfo_t *info)
+{
+    size_t len = min(fileofs, DEMOINDEX_CHECKLEN);
+    byte *buf;
+    int ret;
+
+    ret = FS_Seek(f, 0, SEEK_SET);
+    if (ret < 0)
+        return ret;
+
+    buf = Z_Malloc(len);
+    ret = FS_Read(buf, len, f);
+    if (ret == len) {
+        info->filelen = filelen;
+        info->fileofs = fileofs;
+        info->checksum = Com_BlockChecksum(buf, len);
+    }
+    Z_Free(buf);
+
+    if (ret >= 0 && ret != len)
+        ret = Q_ERR_UNEXPECTED_EOF;
+    if (ret < 0) {
+        FS_Seek(f, fileofs, SEEK_SET);
+        return ret;
+    }
+
+    return FS_Seek(f, fileofs, SEEK_SET);
+}
+
+static void free_snapshots(demosnap_t **snapshots, int count)
+{
+    for (int i = 0; i < count; i++)
+        Z_Free(snapshots[i]);
+    Z_Free(snapshots);
+}
+
+/*
+==================
+Com_LoadDemoIndex
+
+Loads snapshots from index file for the demo. Returns number of snapshots
+loaded, or negative error code if index is missing, doesn't match the demo
+or is corrupt. Snapshots array is allocated in MIN_SNAPSHOTS increments.
+==================
+*/
+int Com_LoadDemoIndex(const char *name, const demoinfo_t *info,
+                      demosnap_t ***snapshots_p, memtag_t tag)
+{
+    char path[MAX_OSPATH];
+    byte header[DEMOINDEX_HEADER];
+    demosnap_t **snapshots = NULL, *snap;
+    int64_t filepos, lastpos;
+    int i, ret, count, framenum, lastnum;
+    unsigned msglen;
+    qhandle_t f;
+
+    if (Q_concat(path, sizeof(path), name, ".idx") >= sizeof(path))
+        return Q_ERR(ENAMETOOLONG);
+
+    ret = FS_OpenFile(path, &f, FS_MODE_READ);
+    if (!f)
+        return ret;
+
+    ret = FS_Read(header, sizeof(header), f);
+    if (ret != sizeof(header))
+        goto fail;
+
+    ret = Q_ERR_UNKNOWN_FORMAT;
+    if (RL32(header) != DEMOINDEX_IDENT || RL32(header + 4) != DEMOINDEX_VERSION)
+        goto fail;
+
+    ret = Q_ERR_INVALID_FORMAT;
+    if (RL64(header + 8) != info->filelen || RL64(header + 16) != info->fileofs ||
+        RL32(header + 24) != info->checksum)
+        goto fail;
+
+    // each snapshot takes at least DEMOINDEX_SNAPHDR + 1 bytes, don't
+    // allocate more than the file can possibly hold
+    count = RL32(header + 28);
+    if (count < 1 || count > MAX_SNAPSHOTS ||
+        count > (FS_Length(f) - DEMOINDEX_HEADER) / (DEMOINDEX_SNAPHDR + 1))
+        goto fail;
+
+    snapshots = Z_TagMalloc(sizeof(snapshots[0]) * Q_ALIGN(count, MIN_SNAPSHOTS), tag);
+
+    lastnum = INT_MIN;
+    lastpos = 0;
+    for (i = 0; i < count; i++) {
+        ret = FS_Read(header, DEMOINDEX_SNAPHDR, f);
+        if (ret != DEMOINDEX_SNAPHDR)
+            break;
+
+        framenum = RL32(header);
+        msglen = RL32(header + 4);
+        filepos = RL64(header + 8);
+
+        // snapshots must be in order and point inside the demo
+        ret = Q_ERR_INVALID_FORMAT;
+        if (framenum <= lastnum || filepos < lastpos || filepos < info->fileofs ||
+            filepos > info->filelen || !msglen || msglen > MAX_MSGLEN)
+            break;
+
+        snap = Z_TagMalloc(sizeof(*snap) + msglen - 1, tag);
+        snap->framenum = framenum;
+        snap->filepos = filepos;
+        snap->msglen = msglen;
+        snapshots[i] = snap;
+
+        ret = FS_Read(snap->data, msglen, f);
+        if (ret != msglen) {
+            i++;
+            break;
+        }
+
+        lastnum = framenum;
+        lastpos = filepos;
+    }
+
+    if (i < count) {
+        free_snapshots(snapshots, i);
+        goto fail;
+    }
+
+    FS_CloseFile(f);
+    *snapshots_p = snapshots;
+    return count;
+
+fail:
+    FS_CloseFile(f);
+    if (ret >= 0)
+        ret = Q_ERR_UNEXPECTED_EOF;
+    Com_DPrintf("Couldn't load %s: %s\n", path, Q_ErrorString(ret));
+    return ret;
+}
+
+/*
+==================
+Com_SaveDemoIndex
+
+Writes snapshots into index file for the demo.
+==================
+*/
+int Com_SaveDemoIndex(const char *name, const demoinfo_t *info,
+                      demosnap_t **snapshots, int numsnapshots)
+{
+    char path[MAX_OSPATH];
+    byte header[DEMOINDEX_HEADER];
+    demosnap_t *snap;
+    qhandle_t f;
+    int i, ret;
+
+    if (Q_concat(path, sizeof(path), name, ".idx") >= sizeof(path))
+        return Q_ERR(ENAMETOOLONG);
+
+    ret = FS_OpenFile(path, &f, FS_MODE_WRITE);
+    if (!f)
+        goto fail;
+
+    WL32(header, DEMOINDEX_IDENT);
+    WL32(header + 4, DEMOINDEX_VERSION);
+    WL64(header + 8, info->filelen);
+    WL64(header + 16, info->fileofs);
+    WL32(header + 24, info->checksum);
+    WL32(header + 28, numsnapshots);
+    ret = FS_Write(header, sizeof(header), f);
+
+    for (i = 0; i < numsnapshots && ret >= 0; i++) {
+        snap = snapshots[i];
+        WL32(header, snap->framenum);
+        WL32(header + 4, snap->msglen);
+        WL64(header + 8, snap->filepos);
+        ret = FS_Write(header, DEMOINDEX_SNAPHDR, f);
+        if (ret >= 0)
+            ret = FS_Write(snap->data, snap->msglen, f);
+    }
+
+    if (ret >= 0)
+        ret = FS_CloseFile(f);
+    else
+        FS_CloseFile(f);
+
+    if (ret >= 0) {
+        Com_DPrintf("Wrote %d snapshots to %s\n", numsnapshots, path);
+        return 0;
+    }
+
+fail:
+    Com_EPrintf("Couldn't write %s: %s\n", path, Q_ErrorString(ret));
+    return ret;
+}
@@ -52,6 +52,9 @@ static const char *Com_GetFeatures(void)
 #if USE_PNG
     "libpng "
 #endif
+#if USE_LOADGEN
+    "load-generator "
+#endif
 #if USE_MD3
     "md3 "
 #endif
@@ -128,6 +128,8 @@ typedef struct {
     filetype_t  type;       // FS_PAK or FS_ZIP
     unsigned    refcount;   // for tracking pack users
     FILE        *fp;
+    byte        *map;       // entire pack mapped into memory, may be NULL
+    int64_t     mapsize;
     unsigned    num_files;
     unsigned    hash_size;
     packfile_t  *files;
@@ -152,6 +154,7 @@ typedef struct {
 #endif
     packfile_t  *entry;     // pack entry this handle is tied to
     pack_t      *pack;      // points to the pack entry is from
+    const byte  *data;      // FS_PAK entry data if pack is mapped
     int         error;      // stream error indicator from read/write operation
     int64_t     position;   // reading position for FS_PAK/FS_ZIP
     int64_t     length;     // total cached file length
@@ -185,18 +188,22 @@ static unsigned     fs_count_read;
 static unsigned     fs_count_open;
 static unsigned     fs_count_strcmp;
 static unsigned     fs_count_strlwr;
+static unsigned     fs_count_mapped;
 #define FS_COUNT_READ       fs_count_read++
 #define FS_COUNT_OPEN       fs_count_open++
 #define FS_COUNT_STRCMP     fs_count_strcmp++
 #define FS_COUNT_STRLWR     fs_count_strlwr++
+#define FS_COUNT_MAPPED     fs_count_mapped++
 #else
 #define FS_COUNT_READ       (void)0
 #define FS_COUNT_OPEN       (void)0
 #define FS_COUNT_STRCMP     (void)0
 #define FS_COUNT_STRLWR     (void)0
+#define FS_COUNT_MAPPED     (void)0
 #endif
 
 static cvar_t       *fs_autoexec;
+static cvar_t       *fs_mmap;
 
 #if USE_DEBUG
 static cvar_t       *fs_debug;
@@ -535,7 +542,7 @@ static int seek_pak_file(file_t *file, int64_t offset, int whence)
     if (entry->filepos > INT64_MAX - offset)
         return Q_ERR(EOVERFLOW);
 
-    if (os_fseek(file->fp, entry->filepos + offset, SEEK_SET))
+    if (!file->data && os_fseek(file->fp, entry->filepos + offset, SEEK_SET))
         return Q_ERRNO;
 
     file->position = offset;
@@ -652,7 +659,9 @@ int FS_CloseFile(qhandle_t f)
             ret = Q_ERRNO;
         break;
     case FS_PAK:
-        if (IS_UNIQUE(file)) {
+        if (file->data) {
+            pack_put(file->pack);
+        } else if (IS_UNIQUE(file)) {
             fclose(file->fp);
             pack_put(file->pack);
         } else {
@@ -919,7 +928,7 @@ fail:
 
 #if USE_ZLIB
 
-static int check_header_coherency(FILE *fp, packfile_t *entry)
+static int check_header_coherency(const pack_t *pack, FILE *fp, packfile_t *entry)
 {
     unsigned ofs, flags, comp_mtd, comp_len, file_len, name_size, xtra_size;
     byte header[ZIP_SIZELOCALHEADER];
@@ -934,10 +943,16 @@ static int check_header_coherency(FILE *fp, packfile_t *entry)
     if (entry->compmtd != 0 && entry->compmtd != Z_DEFLATED)
         return Q_ERR_BAD_COMPRESSION;
 
-    if (os_fseek(fp, entry->filepos, SEEK_SET))
-        return Q_ERRNO;
-    if (!fread(header, sizeof(header), 1, fp))
-        return FS_ERR_READ(fp);
+    if (pack->map) {
+        if (entry->filepos > pack->mapsize - ZIP_SIZELOCALHEADER)
+            return Q_ERR_UNEXPECTED_EOF;
+        memcpy(header, pack->map + entry->filepos, sizeof(header));
+    } else {
+        if (os_fseek(fp, entry->filepos, SEEK_SET))
+            return Q_ERRNO;
+        if (!fread(header, sizeof(header), 1, fp))
+            return FS_ERR_READ(fp);
+    }
 
     // check the magic
     if (RL32(&header[0]) != ZIP_LOCALHEADERMAGIC)
@@ -1124,12 +1139,69 @@ static int seek_zip_file(file_t *file, int64_t offset, int whence)
 #define entry_compmtd(entry)  0
 #endif
 
+// open a new file on the mapped pakfile, stored entries only
+static int64_t open_from_map(file_t *file, pack_t *pack, packfile_t *entry)
+{
+    int64_t len;
+    int ret;
+
+#if USE_ZLIB
+    if (pack->type == FS_ZIP) {
+        ret = check_header_coherency(pack, NULL, entry);
+        if (ret) {
+            goto fail;
+        }
+    }
+#endif
+
+    if ((file->mode & FS_FLAG_DEFLATE) && !entry_compmtd(entry)) {
+        ret = Q_ERR_BAD_COMPRESSION;
+        goto fail;
+    }
+
+#if USE_ZLIB
+    if (file->mode & FS_FLAG_DEFLATE)
+        len = entry->complen;   // server wants raw deflated data for downloads
+    else
+#endif
+        len = entry->filelen;
+
+    if (entry->filepos > pack->mapsize || len > pack->mapsize - entry->filepos) {
+        ret = Q_ERR_UNEXPECTED_EOF;
+        goto fail;
+    }
+
+    file->type = FS_PAK;
+    file->fp = NULL;
+    file->data = pack->map + entry->filepos;
+    file->entry = entry;
+    file->pack = pack_get(pack);
+    file->error = Q_ERR_SUCCESS;
+    file->position = 0;
+    file->length = len;
+
+    FS_COUNT_MAPPED;
+
+    FS_DPrintf("%s: %s/%s: %"PRId64" bytes\n",
+               __func__, pack->filename, pack->names + entry->nameofs, file->length);
+
+    return file->length;
+
+fail:
+    FS_DPrintf("%s: %s/%s: %s\n", __func__, pack->filename, pack->names + entry->nameofs, Q_ErrorString(ret));
+    return ret;
+}
+
 // open a new file on the pakfile
 static int64_t open_from_pack(file_t *file, pack_t *pack, packfile_t *entry)
 {
     FILE *fp;
     int ret;
 
+    // deflated entries are read through stdio even if pack is mapped
+    if (pack->map && (!entry_compmtd(entry) || (file->mode & FS_FLAG_DEFLATE)))
+        return open_from_map(file, pack, entry);
+
     if (IS_UNIQUE(file)) {
         fp = fopen(pack->filename, "rb");
         if (!fp) {
@@ -1147,7 +1219,7 @@ static int64_t open_from_pack(file_t *file, pack_t *pack, packfile_t *entry)
 
 #if USE_ZLIB
     if (pack->type == FS_ZIP) {
-        ret = check_header_coherency(fp, entry);
+        ret = check_header_coherency(pack, fp, entry);
         if (ret) {
             goto fail2;
         }
@@ -1448,6 +1520,12 @@ static int read_pak_file(file_t *file, void *buf, size_t len)
         return 0;
     }
 
+    if (file->data) {
+        memcpy(buf, file->data + file->position, len);
+        file->position += len;
+        return len;
+    }
+
     result = fread(buf, 1, len, file->fp);
     if (result != len) {
         file->error = FS_ERR_READ(file->fp);
@@ -1524,6 +1602,151 @@ int FS_Read(void *buf, size_t len, qhandle_t f)
     }
 }
 
+/*
+=================
+FS_RawFile
+
+Returns opaque pointer to file if it is read without decompression (file on
+disk, stored or raw deflated packed file) through its own stdio stream or
+memory mapping, NULL otherwise. Such file can be read with FS_ReadRaw from
+any thread without touching handle table or allocating memory, as long as
+handle is not used otherwise until reading is finished.
+=================
+*/
+void *FS_RawFile(qhandle_t f)
+{
+    file_t *file = file_for_handle(f);
+
+    if (!file)
+        return NULL;
+
+    if ((file->mode & FS_MODE_MASK) != FS_MODE_READ)
+        return NULL;
+
+    if ((file->type != FS_REAL && file->type != FS_PAK) || !IS_UNIQUE(file))
+        return NULL;
+
+    return file;
+}
+
+int FS_ReadRaw(void *raw, void *buf, size_t len)
+{
+    file_t *file = raw;
+
+    if (file->error)
+        return file->error;
+
+    if (len > INT_MAX)
+        return Q_ERR(EINVAL);
+
+    if (file->type == FS_REAL)
+        return read_phys_file(file, buf, len);
+
+    return read_pak_file(file, buf, len);
+}
+
+#if USE_ZLIB
+// inflates raw deflated packed file without touching the zone allocator
+static int inflate_raw_file(file_t *file, byte *out, size_t outlen)
+{
+    byte buffer[0x4000];
+    z_stream z = { 0 };
+    int ret, result;
+
+    if (inflateInit2(&z, -MAX_WBITS) != Z_OK)
+        return Q_ERR_INFLATE_FAILED;
+
+    if (file->data) {
+        z.next_in = (byte *)file->data;
+        z.avail_in = file->length;
+        file->position = file->length;
+    }
+
+    z.next_out = out;
+    z.avail_out = outlen;
+
+    do {
+        if (!z.avail_in) {
+            result = read_pak_file(file, buffer, sizeof(buffer));
+            if (result <= 0) {
+                ret = result ? result : Q_ERR_UNEXPECTED_EOF;
+                break;
+            }
+            z.next_in = buffer;
+            z.avail_in = result;
+        }
+
+        ret = inflate(&z, Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            ret = Q_ERR_INFLATE_FAILED;
+            break;
+        }
+        if (!z.avail_out) {
+            ret = Q_ERR_SUCCESS;
+            break;
+        }
+        if (ret == Z_STREAM_END) {
+            ret = Q_ERR_UNEXPECTED_EOF;
+            break;
+        }
+    } while (1);
+
+    inflateEnd(&z);
+    return ret;
+}
+#endif
+
+/*
+=================
+FS_LoadRaw
+
+Reads the whole file returned by FS_RawFile into NUL terminated buffer
+allocated with malloc(), inflating raw deflated data. Can be called from
+any thread, like FS_ReadRaw. Returns file length or error code.
+=================
+*/
+int FS_LoadRaw(void *raw, void **buffer)
+{
+    file_t *file = raw;
+    int64_t len = file->length;
+    byte *buf;
+    int ret;
+
+    *buffer = NULL;
+
+#if USE_ZLIB
+    if (file->mode & FS_FLAG_DEFLATE)
+        len = file->entry->filelen;
+#endif
+
+    if (len > MAX_LOADFILE)
+        return Q_ERR(EFBIG);
+
+    buf = malloc(len + 1);
+    if (!buf)
+        return Q_ERR(ENOMEM);
+
+#if USE_ZLIB
+    if (file->mode & FS_FLAG_DEFLATE)
+        ret = inflate_raw_file(file, buf, len);
+    else
+#endif
+    {
+        ret = FS_ReadRaw(raw, buf, len);
+        if (ret >= 0)
+            ret = ret == len ? Q_ERR_SUCCESS : Q_ERR_UNEXPECTED_EOF;
+    }
+
+    if (ret < 0) {
+        free(buf);
+        return ret;
+    }
+
+    buf[len] = 0;
+    *buffer = buf;
+    return len;
+}
+
 int FS_ReadLine(qhandle_t f, char *buffer, size_t size)
 {
     file_t *file = file_for_handle(f);
@@ -2024,6 +2247,8 @@ int FS_FPrintf(qhandle_t f, const char *format, ...)
 
 static void pack_free(pack_t *pack)
 {
+    if (pack->map)
+        Sys_UnmapFile(pack->map, pack->mapsize);
     fclose(pack->fp);
     Z_Free(pack->names);
     Z_Free(pack->file_hash);
@@ -2063,6 +2288,8 @@ static pack_t *pack_alloc(FILE *fp, filetype_t type, const char *name,
     pack->type = type;
     pack->refcount = 0;
     pack->fp = fp;
+    pack->map = NULL;
+    pack->mapsize = 0;
     pack->num_files = num_files;
     pack->files = FS_Malloc(num_files * sizeof(pack->files[0]));
     pack->hash_size = 0;
@@ -2073,6 +2300,26 @@ static pack_t *pack_alloc(FILE *fp, filetype_t type, const char *name,
     return pack;
 }
 
+// maps entire pack into memory if possible
+static void pack_map(pack_t *pack)
+{
+    int64_t size;
+
+    if (!fs_mmap->integer)
+        return;
+
+    if (os_fseek(pack->fp, 0, SEEK_END))
+        return;
+
+    size = os_ftell(pack->fp);
+    if (size <= 0 || size > SIZE_MAX)
+        return;
+
+    pack->map = Sys_MapFile(pack->fp, size);
+    if (pack->map)
+        pack->mapsize = size;
+}
+
 // allocates hash table and inserts all filenames into it
 static void pack_calc_hashes(pack_t *pack)
 {
@@ -2194,6 +2441,8 @@ static pack_t *load_pak_file(const char *packfile)
 
     pack_calc_hashes(pack);
 
+    pack_map(pack);
+
     FS_DPrintf("%s: %u files, %u hash\n",
                packfile, pack->num_files, pack->hash_size);
 
@@ -2510,6 +2759,7 @@ static pack_t *load_zip_file(const char *packfile)
     pack->names = Z_Realloc(pack->names, names_len);
 
     pack_calc_hashes(pack);
+    pack_map(pack);
 
     FS_DPrintf("%s: %u files, %u skipped, %u hash%s\n",
                packfile, pack->num_files, (int)(num_files_cd - num_files),
@@ -3294,13 +3544,19 @@ static void FS_Stats_f(void)
     packfile_t *file, *max = NULL;
     int i;
     int len, maxLen = 0;
-    int totalHashSize, totalLen;
+    int totalHashSize, totalLen, numMapped;
+    int64_t mappedBytes;
 
-    totalHashSize = totalLen = 0;
+    totalHashSize = totalLen = numMapped = 0;
+    mappedBytes = 0;
     for (path = fs_searchpaths; path; path = path->next) {
         if (!(pack = path->pack)) {
             continue;
         }
+        if (pack->map) {
+            mappedBytes += pack->mapsize;
+            numMapped++;
+        }
         for (i = 0; i < pack->hash_size; i++) {
             if (!(file = pack->file_hash[i])) {
                 continue;
@@ -3325,6 +3581,8 @@ static void FS_Stats_f(void)
     Com_Printf("Total path comparisons: %u\n", fs_count_strcmp);
     Com_Printf("Total calls to open_from_disk: %u\n", fs_count_open);
     Com_Printf("Total mixed-case reopens: %u\n", fs_count_strlwr);
+    Com_Printf("Total opens from mapped packs: %u\n", fs_count_mapped);
+    Com_Printf("Mapped %"PRId64" bytes in %d packs\n", mappedBytes, numMapped);
 
     if (!totalHashSize) {
         Com_Printf("No stats to display\n");
@@ -3806,6 +4064,7 @@ void FS_Init(void)
     Cmd_Register(c_fs);
 
     fs_autoexec = Cvar_Get("fs_autoexec", "1", 0);
+    fs_mmap = Cvar_Get("fs_mmap", "1", 0);
 
 #if USE_DEBUG
     fs_debug = Cvar_Get("fs_debug", "0", 0);
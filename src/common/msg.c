@@ -32,7 +32,8 @@ Handles byte ordering and avoids alignment errors
 ==============================================================================
 */
 
-sizebuf_t   msg_write;
+// thread local to allow building client frames in parallel
+q_thread_local sizebuf_t msg_write;
 byte        msg_write_buffer[MAX_MSGLEN];
 
 sizebuf_t   msg_read;
@@ -233,7 +234,7 @@ void MSG_WriteAngle(float f)
     MSG_WriteByte(ANGLE2BYTE(f));
 }
 
-#if USE_CLIENT
+#if USE_CLIENT || USE_LOADGEN
 
 /*
 =============
@@ -466,7 +467,7 @@ int MSG_WriteDeltaUsercmd_Enhanced(const usercmd_t *from,
     return bits;
 }
 
-#endif // USE_CLIENT
+#endif // USE_CLIENT || USE_LOADGEN
 
 void MSG_WriteDir(const vec3_t dir)
 {
@@ -1792,7 +1793,7 @@ size_t MSG_ReadStringLine(char *dest, size_t size)
     return len;
 }
 
-#if USE_CLIENT || USE_MVD_CLIENT
+#if USE_CLIENT || USE_MVD_CLIENT || USE_LOADGEN
 
 static inline float MSG_ReadCoord(void)
 {
@@ -2078,7 +2079,7 @@ void MSG_ReadDeltaUsercmd_Enhanced(const usercmd_t *from, usercmd_t *to)
     }
 }
 
-#if USE_CLIENT || USE_MVD_CLIENT
+#if USE_CLIENT || USE_MVD_CLIENT || USE_LOADGEN
 
 /*
 =================
@@ -2248,7 +2249,7 @@ void MSG_ParseDeltaEntity(entity_state_t            *to,
     }
 }
 
-#endif // USE_CLIENT || USE_MVD_CLIENT
+#endif // USE_CLIENT || USE_MVD_CLIENT || USE_LOADGEN
 
 static uint64_t MSG_ReadVarInt64(void)
 {
@@ -2341,7 +2342,7 @@ static void MSG_ReadFog(player_state_t *to)
         to->heightfog.end.dist = MSG_ReadExtCoord();
 }
 
-#if USE_CLIENT
+#if USE_CLIENT || USE_LOADGEN
 
 /*
 ===================
@@ -2612,7 +2613,7 @@ void MSG_ParseDeltaPlayerstate_Enhanced(const player_state_t    *from,
         MSG_ReadStats(to, psflags);
 }
 
-#endif // USE_CLIENT
+#endif // USE_CLIENT || USE_LOADGEN
 
 #if USE_MVD_CLIENT
 
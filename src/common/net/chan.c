@@ -161,6 +161,17 @@ void Netchan_OutOfBand(netsrc_t sock, const netadr_t *address, const char *forma
     NET_SendPacket(sock, data, len + 4, address);
 }
 
+static void Netchan_SendPacket(const netchan_t *chan, const void *data, size_t len)
+{
+#if USE_LOADGEN
+    if (chan->socket) {
+        NET_SendUdpPacket(chan->socket, data, len, &chan->remote_address);
+        return;
+    }
+#endif
+    NET_SendPacket(chan->sock, data, len, &chan->remote_address);
+}
+
 // ============================================================================
 
 /*
@@ -211,7 +222,7 @@ static int NetchanOld_Transmit(netchan_t *chan, size_t length, const void *data,
     SZ_WriteLong(&send, w1);
     SZ_WriteLong(&send, w2);
 
-#if USE_CLIENT
+#if USE_CLIENT || USE_LOADGEN
     // send the qport if we are a client
     if (chan->sock == NS_CLIENT) {
         if (chan->protocol < PROTOCOL_VERSION_R1Q2) {
@@ -246,7 +257,7 @@ static int NetchanOld_Transmit(netchan_t *chan, size_t length, const void *data,
 
     // send the datagram
     for (int i = 0; i < numpackets; i++) {
-        NET_SendPacket(chan->sock, send.data, send.cursize, &chan->remote_address);
+        Netchan_SendPacket(chan, send.data, send.cursize);
     }
 
     chan->outgoing_sequence++;
@@ -386,7 +397,7 @@ int Netchan_TransmitNextFragment(netchan_t *chan)
     SZ_WriteLong(&send, w1);
     SZ_WriteLong(&send, w2);
 
-#if USE_CLIENT
+#if USE_CLIENT || USE_LOADGEN
     // send the qport if we are a client
     if (chan->sock == NS_CLIENT && chan->qport) {
         SZ_WriteByte(&send, chan->qport);
@@ -436,7 +447,7 @@ int Netchan_TransmitNextFragment(netchan_t *chan)
     }
 
     // send the datagram
-    NET_SendPacket(chan->sock, send.data, send.cursize, &chan->remote_address);
+    Netchan_SendPacket(chan, send.data, send.cursize);
 
     return send.cursize;
 }
@@ -502,7 +513,7 @@ static int NetchanNew_Transmit(netchan_t *chan, size_t length, const void *data,
     SZ_WriteLong(&send, w1);
     SZ_WriteLong(&send, w2);
 
-#if USE_CLIENT
+#if USE_CLIENT || USE_LOADGEN
     // send the qport if we are a client
     if (chan->sock == NS_CLIENT && chan->qport) {
         SZ_WriteByte(&send, chan->qport);
@@ -530,7 +541,7 @@ static int NetchanNew_Transmit(netchan_t *chan, size_t length, const void *data,
 
     // send the datagram
     for (int i = 0; i < numpackets; i++) {
-        NET_SendPacket(chan->sock, send.data, send.cursize, &chan->remote_address);
+        Netchan_SendPacket(chan, send.data, send.cursize);
     }
 
     chan->outgoing_sequence++;
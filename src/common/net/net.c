@@ -54,6 +54,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <arpa/inet.h>
 #include <poll.h>
 #include <errno.h>
+#ifdef HAVE_SENDMMSG
+#include <netinet/udp.h>
+#endif
 #if USE_ICMP
 #include <linux/errqueue.h>
 #else
@@ -65,6 +68,17 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // prevents infinite retry loops caused by broken TCP/IP stacks
 #define MAX_ERROR_RETRIES   64
 
+// max number of UDP packets received with a single system call
+#define MAX_RECV_BATCH      64
+
+// max number of UDP packets (and bytes) queued for sending
+#define MAX_SEND_QUEUE      256
+#define MAX_SEND_BYTES      0x40000
+
+// UDP GSO limits, see linux/udp.h
+#define MAX_GSO_SEGMENTS    64
+#define MAX_GSO_BYTES       (65535 - 8 - 40)
+
 #if USE_CLIENT
 
 #define MAX_LOOPBACK    4
@@ -107,6 +121,17 @@ static cvar_t   *net_enable_ipv6;
 static cvar_t   *net_ignore_icmp;
 #endif
 
+#ifdef HAVE_RECVMMSG
+static cvar_t   *net_recv_batch;
+#endif
+
+#ifdef HAVE_SENDMMSG
+static cvar_t   *net_send_batch;
+#ifdef UDP_SEGMENT
+static cvar_t   *net_send_gso;
+#endif
+#endif
+
 static netflag_t    net_active;
 static int          net_error;
 
@@ -125,6 +150,46 @@ static qhandle_t    net_logFile;
 static struct pollfd    io_entries[MAX_POLL_FDS];
 static int              io_numfds;
 
+#ifdef HAVE_RECVMMSG
+typedef struct {
+    struct iovec            iov;
+    struct sockaddr_storage addr;
+    byte                    data[MAX_PACKETLEN];
+} recvslot_t;
+
+static struct mmsghdr   *recv_msgs;
+static recvslot_t       *recv_slots;
+static int              recv_numslots;
+#endif
+
+#ifdef HAVE_SENDMMSG
+typedef struct {
+    netadr_t    to;
+    size_t      offset;
+    size_t      len;
+} sendslot_t;
+
+typedef union {
+    char            buf[CMSG_SPACE(sizeof(uint16_t))];
+    struct cmsghdr  align;
+} sendcmsg_t;
+
+typedef struct {
+    int                     numslots;
+    size_t                  cursize;
+    sendslot_t              slots[MAX_SEND_QUEUE];
+    struct mmsghdr          msgs[MAX_SEND_QUEUE];
+    struct iovec            iovs[MAX_SEND_QUEUE];
+    struct sockaddr_storage addrs[MAX_SEND_QUEUE];
+    sendcmsg_t              cmsgs[MAX_SEND_QUEUE];
+    byte                    data[MAX_SEND_BYTES];
+} sendqueue_t;
+
+// outgoing packet queues for server UDP and UDP6 sockets
+static sendqueue_t      *udp_send_queue;
+static sendqueue_t      *udp6_send_queue;
+#endif
+
 // current rate measurement
 static unsigned     net_rate_time;
 static size_t       net_rate_rcvd;
@@ -142,6 +207,13 @@ static uint64_t     net_bytes_rcvd;
 static uint64_t     net_bytes_sent;
 static uint64_t     net_packets_rcvd;
 static uint64_t     net_packets_sent;
+static uint64_t     net_recv_calls;
+static uint64_t     net_send_calls;
+static int          net_recv_maxbatch;
+static int          net_send_maxbatch;
+#ifdef HAVE_SENDMMSG
+static uint64_t     net_send_dropped;
+#endif
 
 //=============================================================================
 
@@ -514,6 +586,17 @@ static void NET_Stats_f(void)
                net_packets_sent, net_packets_sent / diff);
     Com_Printf("Packets rcvd: %"PRIu64" (%"PRIu64" packets/sec)\n",
                net_packets_rcvd, net_packets_rcvd / diff);
+    Com_Printf("Recv syscalls: %"PRIu64" (%.2f packets/syscall, %d max)\n",
+               net_recv_calls, net_recv_calls ?
+               (double)net_packets_rcvd / net_recv_calls : 0.0,
+               net_recv_maxbatch);
+    Com_Printf("Send syscalls: %"PRIu64" (%.2f packets/syscall, %d max)\n",
+               net_send_calls, net_send_calls ?
+               (double)net_packets_sent / net_send_calls : 0.0,
+               net_send_maxbatch);
+#ifdef HAVE_SENDMMSG
+    Com_Printf("Queued packets dropped: %"PRIu64"\n", net_send_dropped);
+#endif
 #if USE_ICMP
     Com_Printf("Total errors: %"PRIu64"/%"PRIu64"/%"PRIu64" (send/recv/icmp)\n",
                net_send_errors, net_recv_errors, net_icmp_errors);
@@ -748,6 +831,104 @@ int NET_Sleep1(int msec, struct pollfd *e)
 
 //=============================================================================
 
+#ifdef HAVE_RECVMMSG
+
+static void NET_AllocRecvSlots(int count)
+{
+    int i;
+
+    Z_Freep(&recv_msgs);
+    Z_Freep(&recv_slots);
+
+    recv_msgs = Z_Mallocz(sizeof(recv_msgs[0]) * count);
+    recv_slots = Z_Malloc(sizeof(recv_slots[0]) * count);
+    recv_numslots = count;
+
+    for (i = 0; i < count; i++) {
+        recv_slots[i].iov.iov_base = recv_slots[i].data;
+        recv_slots[i].iov.iov_len = MAX_PACKETLEN;
+        recv_msgs[i].msg_hdr.msg_iov = &recv_slots[i].iov;
+        recv_msgs[i].msg_hdr.msg_iovlen = 1;
+        recv_msgs[i].msg_hdr.msg_name = &recv_slots[i].addr;
+    }
+}
+
+/*
+=============
+NET_GetUdpPacketsMulti
+
+Receives up to `net_recv_batch' packets per system call and dispatches them
+one by one through msg_read_buffer, just like the single packet path does.
+=============
+*/
+static void NET_GetUdpPacketsMulti(struct pollfd *sock, void (*packet_cb)(void))
+{
+    qsocket_t fd = sock->fd;
+    recvslot_t *slot;
+    int i, ret, count, len;
+
+    // reallocate here rather than in cvar callback, since
+    // packet_cb may change the cvar while slots are in use
+    count = net_recv_batch->integer;
+    if (count != recv_numslots)
+        NET_AllocRecvSlots(count);
+
+    while (1) {
+        for (i = 0; i < count; i++)
+            recv_msgs[i].msg_hdr.msg_namelen = sizeof(recv_slots[i].addr);
+
+        ret = os_udp_recv_multi(fd, recv_msgs, count);
+        if (ret == NET_AGAIN) {
+            sock->revents = 0;
+            break;
+        }
+
+        if (ret == NET_ERROR) {
+            Com_DPrintf("%s: %s\n", __func__, NET_ErrorString());
+            net_recv_errors++;
+            break;
+        }
+
+        net_recv_calls++;
+        net_recv_maxbatch = max(net_recv_maxbatch, ret);
+
+        for (i = 0, slot = recv_slots; i < ret; i++, slot++) {
+            len = recv_msgs[i].msg_len;
+
+            NET_SockadrToNetadr(&slot->addr, &net_from);
+
+            NET_LogPacket(&net_from, "UDP recv", slot->data, len);
+
+            net_rate_rcvd += len;
+            net_bytes_rcvd += len;
+            net_packets_rcvd++;
+
+            memcpy(msg_read_buffer, slot->data, len);
+            SZ_InitRead(&msg_read, msg_read_buffer, len);
+
+            (*packet_cb)();
+
+            // socket may have been closed by packet handler
+            if (sock->fd != fd)
+                return;
+        }
+
+        // short batch means receive queue is drained,
+        // don't waste another system call finding that out
+        if (ret < count) {
+            sock->revents = 0;
+            break;
+        }
+    }
+}
+
+static void net_recv_batch_changed(cvar_t *self)
+{
+    Cvar_ClampInteger(self, 1, MAX_RECV_BATCH);
+}
+
+#endif // HAVE_RECVMMSG
+
 static void NET_GetUdpPackets(struct pollfd *sock, void (*packet_cb)(void))
 {
     int ret;
@@ -760,6 +941,13 @@ static void NET_GetUdpPackets(struct pollfd *sock, void (*packet_cb)(void))
     if (!(sock->revents & (POLLIN | POLLERR)))
         return;
 
+#ifdef HAVE_RECVMMSG
+    if (net_recv_batch->integer > 1) {
+        NET_GetUdpPacketsMulti(sock, packet_cb);
+        return;
+    }
+#endif
+
     while (1) {
         ret = os_udp_recv(sock->fd, msg_read_buffer, MAX_PACKETLEN, &net_from);
         if (ret == NET_AGAIN) {
@@ -774,6 +962,8 @@ static void NET_GetUdpPackets(struct pollfd *sock, void (*packet_cb)(void))
             break;
         }
 
+        net_recv_calls++;
+
         NET_LogPacket(&net_from, "UDP recv", msg_read_buffer, ret);
 
         net_rate_rcvd += ret;
@@ -811,16 +1001,211 @@ void NET_GetPackets(netsrc_t sock, void (*packet_cb)(void))
     NET_GetUdpPackets(udp6_sockets[sock], packet_cb);
 }
 
+#ifdef HAVE_SENDMMSG
+
+// returns number of queued packets that can be sent as a single GSO message
+static int NET_GsoCount(const sendqueue_t *q, int start)
+{
+#ifdef UDP_SEGMENT
+    const sendslot_t *first = &q->slots[start];
+    size_t total = first->len;
+    int count = 1;
+
+    if (!net_send_gso->integer)
+        return 1;
+
+    // all segments except the last one must be of equal size
+    while (start + count < q->numslots && count < MAX_GSO_SEGMENTS) {
+        const sendslot_t *slot = &q->slots[start + count];
+
+        if (slot[-1].len != first->len || slot->len > first->len)
+            break;
+        if (total + slot->len > MAX_GSO_BYTES)
+            break;
+        if (!NET_IsEqualAdr(&slot->to, &first->to))
+            break;
+
+        total += slot->len;
+        count++;
+    }
+
+    return count;
+#else
+    return 1;
+#endif
+}
+
+static void NET_FlushQueue(sendqueue_t *q, struct pollfd *s)
+{
+    struct mmsghdr *msg;
+    sendslot_t *slot;
+    int i, j, nummsgs, count, batch, ret;
+
+    if (!q || !q->numslots)
+        return;
+
+    // socket may have been closed since packets were queued
+    if (!s) {
+        net_send_dropped += q->numslots;
+        q->numslots = 0;
+        q->cursize = 0;
+        return;
+    }
+
+    // build message headers, coalescing packets for GSO if possible
+    for (i = nummsgs = 0; i < q->numslots; i += count, nummsgs++) {
+        slot = &q->slots[i];
+        msg = &q->msgs[nummsgs];
+
+        count = NET_GsoCount(q, i);
+        for (j = 0; j < count; j++) {
+            q->iovs[i + j].iov_base = q->data + slot[j].offset;
+            q->iovs[i + j].iov_len = slot[j].len;
+        }
+
+        memset(msg, 0, sizeof(*msg));
+        msg->msg_hdr.msg_name = &q->addrs[nummsgs];
+        msg->msg_hdr.msg_namelen = NET_NetadrToSockadr(&slot->to, &q->addrs[nummsgs]);
+        msg->msg_hdr.msg_iov = &q->iovs[i];
+        msg->msg_hdr.msg_iovlen = count;
+
+#ifdef UDP_SEGMENT
+        if (count > 1) {
+            struct cmsghdr *cmsg;
+
+            msg->msg_hdr.msg_control = q->cmsgs[nummsgs].buf;
+            msg->msg_hdr.msg_controllen = sizeof(q->cmsgs[nummsgs].buf);
+
+            cmsg = CMSG_FIRSTHDR(&msg->msg_hdr);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            *(uint16_t *)CMSG_DATA(cmsg) = slot->len;
+        }
+#endif
+    }
+
+    // send them out in batches
+    batch = net_send_batch->integer;
+    for (i = 0, slot = q->slots; i < nummsgs; ) {
+        msg = &q->msgs[i];
+        ret = os_udp_send_multi(s->fd, msg, min(batch, nummsgs - i), &slot->to);
+        if (ret == NET_AGAIN || ret == NET_ERROR) {
+            if (ret == NET_ERROR) {
+                Com_DPrintf("%s: %s to %s\n", __func__,
+                            NET_ErrorString(), NET_AdrToString(&slot->to));
+                net_send_errors++;
+#ifdef UDP_SEGMENT
+                if (msg->msg_hdr.msg_iovlen > 1 && (net_error == EINVAL || net_error == EIO)) {
+                    Com_WPrintf("UDP GSO failed, disabling.\n");
+                    Cvar_Set("net_send_gso", "0");
+                }
+#endif
+            }
+            // drop this message and move on
+            net_send_dropped += msg->msg_hdr.msg_iovlen;
+            slot += msg->msg_hdr.msg_iovlen;
+            i++;
+            continue;
+        }
+
+        net_send_calls++;
+        net_send_maxbatch = max(net_send_maxbatch, ret);
+
+        for (j = 0; j < ret; j++, msg++, i++) {
+            count = msg->msg_hdr.msg_iovlen;
+            while (count--) {
+                NET_LogPacket(&slot->to, "UDP send", q->data + slot->offset, slot->len);
+
+                net_rate_sent += slot->len;
+                net_bytes_sent += slot->len;
+                net_packets_sent++;
+                slot++;
+            }
+        }
+    }
+
+    q->numslots = 0;
+    q->cursize = 0;
+}
+
+static void NET_QueuePacket(sendqueue_t **queue, struct pollfd *s,
+                            const void *data, size_t len, const netadr_t *to)
+{
+    sendqueue_t *q = *queue;
+    sendslot_t *slot;
+
+    if (!q) {
+        q = *queue = Z_Malloc(sizeof(*q));
+        q->numslots = 0;
+        q->cursize = 0;
+    }
+
+    if (q->numslots == MAX_SEND_QUEUE || q->cursize + len > MAX_SEND_BYTES)
+        NET_FlushQueue(q, s);
+
+    slot = &q->slots[q->numslots++];
+    slot->to = *to;
+    slot->offset = q->cursize;
+    slot->len = len;
+
+    memcpy(q->data + q->cursize, data, len);
+    q->cursize += len;
+}
+
+static void net_send_batch_changed(cvar_t *self)
+{
+    Cvar_ClampInteger(self, 1, MAX_SEND_QUEUE);
+
+    // flush anything queued before batching got disabled
+    if (self->integer <= 1)
+        NET_FlushPackets(NS_SERVER);
+}
+
+#endif // HAVE_SENDMMSG
+
+static bool NET_SendUdp(struct pollfd *s, const void *data,
+                        size_t len, const netadr_t *to)
+{
+    int ret;
+
+    ret = os_udp_send(s->fd, data, len, to);
+    if (ret == NET_AGAIN)
+        return false;
+
+    if (ret == NET_ERROR) {
+        Com_DPrintf("%s: %s to %s\n", __func__,
+                    NET_ErrorString(), NET_AdrToString(to));
+        net_send_errors++;
+        return false;
+    }
+
+    if (ret < len)
+        Com_WPrintf("%s: short send to %s\n", __func__,
+                    NET_AdrToString(to));
+
+    NET_LogPacket(to, "UDP send", data, ret);
+
+    net_rate_sent += ret;
+    net_bytes_sent += ret;
+    net_packets_sent++;
+    net_send_calls++;
+
+    return true;
+}
+
 /*
 =============
 NET_SendPacket
 
+Returns true if packet was sent, or queued for sending if server socket
+batching is enabled. Queued packets may still be dropped when they are
+actually sent, these are counted in 'net_stats' output.
 =============
 */
 bool NET_SendPacket(netsrc_t sock, const void *data,
                     size_t len, const netadr_t *to)
 {
-    int ret;
     struct pollfd *s;
 
     if (len == 0)
@@ -853,28 +1238,32 @@ bool NET_SendPacket(netsrc_t sock, const void *data,
     if (!s)
         return false;
 
-    ret = os_udp_send(s->fd, data, len, to);
-    if (ret == NET_AGAIN)
-        return false;
-
-    if (ret == NET_ERROR) {
-        Com_DPrintf("%s: %s to %s\n", __func__,
-                    NET_ErrorString(), NET_AdrToString(to));
-        net_send_errors++;
-        return false;
+#ifdef HAVE_SENDMMSG
+    if (sock == NS_SERVER && net_send_batch->integer > 1) {
+        NET_QueuePacket(to->type == NA_IP6 ? &udp6_send_queue : &udp_send_queue,
+                        s, data, len, to);
+        return true;
     }
+#endif
 
-    if (ret < len)
-        Com_WPrintf("%s: short send to %s\n", __func__,
-                    NET_AdrToString(to));
-
-    NET_LogPacket(to, "UDP send", data, ret);
+    return NET_SendUdp(s, data, len, to);
+}
 
-    net_rate_sent += ret;
-    net_bytes_sent += ret;
-    net_packets_sent++;
+/*
+=============
+NET_FlushPackets
 
-    return true;
+Sends all UDP packets queued for the given socket.
+=============
+*/
+void NET_FlushPackets(netsrc_t sock)
+{
+#ifdef HAVE_SENDMMSG
+    if (sock == NS_SERVER) {
+        NET_FlushQueue(udp_send_queue, udp_sockets[sock]);
+        NET_FlushQueue(udp6_send_queue, udp6_sockets[sock]);
+    }
+#endif
 }
 
 //=============================================================================
@@ -1018,6 +1407,79 @@ static struct pollfd *UDP_OpenSocket(const char *iface, int port, int family)
     return sock;
 }
 
+#if USE_LOADGEN
+
+/*
+=============
+NET_OpenUdpSocket
+
+Opens UDP socket bound to ephemeral port that is not associated with any
+netsrc_t. Used by load generator to give each simulated client its own
+source address.
+=============
+*/
+struct pollfd *NET_OpenUdpSocket(netadrtype_t type)
+{
+    return UDP_OpenSocket("", PORT_ANY, type == NA_IP6 ? AF_INET6 : AF_INET);
+}
+
+void NET_CloseUdpSocket(struct pollfd *s)
+{
+    NET_CloseSocket(s);
+}
+
+/*
+=============
+NET_GetUdpPacket
+
+Reads single packet from socket opened with NET_OpenUdpSocket into
+msg_read_buffer. Returns false if there are no more packets.
+=============
+*/
+bool NET_GetUdpPacket(struct pollfd *s)
+{
+    int ret;
+
+    if (!(s->revents & (POLLIN | POLLERR)))
+        return false;
+
+    ret = os_udp_recv(s->fd, msg_read_buffer, MAX_PACKETLEN, &net_from);
+    if (ret == NET_AGAIN) {
+        s->revents = 0;
+        return false;
+    }
+
+    if (ret == NET_ERROR) {
+        Com_DPrintf("%s: %s from %s\n", __func__,
+                    NET_ErrorString(), NET_AdrToString(&net_from));
+        net_recv_errors++;
+        s->revents = 0;
+        return false;
+    }
+
+    net_recv_calls++;
+
+    NET_LogPacket(&net_from, "UDP recv", msg_read_buffer, ret);
+
+    net_rate_rcvd += ret;
+    net_bytes_rcvd += ret;
+    net_packets_rcvd++;
+
+    SZ_InitRead(&msg_read, msg_read_buffer, ret);
+    return true;
+}
+
+bool NET_SendUdpPacket(struct pollfd *s, const void *data,
+                       size_t len, const netadr_t *to)
+{
+    if (len == 0 || len > MAX_PACKETLEN)
+        return false;
+
+    return NET_SendUdp(s, data, len, to);
+}
+
+#endif // USE_LOADGEN
+
 static struct pollfd *TCP_OpenSocket(const char *iface, int port, int family, netsrc_t who)
 {
     qsocket_t s;
@@ -1229,6 +1691,7 @@ void NET_Config(netflag_t flag)
     if (flag == NET_NONE) {
         // shut down any existing sockets
         for (sock = 0; sock < NS_COUNT; sock++) {
+            NET_FlushPackets(sock);
             if (udp_sockets[sock]) {
                 NET_CloseSocket(udp_sockets[sock]);
                 udp_sockets[sock] = NULL;
@@ -1855,6 +2318,21 @@ void NET_Init(void)
     net_ignore_icmp = Cvar_Get("net_ignore_icmp", "0", 0);
 #endif
 
+#ifdef HAVE_RECVMMSG
+    net_recv_batch = Cvar_Get("net_recv_batch", "16", 0);
+    net_recv_batch->changed = net_recv_batch_changed;
+    net_recv_batch_changed(net_recv_batch);
+#endif
+
+#ifdef HAVE_SENDMMSG
+    net_send_batch = Cvar_Get("net_send_batch", "64", 0);
+    net_send_batch->changed = net_send_batch_changed;
+    net_send_batch_changed(net_send_batch);
+#ifdef UDP_SEGMENT
+    net_send_gso = Cvar_Get("net_send_gso", "0", 0);
+#endif
+#endif
+
 #if USE_DEBUG
     net_log_enable_changed(net_log_enable);
 #endif
@@ -1885,6 +2363,17 @@ void NET_Shutdown(void)
     NET_Config(NET_NONE);
     os_net_shutdown();
 
+#ifdef HAVE_RECVMMSG
+    Z_Freep(&recv_msgs);
+    Z_Freep(&recv_slots);
+    recv_numslots = 0;
+#endif
+
+#ifdef HAVE_SENDMMSG
+    Z_Freep(&udp_send_queue);
+    Z_Freep(&udp6_send_queue);
+#endif
+
     Cmd_RemoveCommand("net_restart");
     Cmd_RemoveCommand("net_stats");
     Cmd_RemoveCommand("showip");
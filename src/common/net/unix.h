@@ -134,6 +134,33 @@ static int os_udp_recv(qsocket_t sock, void *data,
     return NET_ERROR;
 }
 
+#ifdef HAVE_RECVMMSG
+// returns number of packets received, or error code.
+static int os_udp_recv_multi(qsocket_t sock, struct mmsghdr *msgs,
+                             unsigned count)
+{
+    int ret;
+    int tries;
+
+    for (tries = 0; tries < MAX_ERROR_RETRIES; tries++) {
+        ret = recvmmsg(sock, msgs, count, 0, NULL);
+        if (ret >= 0)
+            return ret;
+
+        net_error = errno;
+
+        // wouldblock is silent
+        if (net_error == EWOULDBLOCK)
+            return NET_AGAIN;
+
+        if (!process_error_queue(sock, NULL))
+            break;
+    }
+
+    return NET_ERROR;
+}
+#endif
+
 static int os_udp_send(qsocket_t sock, const void *data,
                        size_t len, const netadr_t *to)
 {
@@ -163,6 +190,33 @@ static int os_udp_send(qsocket_t sock, const void *data,
     return NET_ERROR;
 }
 
+#ifdef HAVE_SENDMMSG
+// returns number of messages sent, or error code for the first message.
+static int os_udp_send_multi(qsocket_t sock, struct mmsghdr *msgs,
+                             unsigned count, const netadr_t *to)
+{
+    int ret;
+    int tries;
+
+    for (tries = 0; tries < MAX_ERROR_RETRIES; tries++) {
+        ret = sendmmsg(sock, msgs, count, 0);
+        if (ret >= 0)
+            return ret;
+
+        net_error = errno;
+
+        // wouldblock is silent
+        if (net_error == EWOULDBLOCK)
+            return NET_AGAIN;
+
+        if (!process_error_queue(sock, to))
+            break;
+    }
+
+    return NET_ERROR;
+}
+#endif
+
 static neterr_t os_get_error(void)
 {
     net_error = errno;
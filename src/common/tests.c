@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "shared/shared.h"
 #include "common/bsp.h"
 #include "common/cmd.h"
+#include "common/cmodel.h"
 #include "common/common.h"
 #include "common/files.h"
 #include "common/mdfour.h"
@@ -196,6 +197,184 @@ static void BSP_Test_f(void)
     FS_FreeList(list);
 }
 
+// reference RLE decoder, intentionally written apart from BSP_DecompressVis
+static void decompress_vis_ref(const bsp_t *bsp, byte *out, int cluster, int vis)
+{
+    const byte *in = (const byte *)bsp->vis;
+    size_t pos = bsp->vis->bitofs[cluster][vis];
+    int i = 0;
+
+    memset(out, 0, bsp->visrowsize);
+    while (i < bsp->visrowsize && pos < bsp->numvisibility) {
+        if (in[pos]) {
+            out[i++] = in[pos++];
+        } else if (pos + 1 < bsp->numvisibility) {
+            i += in[pos + 1];
+            pos += 2;
+        } else {
+            break;
+        }
+    }
+}
+
+static void BSP_VisTest_f(void)
+{
+    char name[MAX_QPATH];
+    bsp_t *bsp, raw;
+    visrow_t row, ref;
+    int i, j, ret, count, rounds, errors;
+    unsigned start, end, msec[2];
+
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s <map> [rounds]\n", Cmd_Argv(0));
+        return;
+    }
+
+    if (Q_concat(name, sizeof(name), "maps/", Cmd_Argv(1), ".bsp") >= sizeof(name)) {
+        Com_Printf("Oversize map name\n");
+        return;
+    }
+
+    ret = BSP_Load(name, &bsp);
+    if (!bsp) {
+        Com_EPrintf("Couldn't load %s: %s\n", name, BSP_ErrorString(ret));
+        return;
+    }
+
+    if (!bsp->vis) {
+        Com_Printf("%s has no visibility\n", name);
+        goto done;
+    }
+
+    if (!bsp->vismatrix) {
+        Com_Printf("%s visibility is not cached\n", name);
+        goto done;
+    }
+
+    count = bsp->vis->numclusters;
+    rounds = Cmd_Argc() > 2 ? max(Q_atoi(Cmd_Argv(2)), 1) : 100;
+
+    // private copy without the matrix, bsp may be shared with server
+    raw = *bsp;
+    raw.vismatrix = NULL;
+
+    // make sure cached rows match independently decompressed ones
+    errors = 0;
+    for (i = 0; i < count * 2; i++) {
+        decompress_vis_ref(bsp, ref.b, i >> 1, i & 1);
+        if (memcmp(bsp->vismatrix + i * bsp->visrowsize, ref.b, bsp->visrowsize))
+            errors++;
+    }
+
+    for (ret = 0; ret < 2; ret++) {
+        start = Sys_Milliseconds();
+        for (i = 0; i < rounds; i++)
+            for (j = 0; j < count * 2; j++)
+                BSP_ClusterVis(ret ? &raw : bsp, &row, j >> 1, j & 1);
+        end = Sys_Milliseconds();
+        msec[ret] = end - start;
+    }
+
+    Com_Printf("%d clusters, %d rounds: %u msec cached, %u msec decompressed, %d mismatches\n",
+               count, rounds, msec[0], msec[1], errors);
+
+done:
+    BSP_Free(bsp);
+}
+
+static void random_trace(const mmodel_t *world, vec3_t start, vec3_t end, vec3_t mins, vec3_t maxs)
+{
+    int i, type = Q_rand_uniform(3);
+
+    for (i = 0; i < 3; i++) {
+        start[i] = world->mins[i] + frand() * (world->maxs[i] - world->mins[i]);
+        end[i] = start[i] + crand() * 512;
+        maxs[i] = type ? frand() * 32 : 0;
+        mins[i] = -maxs[i];
+    }
+
+    // position test
+    if (type == 2)
+        VectorCopy(start, end);
+}
+
+static void BSP_ClipTest_f(void)
+{
+    char name[MAX_QPATH];
+    bsp_t *bsp;
+    float **planes;
+    vec3_t start, end, mins, maxs;
+    trace_t tr[2];
+    int i, ret, count, errors;
+    unsigned msec[2];
+
+    if (Cmd_Argc() < 2) {
+        Com_Printf("Usage: %s <map> [count]\n", Cmd_Argv(0));
+        return;
+    }
+
+    if (Q_concat(name, sizeof(name), "maps/", Cmd_Argv(1), ".bsp") >= sizeof(name)) {
+        Com_Printf("Oversize map name\n");
+        return;
+    }
+
+    ret = BSP_Load(name, &bsp);
+    if (!bsp) {
+        Com_EPrintf("Couldn't load %s: %s\n", name, BSP_ErrorString(ret));
+        return;
+    }
+
+    if (!bsp->brushplanes) {
+        Com_Printf("SIMD brush clipping not available\n");
+        goto done;
+    }
+
+    count = Cmd_Argc() > 2 ? max(Q_atoi(Cmd_Argv(2)), 1) : 100000;
+    planes = Z_Malloc(sizeof(planes[0]) * bsp->numbrushes);
+    for (i = 0; i < bsp->numbrushes; i++)
+        planes[i] = bsp->brushes[i].planes;
+
+    // make sure SIMD results match scalar ones
+    Q_srand(1);
+    errors = 0;
+    for (i = 0; i < count; i++) {
+        random_trace(&bsp->models[0], start, end, mins, maxs);
+        for (ret = 0; ret < 2; ret++) {
+            for (int j = 0; j < bsp->numbrushes; j++)
+                bsp->brushes[j].planes = ret ? NULL : planes[j];
+            CM_BoxTrace(&tr[ret], start, end, mins, maxs, bsp->nodes, MASK_ALL, true);
+        }
+        if (memcmp(&tr[0].fraction, &tr[1].fraction, sizeof(tr[0].fraction))
+            || memcmp(tr[0].endpos, tr[1].endpos, sizeof(tr[0].endpos))
+            || memcmp(&tr[0].plane, &tr[1].plane, sizeof(tr[0].plane))
+            || tr[0].allsolid != tr[1].allsolid || tr[0].startsolid != tr[1].startsolid
+            || tr[0].surface != tr[1].surface || tr[0].contents != tr[1].contents)
+            errors++;
+    }
+
+    for (ret = 0; ret < 2; ret++) {
+        for (i = 0; i < bsp->numbrushes; i++)
+            bsp->brushes[i].planes = ret ? NULL : planes[i];
+        Q_srand(1);
+        msec[ret] = Sys_Milliseconds();
+        for (i = 0; i < count; i++) {
+            random_trace(&bsp->models[0], start, end, mins, maxs);
+            CM_BoxTrace(&tr[0], start, end, mins, maxs, bsp->nodes, MASK_ALL, true);
+        }
+        msec[ret] = Sys_Milliseconds() - msec[ret];
+    }
+
+    for (i = 0; i < bsp->numbrushes; i++)
+        bsp->brushes[i].planes = planes[i];
+    Z_Free(planes);
+
+    Com_Printf("%d traces: %u msec SIMD, %u msec scalar, %d mismatches\n",
+               count, msec[0], msec[1], errors);
+
+done:
+    BSP_Free(bsp);
+}
+
 typedef struct {
     const char *filter;
     const char *string;
@@ -901,6 +1080,8 @@ static const cmdreg_t c_test[] = {
     { "doublefree", Com_DoubleFree_f },
     { "printjunk", Com_PrintJunk_f },
     { "bsptest", BSP_Test_f },
+    { "vistest", BSP_VisTest_f },
+    { "cliptest", BSP_ClipTest_f },
     { "wildtest", Com_TestWild_f },
     { "normtest", Com_TestNorm_f },
     { "infotest", Com_TestInfo_f },
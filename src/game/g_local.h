@@ -542,6 +542,8 @@ extern  cvar_t  *sv_maplist;
 
 extern  cvar_t  *sv_features;
 
+extern  cvar_t  *g_profile;
+
 #define world   (&g_edicts[0])
 
 // item spawnflags
@@ -612,12 +614,16 @@ void Touch_Item(edict_t *ent, edict_t *other, cplane_t *plane, csurface_t *surf)
 bool    KillBox(edict_t *ent);
 void    G_ProjectSource(const vec3_t point, const vec3_t distance, const vec3_t forward, const vec3_t right, vec3_t result);
 edict_t *G_Find(edict_t *from, int fieldofs, char *match);
+edict_t *G_FindTargetname(edict_t *from, const char *targetname);
+void    G_SetTargetname(edict_t *e, char *targetname);
+void    G_ClearTargetnames(void);
 edict_t *findradius(edict_t *from, vec3_t org, float rad);
 edict_t *G_PickTarget(char *targetname);
 void    G_UseTargets(edict_t *ent, edict_t *activator);
 void    G_SetMovedir(vec3_t angles, vec3_t movedir);
 
 void    G_InitEdict(edict_t *e);
+void    G_InitFreeEdicts(void);
 edict_t *G_Spawn(void);
 void    G_FreeEdict(edict_t *e);
 
@@ -785,6 +791,15 @@ void M_ChangeYaw(edict_t *ent);
 //
 void G_RunEntity(edict_t *ent);
 
+//
+// g_profile.c
+//
+void G_ProfileFrame(void);
+void G_ProfileRunEntity(edict_t *ent);
+void G_ProfileThink(edict_t *ent);
+void G_ProfileSpawn(unsigned scanned, unsigned linear);
+void SVCmd_Profile_f(void);
+
 //
 // g_chase.c
 //
@@ -994,6 +1009,7 @@ struct edict_s {
 
     char        *model;
     float       freetime;           // sv.time when the object was freed
+    list_t      free_entry;         // linked into free list when not in use
 
     //
     // only used locally in game, not by server
@@ -1006,7 +1022,9 @@ struct edict_s {
 
     float       angle;          // set in qe3, -1 = up, -2 = down
     char        *target;
-    char        *targetname;
+    char        *targetname;       // use G_SetTargetname to change
+    edict_t     *targetname_next;   // next edict in targetname hash chain
+    edict_t     **targetname_prev;  // link pointing to this edict, NULL if not hashed
     char        *killtarget;
     char        *team;
     char        *pathtarget;
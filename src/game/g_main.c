@@ -73,6 +73,8 @@ cvar_t  *sv_maplist;
 
 cvar_t  *sv_features;
 
+cvar_t  *g_profile;
+
 static void G_RunFrame(void);
 
 //===================================================================
@@ -148,6 +150,8 @@ static void InitGame(void)
     bob_pitch = gi.cvar("bob_pitch", "0.002", 0);
     bob_roll = gi.cvar("bob_roll", "0.002", 0);
 
+    g_profile = gi.cvar("g_profile", "0", 0);
+
     // flood control
     flood_msgs = gi.cvar("flood_msgs", "4", 0);
     flood_persecond = gi.cvar("flood_persecond", "4", 0);
@@ -467,6 +471,8 @@ static void G_RunFrame(void)
     // choose a client for monsters to target this frame
     AI_SetSightClient();
 
+    G_ProfileFrame();
+
     // exit intermissions
     if (level.exitintermission) {
         ExitLevel();
@@ -500,7 +506,10 @@ static void G_RunFrame(void)
             continue;
         }
 
-        G_RunEntity(ent);
+        if (g_profile->value)
+            G_ProfileRunEntity(ent);
+        else
+            G_RunEntity(ent);
     }
 
     // exit intermission right now to avoid annoying fov change
@@ -96,7 +96,10 @@ static bool SV_RunThink(edict_t *ent)
     ent->nextthink = 0;
     if (!ent->think)
         gi.error("NULL ent->think");
-    ent->think(ent);
+    if (g_profile->value)
+        G_ProfileThink(ent);
+    else
+        ent->think(ent);
 
     return false;
 }
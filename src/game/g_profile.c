@@ -0,0 +1,290 @@
+/*
+Copyright (C) 2023 Andrey Nazarov
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// g_profile.c -- per entity cost accounting
+//
+
+#include "g_local.h"
+#include "g_ptrs.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#define PROF_HASH_SIZE  1024    // must be power of 2
+
+typedef struct {
+    const void  *func;          // think function, NULL for classnames
+    char        name[MAX_QPATH];
+    unsigned    calls;
+    unsigned    traces;
+    unsigned    max;            // usec
+    uint64_t    time;           // usec
+} profentry_t;
+
+typedef struct {
+    profentry_t entries[PROF_HASH_SIZE];
+    int         count;
+} proftable_t;
+
+static proftable_t  classnames;
+static proftable_t  thinks;
+
+static unsigned     prof_traces;
+
+static struct {
+    unsigned    calls;
+    unsigned    scanned;        // free list entries examined
+    unsigned    linear;         // slots linear search would have examined
+} prof_spawns;
+
+static trace_t (* q_gameabi real_trace)(const vec3_t start, const vec3_t mins, const vec3_t maxs,
+                                        const vec3_t end, edict_t *passent, int contentmask);
+
+// game module can't use engine timers, so query monotonic clock directly
+static uint64_t G_Microseconds(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER tm;
+
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&tm);
+    // split to avoid overflow with high frequency counters
+    return tm.QuadPart / freq.QuadPart * 1000000ULL +
+           tm.QuadPart % freq.QuadPart * 1000000ULL / freq.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * UINT64_C(1000000) + ts.tv_nsec / 1000;
+#endif
+}
+
+static trace_t q_gameabi G_ProfileTrace(const vec3_t start, const vec3_t mins, const vec3_t maxs,
+                                        const vec3_t end, edict_t *passent, int contentmask)
+{
+    prof_traces++;
+    return real_trace(start, mins, maxs, end, passent, contentmask);
+}
+
+static const char *think_name(const void *func)
+{
+    const save_ptr_t *ptr;
+    int i;
+
+    for (i = 0, ptr = save_ptrs; i < num_save_ptrs; i++, ptr++)
+        if (ptr->type == P_think && ptr->ptr == func)
+            return ptr->name;
+
+    return NULL;
+}
+
+static unsigned hash_name(const char *s)
+{
+    unsigned hash = 0;
+
+    while (*s)
+        hash = hash * 31 + Q_tolower(*s++);
+
+    return hash;
+}
+
+static profentry_t *find_entry(proftable_t *t, const char *name, const void *func)
+{
+    unsigned hash = func ? (uintptr_t)func >> 2 : hash_name(name);
+    profentry_t *e;
+
+    for (int i = 0; i < PROF_HASH_SIZE; i++) {
+        e = &t->entries[(hash + i) & (PROF_HASH_SIZE - 1)];
+        if (!e->name[0])
+            break;
+        if (func ? e->func == func : !strcmp(e->name, name))
+            return e;
+    }
+
+    // keep load factor sane, ignore the rest
+    if (t->count >= PROF_HASH_SIZE * 3 / 4)
+        return NULL;
+
+    if (func) {
+        if (!(name = think_name(func)))
+            name = va("%p", func);
+        e->func = func;
+    }
+    Q_strlcpy(e->name, name, sizeof(e->name));
+    t->count++;
+    return e;
+}
+
+static void add_sample(proftable_t *t, const char *name, const void *func,
+                       uint64_t start, unsigned traces)
+{
+    unsigned time = G_Microseconds() - start;
+    profentry_t *e = find_entry(t, name, func);
+
+    if (e) {
+        e->calls++;
+        e->traces += prof_traces - traces;
+        e->time += time;
+        e->max = max(e->max, time);
+    }
+}
+
+/*
+=================
+G_ProfileFrame
+
+Installs or removes trace counting hook depending on g_profile.
+=================
+*/
+void G_ProfileFrame(void)
+{
+    if (g_profile->value) {
+        if (gi.trace != G_ProfileTrace) {
+            real_trace = gi.trace;
+            gi.trace = G_ProfileTrace;
+        }
+    } else if (gi.trace == G_ProfileTrace) {
+        gi.trace = real_trace;
+    }
+}
+
+/*
+=================
+G_ProfileRunEntity
+
+Runs entity and charges time and traces spent to its classname.
+Entity may be freed and reused by the time this returns, so classname
+is captured beforehand.
+=================
+*/
+void G_ProfileRunEntity(edict_t *ent)
+{
+    const char *classname = ent->classname ? ent->classname : "noclass";
+    unsigned traces = prof_traces;
+    uint64_t start = G_Microseconds();
+
+    G_RunEntity(ent);
+
+    add_sample(&classnames, classname, NULL, start, traces);
+}
+
+/*
+=================
+G_ProfileThink
+
+Calls think function and charges time and traces spent to it.
+=================
+*/
+void G_ProfileThink(edict_t *ent)
+{
+    void (*think)(edict_t *) = ent->think;
+    unsigned traces = prof_traces;
+    uint64_t start = G_Microseconds();
+
+    think(ent);
+
+    add_sample(&thinks, NULL, think, start, traces);
+}
+
+/*
+=================
+G_ProfileSpawn
+
+Counts edict slots examined by G_Spawn.
+=================
+*/
+void G_ProfileSpawn(unsigned scanned, unsigned linear)
+{
+    prof_spawns.calls++;
+    prof_spawns.scanned += scanned;
+    prof_spawns.linear += linear;
+}
+
+static int entrycmp(const void *p1, const void *p2)
+{
+    const profentry_t *e1 = *(const profentry_t **)p1;
+    const profentry_t *e2 = *(const profentry_t **)p2;
+
+    if (e1->time > e2->time)
+        return -1;
+    if (e1->time < e2->time)
+        return 1;
+    return strcmp(e1->name, e2->name);
+}
+
+static void print_table(const proftable_t *t, const char *title, int count)
+{
+    const profentry_t *sorted[PROF_HASH_SIZE], *e;
+    int i, n;
+
+    for (i = n = 0; i < PROF_HASH_SIZE; i++)
+        if (t->entries[i].name[0])
+            sorted[n++] = &t->entries[i];
+
+    qsort(sorted, n, sizeof(sorted[0]), entrycmp);
+
+    gi.cprintf(NULL, PRINT_HIGH,
+               "%-24s    calls   traces     msec  usec/call  max usec\n"
+               "------------------------ -------- -------- -------- ---------- ---------\n",
+               title);
+    for (i = 0; i < min(n, count); i++) {
+        e = sorted[i];
+        gi.cprintf(NULL, PRINT_HIGH, "%-24.24s %8u %8u %8u %10.1f %9u\n",
+                   e->name, e->calls, e->traces, (unsigned)(e->time / 1000),
+                   (double)e->time / e->calls, e->max);
+    }
+}
+
+/*
+=================
+SVCmd_Profile_f
+
+sv profile [count|reset]
+=================
+*/
+void SVCmd_Profile_f(void)
+{
+    int count = 10;
+
+    if (gi.argc() > 2) {
+        if (!Q_stricmp(gi.argv(2), "reset")) {
+            memset(&classnames, 0, sizeof(classnames));
+            memset(&thinks, 0, sizeof(thinks));
+            memset(&prof_spawns, 0, sizeof(prof_spawns));
+            return;
+        }
+        count = atoi(gi.argv(2));
+    }
+
+    if (!classnames.count) {
+        gi.cprintf(NULL, PRINT_HIGH, "No entities profiled. Set g_profile to 1 to enable.\n");
+        return;
+    }
+
+    print_table(&classnames, "classname", count);
+    gi.cprintf(NULL, PRINT_HIGH, "\n");
+    print_table(&thinks, "think function", count);
+    gi.cprintf(NULL, PRINT_HIGH, "\n%u edicts spawned, %u free slots examined "
+               "(%u with linear search)\n", prof_spawns.calls, prof_spawns.scanned,
+               prof_spawns.linear);
+}
@@ -985,6 +985,7 @@ void ReadLevel(const char *filename)
     // wipe all the entities
     memset(g_edicts, 0, game.maxentities * sizeof(g_edicts[0]));
     globals.num_edicts = game.maxclients + 1;
+    G_ClearTargetnames();
 
     i = read_int(f);
     if (i != SAVE_MAGIC2) {
@@ -1018,6 +1019,7 @@ void ReadLevel(const char *filename)
         read_fields(f, entityfields, ent);
         ent->inuse = true;
         ent->s.number = entnum;
+        G_SetTargetname(ent, ent->targetname);
 
         // let the server rebuild world links for this ent
         memset(&ent->area, 0, sizeof(ent->area));
@@ -1026,6 +1028,8 @@ void ReadLevel(const char *filename)
 
     gzclose(f);
 
+    G_InitFreeEdicts();
+
     // mark all clients as unconnected
     for (i = 0; i < game.maxclients; i++) {
         ent = &g_edicts[i + 1];
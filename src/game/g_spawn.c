@@ -643,6 +643,8 @@ void SpawnEntities(const char *mapname, const char *entities, const char *spawnp
 
     memset(&level, 0, sizeof(level));
     memset(g_edicts, 0, game.maxentities * sizeof(g_edicts[0]));
+    G_ClearTargetnames();
+    G_InitFreeEdicts();
 
     Q_strlcpy(level.mapname, mapname, sizeof(level.mapname));
     Q_strlcpy(game.spawnpoint, spawnpoint, sizeof(game.spawnpoint));
@@ -668,6 +670,7 @@ void SpawnEntities(const char *mapname, const char *entities, const char *spawnp
         else
             ent = G_Spawn();
         ED_ParseEdict(&entities, ent);
+        G_SetTargetname(ent, ent->targetname);
 
         // yet another map hack
         if (!Q_stricmp(level.mapname, "command") && !Q_stricmp(ent->classname, "trigger_once") && !Q_stricmp(ent->model, "*27"))
@@ -42,6 +42,9 @@ edict_t *G_Find(edict_t *from, int fieldofs, char *match)
 {
     char    *s;
 
+    if (fieldofs == FOFS(targetname))
+        return G_FindTargetname(from, match);
+
     if (!from)
         from = g_edicts;
     else
@@ -60,6 +63,107 @@ edict_t *G_Find(edict_t *from, int fieldofs, char *match)
     return NULL;
 }
 
+/*
+Entities with targetname set are kept in a hash table to speed up
+G_UseTargets and friends. Hash chains are sorted by edict number, so that
+lookups visit entities in the same order as linear search does.
+*/
+
+#define TARGETNAME_HASH_SIZE    256     // must be power of 2
+
+static edict_t  *targetname_hash[TARGETNAME_HASH_SIZE];
+
+static edict_t **targetname_bucket(const char *s)
+{
+    unsigned hash = 0;
+
+    while (*s)
+        hash = hash * 31 + Q_tolower(*s++);
+
+    return &targetname_hash[hash & (TARGETNAME_HASH_SIZE - 1)];
+}
+
+static void link_targetname(edict_t *e)
+{
+    edict_t **link = targetname_bucket(e->targetname);
+
+    while (*link && *link < e)
+        link = &(*link)->targetname_next;
+
+    e->targetname_next = *link;
+    e->targetname_prev = link;
+    if (*link)
+        (*link)->targetname_prev = &e->targetname_next;
+    *link = e;
+}
+
+static void unlink_targetname(edict_t *e)
+{
+    if (!e->targetname_prev)
+        return;
+
+    *e->targetname_prev = e->targetname_next;
+    if (e->targetname_next)
+        e->targetname_next->targetname_prev = e->targetname_prev;
+
+    e->targetname_next = NULL;
+    e->targetname_prev = NULL;
+}
+
+/*
+=============
+G_SetTargetname
+
+Changes targetname of the entity and updates hash table. Must be used
+instead of assigning targetname directly once entity is spawned.
+=============
+*/
+void G_SetTargetname(edict_t *e, char *targetname)
+{
+    unlink_targetname(e);
+    e->targetname = targetname;
+    if (targetname)
+        link_targetname(e);
+}
+
+/*
+=============
+G_ClearTargetnames
+
+Empties hash table. Called when all edicts are wiped.
+=============
+*/
+void G_ClearTargetnames(void)
+{
+    memset(targetname_hash, 0, sizeof(targetname_hash));
+}
+
+/*
+=============
+G_FindTargetname
+
+Same as G_Find(from, FOFS(targetname), targetname), but only visits
+entities that hash to the same chain.
+=============
+*/
+edict_t *G_FindTargetname(edict_t *from, const char *targetname)
+{
+    edict_t *e;
+
+    for (e = *targetname_bucket(targetname); e; e = e->targetname_next) {
+        if (from && e <= from)
+            continue;
+        if (e >= &g_edicts[globals.num_edicts])
+            break;
+        if (!e->inuse)
+            continue;
+        if (!Q_stricmp(e->targetname, targetname))
+            return e;
+    }
+
+    return NULL;
+}
+
 /*
 =================
 findradius
@@ -119,7 +223,7 @@ edict_t *G_PickTarget(char *targetname)
     }
 
     while (1) {
-        ent = G_Find(ent, FOFS(targetname), targetname);
+        ent = G_FindTargetname(ent, targetname);
         if (!ent)
             break;
         choice[num_choices++] = ent;
@@ -195,7 +299,7 @@ void G_UseTargets(edict_t *ent, edict_t *activator)
 //
     if (ent->killtarget) {
         t = NULL;
-        while ((t = G_Find(t, FOFS(targetname), ent->killtarget))) {
+        while ((t = G_FindTargetname(t, ent->killtarget))) {
             G_FreeEdict(t);
             if (!ent->inuse) {
                 gi.dprintf("entity was removed while using killtargets\n");
@@ -209,7 +313,7 @@ void G_UseTargets(edict_t *ent, edict_t *activator)
 //
     if (ent->target) {
         t = NULL;
-        while ((t = G_Find(t, FOFS(targetname), ent->target))) {
+        while ((t = G_FindTargetname(t, ent->target))) {
             // doors fire area portals in a specific way
             if (!Q_stricmp(t->classname, "func_areaportal") &&
                 (!Q_stricmp(ent->classname, "func_door") || !Q_stricmp(ent->classname, "func_door_rotating")))
@@ -314,6 +418,51 @@ void G_InitEdict(edict_t *e)
     e->s.number = e - g_edicts;
 }
 
+// free edicts ordered by freetime, oldest first
+static LIST_DECL(free_edicts);
+
+static bool G_CanReuse(const edict_t *e)
+{
+    // the first couple seconds of server time can involve a lot of
+    // freeing and allocating, so relax the replacement policy
+    return e->freetime < 2 || level.time - e->freetime > 0.5f;
+}
+
+/*
+=================
+G_InitFreeEdicts
+
+Puts all unused edicts on the free list. Called after edicts are wiped.
+=================
+*/
+void G_InitFreeEdicts(void)
+{
+    int         i;
+    edict_t     *e;
+
+    List_Init(&free_edicts);
+
+    e = &g_edicts[game.maxclients + 1];
+    for (i = game.maxclients + 1; i < globals.num_edicts; i++, e++)
+        if (!e->inuse)
+            List_Append(&free_edicts, &e->free_entry);
+}
+
+// returns number of slots the linear search used before free list
+// would have examined, for profiling
+static unsigned G_LinearSpawnCost(void)
+{
+    int         i;
+    edict_t     *e;
+
+    e = &g_edicts[game.maxclients + 1];
+    for (i = game.maxclients + 1; i < globals.num_edicts; i++, e++)
+        if (!e->inuse && G_CanReuse(e))
+            break;
+
+    return i - game.maxclients;
+}
+
 /*
 =================
 G_Spawn
@@ -323,27 +472,31 @@ Try to avoid reusing an entity that was recently freed, because it
 can cause the client to think the entity morphed into something else
 instead of being removed and recreated, which can cause interpolated
 angles and bad trails.
+
+Free list is ordered by freetime, so if the oldest free edict can't be
+reused yet, neither can any other.
 =================
 */
 edict_t *G_Spawn(void)
 {
-    int         i;
     edict_t     *e;
 
-    e = &g_edicts[game.maxclients + 1];
-    for (i = game.maxclients + 1; i < globals.num_edicts; i++, e++) {
-        // the first couple seconds of server time can involve a lot of
-        // freeing and allocating, so relax the replacement policy
-        if (!e->inuse && (e->freetime < 2 || level.time - e->freetime > 0.5f)) {
+    if (g_profile->value)
+        G_ProfileSpawn(!LIST_EMPTY(&free_edicts), G_LinearSpawnCost());
+
+    if (!LIST_EMPTY(&free_edicts)) {
+        e = LIST_FIRST(edict_t, &free_edicts, free_entry);
+        if (G_CanReuse(e)) {
+            List_Delete(&e->free_entry);
             G_InitEdict(e);
             return e;
         }
     }
 
-    if (i == game.maxentities)
+    if (globals.num_edicts == game.maxentities)
         gi.error("ED_Alloc: no free edicts");
 
-    globals.num_edicts++;
+    e = &g_edicts[globals.num_edicts++];
     G_InitEdict(e);
     return e;
 }
@@ -364,10 +517,18 @@ void G_FreeEdict(edict_t *ed)
         return;
     }
 
+    unlink_targetname(ed);
+
+    // edict may be already free, keep the list ordered by freetime
+    if (ed->free_entry.next)
+        List_Remove(&ed->free_entry);
+
     memset(ed, 0, sizeof(*ed));
     ed->classname = "freed";
     ed->freetime = level.time;
     ed->inuse = false;
+
+    List_Append(&free_edicts, &ed->free_entry);
 }
 
 /*
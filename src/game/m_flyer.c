@@ -491,7 +491,7 @@ void SP_monster_flyer(edict_t *self)
 
     // fix a map bug in jail5.bsp
     if (!Q_stricmp(level.mapname, "jail5") && (self->s.origin[2] == -104)) {
-        self->targetname = self->target;
+        G_SetTargetname(self, self->target);
         self->target = NULL;
     }
 
@@ -49,7 +49,7 @@ void SP_FixCoopSpots(edict_t *self)
         if (VectorLength(d) < 384) {
             if ((!self->targetname) || Q_stricmp(self->targetname, spot->targetname) != 0) {
 //              gi.dprintf("FixCoopSpots changed %s at %s targetname from %s to %s\n", self->classname, vtos(self->s.origin), self->targetname, spot->targetname);
-                self->targetname = spot->targetname;
+                G_SetTargetname(self, spot->targetname);
             }
             return;
         }
@@ -70,7 +70,7 @@ void SP_CreateCoopSpots(edict_t *self)
         spot->s.origin[0] = 188 - 64;
         spot->s.origin[1] = -164;
         spot->s.origin[2] = 80;
-        spot->targetname = "jail3";
+        G_SetTargetname(spot, "jail3");
         spot->s.angles[1] = 90;
 
         spot = G_Spawn();
@@ -78,7 +78,7 @@ void SP_CreateCoopSpots(edict_t *self)
         spot->s.origin[0] = 188 + 64;
         spot->s.origin[1] = -164;
         spot->s.origin[2] = 80;
-        spot->targetname = "jail3";
+        G_SetTargetname(spot, "jail3");
         spot->s.angles[1] = 90;
 
         spot = G_Spawn();
@@ -86,7 +86,7 @@ void SP_CreateCoopSpots(edict_t *self)
         spot->s.origin[0] = 188 + 128;
         spot->s.origin[1] = -164;
         spot->s.origin[2] = 80;
-        spot->targetname = "jail3";
+        G_SetTargetname(spot, "jail3");
         spot->s.angles[1] = 90;
 
         return;
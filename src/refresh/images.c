@@ -50,6 +50,31 @@ with this program; if not, write to the Free Software Foundation, Inc.,
     static int IMG_Load##x(const byte *rawdata, size_t rawlen, \
         image_t *image, byte **pic)
 
+// set while decoding prefetched images on worker thread,
+// where zone allocator can't be used
+static q_thread_local bool img_worker;
+
+static void *IMG_AllocPixels(size_t size)
+{
+    void *ptr;
+
+    if (!img_worker)
+        return FS_AllocTempMem(size);
+
+    ptr = malloc(size);
+    if (!ptr)
+        Com_Error(ERR_FATAL, "%s: couldn't allocate %zu bytes", __func__, size);
+    return ptr;
+}
+
+static void IMG_FreePixels(void *ptr)
+{
+    if (img_worker)
+        free(ptr);
+    else
+        FS_FreeTempMem(ptr);
+}
+
 static bool check_image_size(unsigned w, unsigned h)
 {
     return (w < 1 || h < 1 || w > MAX_TEXTURE_SIZE || h > MAX_TEXTURE_SIZE);
@@ -1315,6 +1340,7 @@ static void make_screenshot(const char *name, const char *ext,
             .work_cb = screenshot_work_cb,
             .done_cb = screenshot_done_cb,
             .cb_arg = Z_CopyStruct(&s),
+            .prio = ASYNC_PRIO_HIGH,
         };
         Com_QueueAsyncWork(&work);
     } else {
@@ -1481,6 +1507,7 @@ static cvar_t   *r_texture_overrides;
 #endif
 
 static cvar_t   *r_glowmaps;
+static cvar_t   *r_prefetch;
 
 static const cmd_option_t o_imagelist[] = {
     { "8", "pal", "list paletted images" },
@@ -1638,6 +1665,8 @@ static image_t *lookup_image(const char *name,
     return NULL;
 }
 
+typedef int (*tryformat_t)(imageformat_t, image_t *, byte **);
+
 static int try_image_format(imageformat_t fmt, image_t *image, byte **pic)
 {
     void    *data;
@@ -1658,15 +1687,15 @@ static int try_image_format(imageformat_t fmt, image_t *image, byte **pic)
 
 #if USE_PNG || USE_JPG || USE_TGA
 
-static int try_replace_ext(imageformat_t fmt, image_t *image, byte **pic)
+static int try_replace_ext(tryformat_t func, imageformat_t fmt, image_t *image, byte **pic)
 {
     // replace the extension
     memcpy(image->name + image->baselen + 1, img_loaders[fmt].ext, 4);
-    return try_image_format(fmt, image, pic);
+    return func(fmt, image, pic);
 }
 
 // tries to load the image with a different extension
-static int try_other_formats(imageformat_t orig, image_t *image, byte **pic)
+static int try_other_formats(tryformat_t func, imageformat_t orig, image_t *image, byte **pic)
 {
     imageformat_t   fmt;
     int             i, ret;
@@ -1677,7 +1706,7 @@ static int try_other_formats(imageformat_t orig, image_t *image, byte **pic)
         if (fmt == orig)
             continue;   // don't retry twice
 
-        ret = try_replace_ext(fmt, image, pic);
+        ret = try_replace_ext(func, fmt, image, pic);
         if (ret != Q_ERR(ENOENT))
             return ret; // found something
     }
@@ -1687,7 +1716,7 @@ static int try_other_formats(imageformat_t orig, image_t *image, byte **pic)
     if (fmt == orig)
         return Q_ERR(ENOENT); // don't retry twice
 
-    return try_replace_ext(fmt, image, pic);
+    return try_replace_ext(func, fmt, image, pic);
 }
 
 static void get_image_dimensions(imageformat_t fmt, image_t *image)
@@ -1816,27 +1845,27 @@ static void print_error(const char *name, imageflags_t flags, int err)
     Com_LPrintf(level, "Couldn't load %s: %s\n", Com_MakePrintable(name), msg);
 }
 
-static int load_image_data(image_t *image, imageformat_t fmt, bool need_dimensions, byte **pic)
+static int load_image_data(tryformat_t func, image_t *image, imageformat_t fmt, bool need_dimensions, byte **pic)
 {
     int ret;
 
 #if USE_PNG || USE_JPG || USE_TGA
     if (fmt == IM_MAX) {
         // unknown extension, but give it a chance to load anyway
-        ret = try_other_formats(IM_MAX, image, pic);
+        ret = try_other_formats(func, IM_MAX, image, pic);
         if (ret == Q_ERR(ENOENT)) {
             // not found, change error to invalid path
             ret = Q_ERR_INVALID_PATH;
         }
     } else if (need_override_image(image->type, fmt)) {
         // forcibly replace the extension
-        ret = try_other_formats(IM_MAX, image, pic);
+        ret = try_other_formats(func, IM_MAX, image, pic);
     } else {
         // first try with original extension
-        ret = try_image_format(fmt, image, pic);
+        ret = func(fmt, image, pic);
         if (ret == Q_ERR(ENOENT)) {
             // retry with remaining extensions
-            ret = try_other_formats(fmt, image, pic);
+            ret = try_other_formats(func, fmt, image, pic);
         }
     }
 
@@ -1848,12 +1877,252 @@ static int load_image_data(image_t *image, imageformat_t fmt, bool need_dimensio
     if (fmt == IM_MAX)
         ret = Q_ERR_INVALID_PATH;
     else
-        ret = try_image_format(fmt, image, pic);
+        ret = func(fmt, image, pic);
 #endif
 
     return ret;
 }
 
+/*
+===============================================================================
+
+IMAGE PREFETCHING
+
+Images known to be needed soon are decoded on async worker threads into
+buffers allocated with malloc(). Main thread looks up the file the same way
+it would do when loading, and hands raw file reader to the worker.
+find_or_load_image() then waits for the result and only uploads it. Failed
+jobs are ignored, image is loaded again on main thread to report the error.
+
+===============================================================================
+*/
+
+#define MAX_PREFETCH    256
+
+typedef struct {
+    image_t         image;      // must be first
+    char            name[MAX_QPATH];
+    imageformat_t   fmt;
+    qhandle_t       f;
+    void            *raw;
+    byte            *pic;
+    int             ret;
+    bool            done;
+    bool            failed;
+    errortrap_t     error;
+} imgprefetch_t;
+
+static struct {
+    imgprefetch_t   *jobs;
+    int             numjobs;
+    int             numpending;
+    int             numused;
+} img_prefetch;
+
+static void prefetch_work(void *arg)
+{
+    imgprefetch_t *p = arg;
+    void *data;
+
+    if (setjmp(p->error.jmpbuf)) {
+        img_worker = false;
+        p->failed = true;
+        return;
+    }
+
+    Com_SetErrorTrap(&p->error);
+    img_worker = true;
+
+    p->ret = FS_LoadRaw(p->raw, &data);
+    if (p->ret >= 0) {
+        p->ret = img_loaders[p->fmt].load(data, p->ret, &p->image, &p->pic);
+        free(data);
+    }
+
+    img_worker = false;
+    Com_SetErrorTrap(NULL);
+}
+
+static void prefetch_done(void *arg)
+{
+    imgprefetch_t *p = arg;
+
+    FS_CloseFile(p->f);
+    p->done = true;
+    img_prefetch.numpending--;
+}
+
+// opens the file instead of loading it
+static int open_image_format(imageformat_t fmt, image_t *image, byte **pic)
+{
+    imgprefetch_t *p = (imgprefetch_t *)image;
+    int64_t ret;
+
+    ret = FS_OpenFile(image->name, &p->f, FS_MODE_READ | FS_FLAG_DEFLATE);
+    if (ret == Q_ERR_BAD_COMPRESSION)
+        ret = FS_OpenFile(image->name, &p->f, FS_MODE_READ);
+    if (ret < 0)
+        return ret;
+
+    p->raw = FS_RawFile(p->f);
+    if (!p->raw) {
+        FS_CloseFile(p->f);
+        return Q_ERR(ENOSYS);
+    }
+
+    p->fmt = fmt;
+    return fmt;
+}
+
+static imgprefetch_t *find_prefetched(const char *name, imagetype_t type)
+{
+    imgprefetch_t *p;
+    int i;
+
+    for (i = 0, p = img_prefetch.jobs; i < img_prefetch.numjobs; i++, p++)
+        if (p->image.type == type && !FS_pathcmp(p->name, name))
+            return p;
+
+    return NULL;
+}
+
+static void prefetch_image(const char *name, size_t len, imagetype_t type)
+{
+    imgprefetch_t   *p;
+    size_t          baselen;
+    imageformat_t   fmt;
+    asyncwork_t     work;
+
+    if (!r_prefetch->integer)
+        return;
+
+    if (img_prefetch.numjobs == MAX_PREFETCH)
+        return;
+
+    Q_assert(len < MAX_QPATH);
+    baselen = COM_FileExtension(name) - name;
+    if (baselen < 1 || name[baselen] != '.')
+        return;
+
+    if (lookup_image(name, type, FS_HashPathLen(name, baselen, RIMAGES_HASH), baselen))
+        return;
+
+    if (find_prefetched(name, type))
+        return;
+
+    for (fmt = 0; fmt < IM_MAX; fmt++)
+        if (!Q_stricmp(name + baselen + 1, img_loaders[fmt].ext))
+            break;
+
+    if (!img_prefetch.jobs)
+        img_prefetch.jobs = Z_TagMalloc(sizeof(img_prefetch.jobs[0]) * MAX_PREFETCH, TAG_RENDERER);
+
+    p = &img_prefetch.jobs[img_prefetch.numjobs];
+    memset(p, 0, sizeof(*p));
+    memcpy(p->name, name, len + 1);
+    memcpy(p->image.name, name, len + 1);
+    p->image.baselen = baselen;
+    p->image.type = type;
+
+    // find the file that would be loaded, keep it open for worker
+    if (load_image_data(open_image_format, &p->image, fmt, false, NULL) < 0)
+        return;
+
+    img_prefetch.numjobs++;
+    img_prefetch.numpending++;
+
+    work = (asyncwork_t) {
+        .work_cb = prefetch_work,
+        .done_cb = prefetch_done,
+        .cb_arg = p,
+        .prio = ASYNC_PRIO_HIGH,
+    };
+    Com_QueueAsyncWork(&work);
+}
+
+// picks up image decoded by worker thread, if any
+static int load_prefetched(image_t *image, imageformat_t fmt, byte **pic)
+{
+    imgprefetch_t *p = find_prefetched(image->name, image->type);
+
+    if (!p)
+        return Q_ERR(ENOENT);
+
+    while (!p->done)
+        Com_WaitAsyncWork();
+
+    p->image.type = IT_MAX;     // don't find it again
+
+    if (p->failed)
+        Com_Error(p->error.code, "%s", p->error.msg);
+
+    if (p->ret < 0)
+        return p->ret;
+
+    memcpy(image->name, p->image.name, sizeof(image->name));
+    image->flags |= p->image.flags;
+    image->width = p->image.width;
+    image->height = p->image.height;
+    image->upload_width = p->image.upload_width;
+    image->upload_height = p->image.upload_height;
+
+#if USE_PNG || USE_JPG || USE_TGA
+    if (fmt <= IM_WAL && p->fmt > IM_WAL)
+        get_image_dimensions(fmt, image);
+#endif
+
+    *pic = p->pic;
+    p->pic = NULL;
+    img_prefetch.numused++;
+    return p->fmt;
+}
+
+/*
+===============
+IMG_Prefetch
+
+Starts decoding the image in background. Later IMG_Find() call with the same
+name and type picks up the result.
+===============
+*/
+void IMG_Prefetch(const char *name, imagetype_t type)
+{
+    char buffer[MAX_QPATH];
+    size_t len;
+
+    len = FS_NormalizePathBuffer(buffer, name, sizeof(buffer));
+    if (len < sizeof(buffer))
+        prefetch_image(buffer, len, type);
+}
+
+/*
+===============
+IMG_FinishPrefetch
+
+Waits for all pending jobs and frees unused results.
+===============
+*/
+void IMG_FinishPrefetch(void)
+{
+    int i;
+
+    if (!img_prefetch.jobs)
+        return;
+
+    while (img_prefetch.numpending)
+        Com_WaitAsyncWork();
+
+    for (i = 0; i < img_prefetch.numjobs; i++)
+        free(img_prefetch.jobs[i].pic);
+
+    Com_DPrintf("%s: %d of %d prefetched images used\n", __func__,
+                img_prefetch.numused, img_prefetch.numjobs);
+
+    Z_Freep(&img_prefetch.jobs);
+    img_prefetch.numjobs = 0;
+    img_prefetch.numused = 0;
+}
+
 static void check_for_glow_map(image_t *image)
 {
     extern cvar_t *gl_shaders;
@@ -1883,7 +2152,7 @@ static void check_for_glow_map(image_t *image)
     // load the pic from disk
     glow_pic = NULL;
 
-    ret = load_image_data(&temporary, IM_PCX, false, &glow_pic);
+    ret = load_image_data(try_image_format, &temporary, IM_PCX, false, &glow_pic);
     if (ret < 0) {
         print_error(temporary.name, -1, ret);
         return;
@@ -1920,6 +2189,7 @@ static image_t *find_or_load_image(const char *name, size_t len,
     size_t          baselen;
     imageformat_t   fmt;
     int             ret;
+    bool            prefetched = false;
 
     Q_assert(len < MAX_QPATH);
     baselen = COM_FileExtension(name) - name;
@@ -1970,8 +2240,10 @@ static image_t *find_or_load_image(const char *name, size_t len,
             ret = Q_ERR_INVALID_PATH;
         else
             ret = try_image_format(fmt, image, &pic);
+    } else if ((ret = load_prefetched(image, fmt, &pic)) >= 0) {
+        prefetched = true;
     } else {
-        ret = load_image_data(image, fmt, true, &pic);
+        ret = load_image_data(try_image_format, image, fmt, true, &pic);
     }
 
     if (ret < 0) {
@@ -2019,7 +2291,10 @@ static image_t *find_or_load_image(const char *name, size_t len,
     }
 
     // don't need pics in memory after GL upload
-    Z_Free(pic);
+    if (prefetched)
+        free(pic);
+    else
+        Z_Free(pic);
 
     return image;
 
@@ -2069,6 +2344,25 @@ image_t *IMG_ForHandle(qhandle_t h)
 R_RegisterImage
 ===============
 */
+static size_t register_path(char *fullname, const char *name, imagetype_t type)
+{
+    size_t len;
+
+    if (type == IT_SKIN || type == IT_SPRITE) {
+        len = FS_NormalizePathBuffer(fullname, name, MAX_QPATH);
+    } else if (*name == '/' || *name == '\\') {
+        len = FS_NormalizePathBuffer(fullname, name + 1, MAX_QPATH);
+    } else {
+        len = Q_concat(fullname, MAX_QPATH, "pics/", name);
+        if (len < MAX_QPATH) {
+            FS_NormalizePath(fullname);
+            len = COM_DefaultExtension(fullname, ".pcx", MAX_QPATH);
+        }
+    }
+
+    return len;
+}
+
 qhandle_t R_RegisterImage(const char *name, imagetype_t type, imageflags_t flags)
 {
     image_t     *image;
@@ -2085,18 +2379,7 @@ qhandle_t R_RegisterImage(const char *name, imagetype_t type, imageflags_t flags
     if (!r_numImages)
         return 0;
 
-    if (type == IT_SKIN || type == IT_SPRITE) {
-        len = FS_NormalizePathBuffer(fullname, name, sizeof(fullname));
-    } else if (*name == '/' || *name == '\\') {
-        len = FS_NormalizePathBuffer(fullname, name + 1, sizeof(fullname));
-    } else {
-        len = Q_concat(fullname, sizeof(fullname), "pics/", name);
-        if (len < sizeof(fullname)) {
-            FS_NormalizePath(fullname);
-            len = COM_DefaultExtension(fullname, ".pcx", sizeof(fullname));
-        }
-    }
-
+    len = register_path(fullname, name, type);
     if (len >= sizeof(fullname)) {
         print_error(fullname, flags, Q_ERR(ENAMETOOLONG));
         return 0;
@@ -2108,6 +2391,26 @@ qhandle_t R_RegisterImage(const char *name, imagetype_t type, imageflags_t flags
     return 0;
 }
 
+/*
+===============
+R_PrefetchImage
+===============
+*/
+void R_PrefetchImage(const char *name, imagetype_t type, imageflags_t flags)
+{
+    char    fullname[MAX_QPATH];
+    size_t  len;
+
+    Q_assert(name);
+
+    if (!*name || !r_numImages || flags & IF_KEEP_EXTENSION)
+        return;
+
+    len = register_path(fullname, name, type);
+    if (len < sizeof(fullname))
+        prefetch_image(fullname, len, type);
+}
+
 /*
 =============
 R_GetPicSize
@@ -2266,6 +2569,7 @@ void IMG_Init(void)
 #endif // USE_PNG || USE_JPG || USE_TGA
 
     r_glowmaps = Cvar_Get("r_glowmaps", "1", CVAR_FILES);
+    r_prefetch = Cvar_Get("r_prefetch", "1", 0);
 
     Cmd_Register(img_cmd);
 
@@ -2278,6 +2582,7 @@ void IMG_Init(void)
 
 void IMG_Shutdown(void)
 {
+    IMG_FinishPrefetch();
     Cmd_Deregister(img_cmd);
     memset(r_images, 0, R_NUM_AUTO_IMG * sizeof(r_images[0]));   // clear R_NOTEXTURE
     r_numImages = 0;
@@ -29,9 +29,6 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/error.h"
 #include "refresh/refresh.h"
 
-#define IMG_AllocPixels(x)  FS_AllocTempMem(x)
-#define IMG_FreePixels(x)   FS_FreeTempMem(x)
-
 #define LUMINANCE(r, g, b) ((r) * 0.2126f + (g) * 0.7152f + (b) * 0.0722f)
 
 #define U32_ALPHA   MakeColor(  0,   0,   0, 255)
@@ -84,6 +81,8 @@ extern unsigned r_registration_sequence;
 extern uint32_t d_8to24table[256];
 
 image_t *IMG_Find(const char *name, imagetype_t type, imageflags_t flags);
+void IMG_Prefetch(const char *name, imagetype_t type);
+void IMG_FinishPrefetch(void);
 void IMG_FreeUnused(void);
 void IMG_FreeAll(void);
 void IMG_Init(void);
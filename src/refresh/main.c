@@ -1475,6 +1475,8 @@ R_BeginRegistration
 */
 void R_BeginRegistration(const char *name)
 {
+    IMG_FinishPrefetch();
+
     gl_static.registering = true;
     r_registration_sequence++;
 
@@ -1491,6 +1493,7 @@ R_EndRegistration
 */
 void R_EndRegistration(void)
 {
+    IMG_FinishPrefetch();
     IMG_FreeUnused();
     MOD_FreeUnused();
     Scrap_Upload();
@@ -1108,6 +1108,16 @@ void GL_LoadWorld(const char *name)
     // calculate world size for far clip plane and sky box
     set_world_size(bsp->nodes);
 
+    // start decoding wall textures in background
+    for (i = 0, info = bsp->texinfo; i < bsp->numtexinfo; i++, info++) {
+        if (info->c.flags & SURF_SKY)
+            continue;
+        if (info->c.flags & SURF_NODRAW && bsp->has_bspx)
+            continue;
+        Q_concat(buffer, sizeof(buffer), "textures/", info->name, ".wal");
+        IMG_Prefetch(buffer, IT_WALL);
+    }
+
     // register all texinfo
     for (i = 0, info = bsp->texinfo; i < bsp->numtexinfo; i++, info++) {
         if (info->c.flags & SURF_SKY) {
@@ -0,0 +1,575 @@
+/*
+Copyright (C) 2023 Andrey Nazarov
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// capture.c -- inbound packet capture and replay
+//
+// Capture records every datagram received by the server during a single
+// map, along with the random seed the map was started with. Capture only
+// starts on a map spawned with no clients, so that replay sees every client
+// connect from scratch. Replay starts the same map with the same seed on a
+// dedicated server with networking disabled and feeds the datagrams back,
+// either as fast as possible or in real time, then reports frame timings.
+//
+
+#include "server.h"
+#include "common/intreadwrite.h"
+
+#define CAPTURE_MAGIC       MakeLittleLong('Q','2','P','C')
+#define CAPTURE_VERSION     1
+
+// magic, version, seed, map name, info string with cvars
+#define CAPTURE_HEADER      (12 + MAX_QPATH + MAX_INFO_STRING)
+
+// time, length, address type, pad, port, address
+#define RECORD_HEADER       26
+
+// cvars that affect how the map is started
+static const char *const capture_cvars[] = {
+    "maxclients", "deathmatch", "coop", "skill", "dmflags", "sv_fps"
+};
+
+static struct {
+    char        name[MAX_QPATH];    // pending capture
+    qhandle_t   file;
+    unsigned    start;
+    unsigned    packets;
+    uint64_t    bytes;
+} capture;
+
+static struct {
+    qhandle_t   file;
+    bool        pending;    // waiting for map to spawn
+    bool        active;
+    bool        realtime;
+    bool        quit;
+    unsigned    seed;
+    char        mapname[MAX_QPATH];
+    unsigned    start;
+    uint64_t    wallstart;
+    unsigned    packets;
+
+    // next record
+    bool        have_next;
+    unsigned    time;
+    unsigned    len;
+    netadr_t    from;
+} replay;
+
+/*
+==============================================================================
+
+CAPTURE
+
+==============================================================================
+*/
+
+static void stop_capture(void)
+{
+    if (!capture.file)
+        return;
+
+    FS_CloseFile(capture.file);
+    capture.file = 0;
+
+    Com_Printf("Stopped packet capture: %u packets, %"PRIu64" bytes.\n",
+               capture.packets, capture.bytes);
+}
+
+static void start_capture(const char *mapname)
+{
+    char buffer[MAX_OSPATH];
+    char info[MAX_INFO_STRING];
+    byte header[CAPTURE_HEADER];
+    unsigned seed;
+    int i;
+
+    capture.file = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_WRITE,
+                                   "captures/", capture.name, ".cap");
+    capture.name[0] = 0;
+    if (!capture.file)
+        return;
+
+    // reseed so that everything random about this map can be reproduced
+    seed = Q_rand();
+    Q_srand(seed);
+
+    info[0] = 0;
+    for (i = 0; i < q_countof(capture_cvars); i++) {
+        const char *s = Cvar_VariableString(capture_cvars[i]);
+        if (*s)
+            Info_SetValueForKey(info, capture_cvars[i], s);
+    }
+
+    memset(header, 0, sizeof(header));
+    WL32(header, CAPTURE_MAGIC);
+    WL32(header + 4, CAPTURE_VERSION);
+    WL32(header + 8, seed);
+    Q_strlcpy((char *)header + 12, mapname, MAX_QPATH);
+    Q_strlcpy((char *)header + 12 + MAX_QPATH, info, MAX_INFO_STRING);
+
+    if (FS_Write(header, sizeof(header), capture.file) != sizeof(header)) {
+        Com_EPrintf("Couldn't write capture header.\n");
+        FS_CloseFile(capture.file);
+        capture.file = 0;
+        return;
+    }
+
+    capture.start = svs.realtime;
+    capture.packets = 0;
+    capture.bytes = 0;
+
+    Com_Printf("Capturing packets to %s.\n", buffer);
+}
+
+/*
+==================
+SV_CapturePacket
+
+Called for each packet received from the network.
+==================
+*/
+void SV_CapturePacket(void)
+{
+    byte header[RECORD_HEADER];
+
+    if (!capture.file)
+        return;
+
+    WL32(header, svs.realtime - capture.start);
+    WL16(header + 4, msg_read.cursize);
+    header[6] = net_from.type;
+    header[7] = 0;
+    memcpy(header + 8, &net_from.port, 2);  // kept in network byte order
+    memcpy(header + 10, net_from.ip.u8, 16);
+
+    if (FS_Write(header, sizeof(header), capture.file) != sizeof(header) ||
+        FS_Write(msg_read.data, msg_read.cursize, capture.file) != msg_read.cursize) {
+        Com_EPrintf("Couldn't write captured packet.\n");
+        stop_capture();
+        return;
+    }
+
+    capture.packets++;
+    capture.bytes += msg_read.cursize;
+}
+
+static const cmd_option_t o_capture[] = {
+    { "h", "help", "display this message" },
+    { NULL }
+};
+
+static void SV_Capture_f(void)
+{
+    int c;
+
+    while ((c = Cmd_ParseOptions(o_capture)) != -1) {
+        switch (c) {
+        case 'h':
+            Cmd_PrintUsage(o_capture, "<filename>");
+            Com_Printf("Capture inbound packets starting from next map load.\n");
+            Cmd_PrintHelp(o_capture);
+            return;
+        default:
+            return;
+        }
+    }
+
+    if (!cmd_optarg[0]) {
+        Com_Printf("Missing filename argument.\n");
+        Cmd_PrintHint();
+        return;
+    }
+
+    if (capture.file) {
+        Com_Printf("Already capturing packets.\n");
+        return;
+    }
+
+    if (replay.file) {
+        Com_Printf("Can't capture packets while replaying.\n");
+        return;
+    }
+
+    Q_strlcpy(capture.name, cmd_optarg, sizeof(capture.name));
+    Com_Printf("Packet capture will start on next map load.\n");
+}
+
+static void SV_StopCapture_f(void)
+{
+    if (capture.name[0]) {
+        capture.name[0] = 0;
+        Com_Printf("Pending packet capture cancelled.\n");
+        return;
+    }
+
+    if (!capture.file) {
+        Com_Printf("Not capturing packets.\n");
+        return;
+    }
+
+    stop_capture();
+}
+
+/*
+==============================================================================
+
+REPLAY
+
+==============================================================================
+*/
+
+static void stop_replay(void)
+{
+    unsigned simulated, wall;
+
+    if (!replay.file)
+        return;
+
+    FS_CloseFile(replay.file);
+
+    if (replay.active) {
+        simulated = svs.realtime - replay.start;
+        wall = (Sys_Microseconds() - replay.wallstart) / 1000;
+
+        Com_Printf("Replay finished: %u packets, %u msec of traffic replayed in %u msec",
+                   replay.packets, simulated, wall);
+        if (wall)
+            Com_Printf(" (%.1fx realtime)", (double)simulated / wall);
+        Com_Printf("\n");
+        SV_ProfileReport();
+
+        // resume listening
+        NET_Config(NET_SERVER);
+    }
+
+    if (replay.quit)
+        Cbuf_AddText(&cmd_buffer, "quit\n");
+
+    memset(&replay, 0, sizeof(replay));
+}
+
+static bool read_record(void)
+{
+    byte header[RECORD_HEADER];
+
+    if (FS_Read(header, sizeof(header), replay.file) != sizeof(header))
+        return false;
+
+    replay.time = RL32(header);
+    replay.len = RL16(header + 4);
+    if (replay.len > MAX_PACKETLEN)
+        return false;
+
+    memset(&replay.from, 0, sizeof(replay.from));
+    replay.from.type = header[6];
+    if (replay.from.type != NA_IP && replay.from.type != NA_IP6)
+        return false;
+
+    memcpy(&replay.from.port, header + 8, 2);
+    memcpy(replay.from.ip.u8, header + 10, 16);
+    return true;
+}
+
+static bool is_capture_cvar(const char *name)
+{
+    for (int i = 0; i < q_countof(capture_cvars); i++)
+        if (!Q_stricmp(name, capture_cvars[i]))
+            return true;
+
+    return false;
+}
+
+// map name is pasted into 'map' command, so it must not contain anything
+// with special meaning to the console
+static bool is_capture_mapname(const char *name)
+{
+    const char *s;
+
+    if (FS_ValidatePath(name) == PATH_INVALID)
+        return false;
+
+    for (s = name; *s; s++)
+        if (!Q_ispath(*s) && *s != '/')
+            return false;
+
+    return true;
+}
+
+/*
+==================
+SV_ReplayActive
+
+Challenges can't be reproduced on replay, so connect packets skip
+challenge check while replay is active.
+==================
+*/
+bool SV_ReplayActive(void)
+{
+    return replay.active;
+}
+
+/*
+==================
+SV_ReplayPackets
+
+Feeds captured packets that are due by now into packet_cb.
+Returns false if not replaying.
+==================
+*/
+bool SV_ReplayPackets(void (*packet_cb)(void))
+{
+    if (!replay.active)
+        return false;
+
+    while (replay.have_next && replay.time <= svs.realtime - replay.start) {
+        if (FS_Read(msg_read_buffer, replay.len, replay.file) != replay.len) {
+            replay.have_next = false;
+            break;
+        }
+
+        net_from = replay.from;
+        SZ_InitRead(&msg_read, msg_read_buffer, replay.len);
+        replay.packets++;
+
+        (*packet_cb)();
+
+        // packet may have shut down the server
+        if (!replay.active)
+            return true;
+
+        replay.have_next = read_record();
+    }
+
+    if (!replay.have_next)
+        stop_replay();
+
+    return true;
+}
+
+/*
+==================
+SV_ReplayFrameTime
+
+When replaying as fast as possible, advances time straight to the next
+server frame and doesn't sleep between frames.
+==================
+*/
+unsigned SV_ReplayFrameTime(unsigned msec)
+{
+    if (replay.active && !replay.realtime)
+        return SV_FRAMETIME - min(sv.frameresidual, SV_FRAMETIME);
+
+    return msec;
+}
+
+unsigned SV_ReplaySleepTime(unsigned msec)
+{
+    if (replay.active && !replay.realtime)
+        return 0;
+
+    return msec;
+}
+
+static const cmd_option_t o_replay[] = {
+    { "h", "help", "display this message" },
+    { "q", "quit", "quit when replay is finished" },
+    { "r", "realtime", "replay in real time" },
+    { NULL }
+};
+
+static void SV_Replay_f(void)
+{
+    char buffer[MAX_OSPATH];
+    char info[MAX_INFO_STRING];
+    char key[MAX_INFO_STRING];
+    char value[MAX_INFO_STRING];
+    byte header[CAPTURE_HEADER];
+    const char *s;
+    qhandle_t f;
+    bool realtime = false, quit = false;
+    int c;
+
+    while ((c = Cmd_ParseOptions(o_replay)) != -1) {
+        switch (c) {
+        case 'h':
+            Cmd_PrintUsage(o_replay, "<filename>");
+            Com_Printf("Replay captured packets and report frame timings.\n");
+            Cmd_PrintHelp(o_replay);
+            return;
+        case 'q':
+            quit = true;
+            break;
+        case 'r':
+            realtime = true;
+            break;
+        default:
+            return;
+        }
+    }
+
+    if (!cmd_optarg[0]) {
+        Com_Printf("Missing filename argument.\n");
+        Cmd_PrintHint();
+        return;
+    }
+
+    if (!COM_DEDICATED) {
+        Com_Printf("Replay is only supported on dedicated server.\n");
+        return;
+    }
+
+    if (replay.file) {
+        Com_Printf("Already replaying.\n");
+        return;
+    }
+
+    if (capture.file || capture.name[0]) {
+        Com_Printf("Can't replay while capturing packets.\n");
+        return;
+    }
+
+    f = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_READ,
+                        "captures/", cmd_optarg, ".cap");
+    if (!f)
+        return;
+
+    if (FS_Read(header, sizeof(header), f) != sizeof(header) ||
+        RL32(header) != CAPTURE_MAGIC || RL32(header + 4) != CAPTURE_VERSION) {
+        Com_Printf("%s is not a valid capture file.\n", buffer);
+        FS_CloseFile(f);
+        return;
+    }
+
+    header[12 + MAX_QPATH - 1] = 0;
+    if (!is_capture_mapname((char *)header + 12)) {
+        Com_Printf("%s has invalid map name.\n", buffer);
+        FS_CloseFile(f);
+        return;
+    }
+
+    // shut down running server before changing latched cvars
+    if (svs.initialized)
+        SV_Shutdown("Server is starting packet replay.\n", ERR_DISCONNECT);
+
+    replay.file = f;
+    replay.pending = true;
+    replay.realtime = realtime;
+    replay.quit = quit;
+    replay.seed = RL32(header + 8);
+    header[CAPTURE_HEADER - 1] = 0;
+    Q_strlcpy(replay.mapname, (char *)header + 12, sizeof(replay.mapname));
+    Q_strlcpy(info, (char *)header + 12 + MAX_QPATH, sizeof(info));
+
+    s = info;
+    while (1) {
+        Info_NextPair(&s, key, value);
+        if (!s)
+            break;
+        // capture file shouldn't be able to change arbitrary cvars
+        if (!is_capture_cvar(key)) {
+            Com_WPrintf("Ignoring unexpected cvar %s in capture file.\n", key);
+            continue;
+        }
+        Cvar_Set(key, value);
+    }
+
+    Com_Printf("Replaying %s on %s.\n", buffer, replay.mapname);
+    Cbuf_InsertText(&cmd_buffer, va("map \"%s\"\n", replay.mapname));
+}
+
+/*
+==============================================================================
+
+COMMON
+
+==============================================================================
+*/
+
+/*
+==================
+SV_CaptureSpawn
+
+Called when a new map is spawned, before anything random happens.
+==================
+*/
+void SV_CaptureSpawn(const char *mapname)
+{
+    if (replay.pending) {
+        if (strcmp(mapname, replay.mapname)) {
+            Com_WPrintf("Spawning %s instead of captured %s, replay cancelled.\n",
+                        mapname, replay.mapname);
+            stop_replay();
+            return;
+        }
+
+        Q_srand(replay.seed);
+
+        // captured addresses are real, make sure nothing is sent to them
+        NET_Config(NET_NONE);
+
+        SV_ProfileReset();
+        replay.pending = false;
+        replay.active = true;
+        replay.start = svs.realtime;
+        replay.wallstart = Sys_Microseconds();
+        replay.have_next = read_record();
+        return;
+    }
+
+    // captured and replayed traffic covers a single map
+    stop_replay();
+    stop_capture();
+
+    if (!capture.name[0])
+        return;
+
+    // clients that carried over from previous map can't be replayed
+    if (!LIST_EMPTY(&sv_clientlist)) {
+        Com_Printf("Clients are connected, packet capture postponed.\n");
+        return;
+    }
+
+    start_capture(mapname);
+}
+
+/*
+==================
+SV_CaptureShutdown
+
+Called when server is shut down.
+==================
+*/
+void SV_CaptureShutdown(void)
+{
+    stop_replay();
+    stop_capture();
+}
+
+static const cmdreg_t c_capture[] = {
+    { "capture", SV_Capture_f },
+    { "stopcapture", SV_StopCapture_f },
+    { "replay", SV_Replay_f },
+
+    { NULL }
+};
+
+void SV_RegisterCapture(void)
+{
+    Cmd_Register(c_capture);
+}
@@ -0,0 +1,311 @@
+/*
+Copyright (C) 2023 Andrey Nazarov
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// download.c -- shared cache of UDP download contents
+//
+// Files are keyed by path and compression mode (raw deflate stream from
+// .pkz or plain contents). Each file is read once and the buffer is shared
+// by all clients downloading it. Loose files and packed files that need no
+// decompression are read by async worker. Packed files that need to be
+// inflated are read synchronously, since decompression allocates memory and
+// zone allocator is not thread safe. Unreferenced files are kept in LRU
+// order until total cache size exceeds sv_download_cache_size.
+//
+
+#include "server.h"
+#include "common/async.h"
+
+#define DLCACHE_HASH_SIZE   64
+
+static cvar_t   *sv_download_cache_size;
+
+static struct {
+    list_t      lru;        // least recently used first
+    dlcache_t   *hash[DLCACHE_HASH_SIZE];
+    size_t      total;      // bytes allocated for all entries
+    int         numloading;
+    unsigned    hits, misses;
+} dlcache = {
+    .lru = { &dlcache.lru, &dlcache.lru }
+};
+
+static void unhash_entry(dlcache_t *dl)
+{
+    dlcache_t **back;
+
+    if (dl->stale)
+        return;
+
+    for (back = &dlcache.hash[dl->hash]; *back; back = &(*back)->next) {
+        if (*back == dl) {
+            *back = dl->next;
+            break;
+        }
+    }
+
+    dl->stale = true;
+}
+
+static void free_entry(dlcache_t *dl)
+{
+    unhash_entry(dl);
+    List_Remove(&dl->entry);
+    dlcache.total -= dl->size;
+    Z_Free(dl->data);
+    Z_Free(dl);
+}
+
+// evicts unreferenced files until cache fits in the limit
+static void evict_entries(void)
+{
+    dlcache_t *dl, *next;
+    size_t limit = max(sv_download_cache_size->integer, 0);
+
+    LIST_FOR_EACH_SAFE(dlcache_t, dl, next, &dlcache.lru, entry) {
+        if (dlcache.total <= limit)
+            break;
+        if (!dl->refcount && !dl->loading)
+            free_entry(dl);
+    }
+}
+
+static void load_work(void *arg)
+{
+    dlcache_t *dl = arg;
+
+    dl->result = FS_ReadRaw(dl->raw, dl->data, dl->size);
+}
+
+static void load_done(void *arg)
+{
+    dlcache_t *dl = arg;
+    client_t *client;
+    bool failed;
+
+    FS_CloseFile(dl->f);
+    dl->f = 0;
+    dl->raw = NULL;
+    dl->loading = false;
+    dlcache.numloading--;
+
+    failed = dl->result != dl->size;
+    if (failed) {
+        Com_DPrintf("Couldn't read %s for download: %s\n", dl->path,
+                    dl->result < 0 ? Q_ErrorString(dl->result) : "short read");
+        unhash_entry(dl);
+    }
+
+    // start downloads for clients waiting for this file, hold a reference
+    // since closing failed downloads may release the last one
+    dl->refcount++;
+    FOR_EACH_CLIENT(client) {
+        if (client->download != dl)
+            continue;
+
+        if (failed) {
+            MSG_WriteByte(svc_download);
+            MSG_WriteShort(-1);
+            MSG_WriteByte(0);
+            SV_ClientAddMessage(client, MSG_RELIABLE | MSG_CLEAR);
+            SV_CloseDownload(client);
+        } else {
+            client->downloadpending = true;
+        }
+    }
+
+    SV_ReleaseDownload(dl);
+}
+
+static dlcache_t *find_entry(const char *path, bool deflate, unsigned hash)
+{
+    dlcache_t *dl;
+
+    for (dl = dlcache.hash[hash]; dl; dl = dl->next)
+        if (dl->deflate == deflate && !FS_pathcmp(dl->path, path))
+            return dl;
+
+    return NULL;
+}
+
+/*
+==================
+SV_AcquireDownload
+
+Returns shared cache entry for the file opened for download and adds a
+reference to it, or NULL if file couldn't be read. Takes ownership of file
+handle: it is closed immediately if file is already cached or read
+synchronously, or loaded asynchronously. Entry stays in loading state until
+load is finished, clients referencing it will be notified.
+==================
+*/
+dlcache_t *SV_AcquireDownload(const char *path, bool deflate, qhandle_t f, int size)
+{
+    unsigned hash = FS_HashPath(path, DLCACHE_HASH_SIZE);
+    dlcache_t *dl;
+    size_t len;
+    void *raw;
+    byte *data;
+    int ret;
+
+    dl = find_entry(path, deflate, hash);
+    if (dl) {
+        if (dl->size == size) {
+            FS_CloseFile(f);
+            List_Remove(&dl->entry);
+            List_Append(&dlcache.lru, &dl->entry);
+            dl->refcount++;
+            dlcache.hits++;
+            return dl;
+        }
+
+        // file has changed on disk, drop it once unreferenced
+        unhash_entry(dl);
+        if (!dl->refcount && !dl->loading)
+            free_entry(dl);
+    }
+
+    data = SV_Malloc(size);
+
+    raw = FS_RawFile(f);
+    if (!raw) {
+        ret = FS_Read(data, size, f);
+        FS_CloseFile(f);
+        if (ret != size) {
+            Com_DPrintf("Couldn't read %s for download: %s\n", path,
+                        ret < 0 ? Q_ErrorString(ret) : "short read");
+            Z_Free(data);
+            return NULL;
+        }
+    }
+
+    len = strlen(path);
+    dl = SV_Mallocz(sizeof(*dl) + len);
+    memcpy(dl->path, path, len + 1);
+    dl->data = data;
+    dl->size = size;
+    dl->hash = hash;
+    dl->deflate = deflate;
+    dl->refcount = 1;
+    dl->next = dlcache.hash[hash];
+    dlcache.hash[hash] = dl;
+    List_Append(&dlcache.lru, &dl->entry);
+    dlcache.total += size;
+    dlcache.misses++;
+
+    if (!raw)
+        return dl;
+
+    dl->loading = true;
+    dl->f = f;
+    dl->raw = raw;
+    dlcache.numloading++;
+
+    asyncwork_t work = {
+        .work_cb = load_work,
+        .done_cb = load_done,
+        .cb_arg = dl,
+    };
+    Com_QueueAsyncWork(&work);
+
+    return dl;
+}
+
+/*
+==================
+SV_ReleaseDownload
+
+Drops a reference to cache entry. Entry is kept for future downloads
+unless it is stale or cache is over the limit.
+==================
+*/
+void SV_ReleaseDownload(dlcache_t *dl)
+{
+    Q_assert(dl->refcount > 0);
+    if (--dl->refcount || dl->loading)
+        return;
+
+    if (dl->stale)
+        free_entry(dl);
+    else
+        evict_entries();
+}
+
+/*
+==================
+SV_ShutdownDownloads
+
+Waits for pending loads and frees all cached files. All clients must
+have been removed by now.
+==================
+*/
+void SV_ShutdownDownloads(void)
+{
+    dlcache_t *dl, *next;
+
+    while (dlcache.numloading)
+        Com_WaitAsyncWork();
+
+    LIST_FOR_EACH_SAFE(dlcache_t, dl, next, &dlcache.lru, entry) {
+        Q_assert(!dl->refcount);
+        free_entry(dl);
+    }
+
+    dlcache.hits = dlcache.misses = 0;
+}
+
+static void SV_DownloadCache_f(void)
+{
+    dlcache_t *dl;
+    int count = 0;
+
+    if (LIST_EMPTY(&dlcache.lru)) {
+        Com_Printf("No files in download cache.\n");
+    } else {
+        Com_Printf("refs size     mode    name\n"
+                   "---- -------- ------- ----\n");
+        LIST_FOR_EACH(dlcache_t, dl, &dlcache.lru, entry) {
+            Com_Printf("%4d %8d %-7s %s\n", dl->refcount, dl->size,
+                       dl->loading ? "loading" : dl->deflate ? "deflate" : "plain",
+                       dl->path);
+            count++;
+        }
+    }
+
+    Com_Printf("%d files, %zu bytes, %u hits, %u misses\n",
+               count, dlcache.total, dlcache.hits, dlcache.misses);
+}
+
+static const cmdreg_t c_download[] = {
+    { "downloadcache", SV_DownloadCache_f },
+
+    { NULL }
+};
+
+static void sv_download_cache_size_changed(cvar_t *self)
+{
+    evict_entries();
+}
+
+void SV_RegisterDownloads(void)
+{
+    sv_download_cache_size = Cvar_Get("sv_download_cache_size", "33554432", 0);
+    sv_download_cache_size->changed = sv_download_cache_size_changed;
+
+    Cmd_Register(c_download);
+}
@@ -488,15 +488,17 @@ static bool SV_EntityAttenuatedAway(const vec3_t org, const edict_t *ent)
     ((ent->svflags & (SVF_MONSTER | SVF_DEADMONSTER)) == SVF_MONSTER || (ent->s.renderfx & RF_FRAMELERP))
 
 #define IS_HI_PRIO(ent) \
-    (ent->s.number <= sv_client->maxclients || IS_MONSTER(ent) || ent->solid == SOLID_BSP)
+    (ent->s.number <= prioclient->maxclients || IS_MONSTER(ent) || ent->solid == SOLID_BSP)
 
 #define IS_GIB(ent) \
-    (sv_client->csr->extended ? (ent->s.renderfx & RF_LOW_PRIORITY) : (ent->s.effects & (EF_GIB | EF_GREENGIB)))
+    (prioclient->csr->extended ? (ent->s.renderfx & RF_LOW_PRIORITY) : (ent->s.effects & (EF_GIB | EF_GREENGIB)))
 
 #define IS_LO_PRIO(ent) \
     (IS_GIB(ent) || (!ent->s.modelindex && !ent->s.effects))
 
-static vec3_t clientorg;
+// frames may be built by multiple threads
+static q_thread_local const client_t *prioclient;
+static q_thread_local vec3_t clientorg;
 
 static int entpriocmp(const void *p1, const void *p2)
 {
@@ -527,6 +529,322 @@ static int entnumcmp(const void *p1, const void *p2)
     return a->s.number - b->s.number;
 }
 
+/*
+=============================================================================
+
+Per-frame visibility pre-pass
+
+Entities that may be sent to clients are bucketed by cluster once per server
+frame, and PVS/PHS rows of clusters clients are standing in are decompressed
+once for all clients. Frame building then tests only entities in clusters
+visible to the client instead of scanning all edicts. Pre-pass runs on main
+thread, frame building (possibly on worker threads) only reads the results.
+
+=============================================================================
+*/
+
+#define VIS_LONG_BITS   (int)(sizeof(size_t) * CHAR_BIT)
+
+static struct {
+    bool            active;         // valid for current frame
+    const bsp_t     *bsp;
+    const game_export_t *game;
+    int             numclusters;
+    int             rowlongs;
+
+    // decompressed rows, indexed by cluster * 2 + DVIS_PVS/DVIS_PHS
+    int             *rowindex;      // [numclusters * 2], -1 if not cached
+    size_t          *rows;          // [maxrows * rowlongs]
+    int             numrows;
+    int             maxrows;
+
+    // entities bucketed by cluster, in ascending order within bucket
+    int             *buckets;       // [numclusters + 1]
+    uint16_t        *bucketents;    // [maxbucketents]
+    int             maxbucketents;
+
+    // entities that can't be bucketed and must always be checked
+    uint16_t        always[MAX_EDICTS];
+    int             numalways;
+
+    uint16_t        bucketed[MAX_EDICTS];
+    int             numbucketed;
+} sv_vis;
+
+void SV_FreeFrameVis(void)
+{
+    Z_Free(sv_vis.rowindex);
+    Z_Free(sv_vis.rows);
+    Z_Free(sv_vis.buckets);
+    Z_Free(sv_vis.bucketents);
+    memset(&sv_vis, 0, sizeof(sv_vis));
+}
+
+static void cache_vis_row(int cluster, int vis)
+{
+    int *index;
+    visrow_t temp;
+
+    if (cluster < 0 || cluster >= sv_vis.numclusters)
+        return;
+
+    index = &sv_vis.rowindex[cluster * 2 + vis];
+    if (*index != -1)
+        return;
+
+    if (sv_vis.numrows == sv_vis.maxrows) {
+        sv_vis.maxrows = max(sv_vis.maxrows * 2, 64);
+        sv_vis.rows = Z_ReallocArray(sv_vis.rows, sv_vis.maxrows,
+                                     sv_vis.rowlongs * sizeof(size_t), TAG_SERVER);
+    }
+
+    temp.l[sv_vis.rowlongs - 1] = 0;
+    BSP_ClusterVis(sv_vis.bsp, &temp, cluster, vis);
+    memcpy(sv_vis.rows + sv_vis.numrows * sv_vis.rowlongs, temp.l,
+           sv_vis.rowlongs * sizeof(size_t));
+    *index = sv_vis.numrows++;
+}
+
+static const size_t *get_vis_row(int cluster, int vis, visrow_t *temp)
+{
+    if (cluster >= 0 && cluster < sv_vis.numclusters) {
+        int index = sv_vis.rowindex[cluster * 2 + vis];
+        if (index != -1)
+            return sv_vis.rows + index * sv_vis.rowlongs;
+    }
+
+    // not cached, shouldn't normally happen
+    temp->l[sv_vis.rowlongs - 1] = 0;
+    BSP_ClusterVis(sv_vis.bsp, temp, cluster, vis);
+    return temp->l;
+}
+
+static int box_leafs(const vec3_t org, const mleaf_t **leafs, int listsize)
+{
+    vec3_t mins, maxs;
+
+    for (int i = 0; i < 3; i++) {
+        mins[i] = org[i] - 8;
+        maxs[i] = org[i] + 8;
+    }
+
+    return CM_BoxLeafs_headnode(mins, maxs, leafs, listsize, sv_vis.bsp->nodes, NULL);
+}
+
+static void cache_client_rows(const client_t *client)
+{
+    const mleaf_t *leafs[64];
+    vec3_t org;
+    int i, count;
+
+    SV_GetClient_ViewOrg(client, org);
+
+    count = box_leafs(org, leafs, q_countof(leafs));
+    for (i = 0; i < count; i++)
+        cache_vis_row(leafs[i]->cluster, DVIS_PVS);
+
+    cache_vis_row(CM_PointLeaf(client->cm, org)->cluster, DVIS_PHS);
+}
+
+static void bucket_entities(void)
+{
+    int *buckets = sv_vis.buckets;
+    int i, e, c, total;
+    edict_t *ent;
+
+    memset(buckets, 0, sizeof(buckets[0]) * (sv_vis.numclusters + 1));
+    sv_vis.numalways = sv_vis.numbucketed = 0;
+    total = 0;
+
+    // count entities per cluster
+    for (e = 1; e < ge->num_edicts; e++) {
+        ent = EDICT_NUM(e);
+
+        if (!ent->inuse && (g_features->integer & GMF_PROPERINUSE))
+            continue;
+        if (ent->svflags & SVF_NOCLIENT)
+            continue;
+        if (!HAS_EFFECTS(ent))
+            continue;
+
+        if (ent->num_clusters == -1 || ent->svflags & SVF_NOCULL) {
+            sv_vis.always[sv_vis.numalways++] = e;
+            continue;
+        }
+
+        for (i = 0; i < ent->num_clusters; i++) {
+            c = ent->clusternums[i];
+            if (c < 0 || c >= sv_vis.numclusters)
+                break;
+        }
+        if (i < ent->num_clusters) {
+            sv_vis.always[sv_vis.numalways++] = e;
+            continue;
+        }
+
+        for (i = 0; i < ent->num_clusters; i++)
+            buckets[ent->clusternums[i]]++;
+        total += ent->num_clusters;
+
+        sv_vis.bucketed[sv_vis.numbucketed++] = e;
+    }
+
+    // turn counts into end offsets
+    for (c = 1; c < sv_vis.numclusters; c++)
+        buckets[c] += buckets[c - 1];
+    buckets[sv_vis.numclusters] = total;
+
+    if (total > sv_vis.maxbucketents) {
+        sv_vis.maxbucketents = Q_ALIGN(total, 1024);
+        Z_Free(sv_vis.bucketents);
+        sv_vis.bucketents = SV_Malloc(sizeof(sv_vis.bucketents[0]) * sv_vis.maxbucketents);
+    }
+
+    // fill in reverse, leaving start offsets and ascending order
+    for (i = sv_vis.numbucketed - 1; i >= 0; i--) {
+        e = sv_vis.bucketed[i];
+        ent = EDICT_NUM(e);
+        for (c = 0; c < ent->num_clusters; c++)
+            sv_vis.bucketents[--buckets[ent->clusternums[c]]] = e;
+    }
+}
+
+/*
+=============
+SV_PrepareFrameVis
+
+Called once per frame before client frames are built.
+=============
+*/
+void SV_PrepareFrameVis(void)
+{
+    const bsp_t *bsp = sv.cm.cache;
+    client_t *client;
+    bool need = false;
+
+    sv_vis.active = false;
+
+    if (sv.state != ss_game || !ge || !bsp || !bsp->vis || sv_novis->integer)
+        return;
+
+    FOR_EACH_CLIENT(client) {
+        if (CLIENT_ACTIVE(client) && SV_CLIENTSYNC(client) && client->edict->client) {
+            need = true;
+            break;
+        }
+    }
+    if (!need)
+        return;
+
+    if (sv_vis.bsp != bsp) {
+        SV_FreeFrameVis();
+        sv_vis.bsp = bsp;
+        sv_vis.numclusters = bsp->vis->numclusters;
+        sv_vis.rowlongs = VIS_FAST_LONGS(bsp->visrowsize);
+        sv_vis.rowindex = SV_Malloc(sizeof(sv_vis.rowindex[0]) * sv_vis.numclusters * 2);
+        sv_vis.buckets = SV_Malloc(sizeof(sv_vis.buckets[0]) * (sv_vis.numclusters + 1));
+    }
+
+    // rows are only valid for this frame, visibility patches may change
+    memset(sv_vis.rowindex, -1, sizeof(sv_vis.rowindex[0]) * sv_vis.numclusters * 2);
+    sv_vis.numrows = 0;
+
+    FOR_EACH_CLIENT(client)
+        if (CLIENT_ACTIVE(client) && SV_CLIENTSYNC(client) && client->edict->client)
+            cache_client_rows(client);
+
+    bucket_entities();
+
+    sv_vis.game = ge;
+    sv_vis.active = true;
+}
+
+static bool frame_vis_usable(const client_t *client)
+{
+    return sv_vis.active && client->ge == sv_vis.game
+        && client->cm->cache == sv_vis.bsp && !sv_novis->integer;
+}
+
+// same as CM_FatPVS, but uses cached rows
+static void frame_fat_pvs(visrow_t *mask, const vec3_t org)
+{
+    const mleaf_t *leafs[64];
+    int clusters[64];
+    const size_t *row;
+    visrow_t temp;
+    int i, j, count;
+
+    count = box_leafs(org, leafs, q_countof(leafs));
+    Q_assert(count > 0);
+
+    memset(mask->l, 0, sv_vis.rowlongs * sizeof(size_t));
+
+    for (i = 0; i < count; i++) {
+        clusters[i] = leafs[i]->cluster;
+        for (j = 0; j < i; j++)
+            if (clusters[i] == clusters[j])
+                break;  // already have the cluster we want
+        if (j < i)
+            continue;
+        row = get_vis_row(clusters[i], DVIS_PVS, &temp);
+        for (j = 0; j < sv_vis.rowlongs; j++)
+            mask->l[j] |= row[j];
+    }
+}
+
+static void frame_cluster_vis(visrow_t *mask, int cluster, int vis)
+{
+    visrow_t temp;
+    const size_t *row = get_vis_row(cluster, vis, &temp);
+
+    memcpy(mask->l, row, sv_vis.rowlongs * sizeof(size_t));
+}
+
+#define MARK_ENTITY(marks, e) \
+    ((marks)[(e) / VIS_LONG_BITS] |= (size_t)1 << ((e) % VIS_LONG_BITS))
+
+// returns candidate entity numbers in ascending order
+static int frame_vis_entities(const visrow_t *pvs, const visrow_t *phs,
+                              int clentnum, uint16_t *list)
+{
+    size_t marks[MAX_EDICTS / VIS_LONG_BITS];
+    int i, j, c, e, end, count;
+
+    memset(marks, 0, sizeof(marks));
+
+    for (i = 0; i < sv_vis.numalways; i++)
+        MARK_ENTITY(marks, sv_vis.always[i]);
+
+    if (clentnum > 0 && clentnum < MAX_EDICTS)
+        MARK_ENTITY(marks, clentnum);
+
+    for (i = 0; i < sv_vis.rowlongs; i++) {
+        if (!(pvs->l[i] | phs->l[i]))
+            continue;
+        c = i * VIS_LONG_BITS;
+        end = min(c + VIS_LONG_BITS, sv_vis.numclusters);
+        for (; c < end; c++) {
+            if (!Q_IsBitSet(pvs->b, c) && !Q_IsBitSet(phs->b, c))
+                continue;
+            for (j = sv_vis.buckets[c]; j < sv_vis.buckets[c + 1]; j++)
+                MARK_ENTITY(marks, sv_vis.bucketents[j]);
+        }
+    }
+
+    count = 0;
+    for (i = 0; i < q_countof(marks); i++) {
+        if (!marks[i])
+            continue;
+        e = i * VIS_LONG_BITS;
+        end = e + VIS_LONG_BITS;
+        for (; e < end; e++)
+            if (marks[i] & ((size_t)1 << (e % VIS_LONG_BITS)))
+                list[count++] = e;
+    }
+
+    return count;
+}
+
 /*
 =============
 SV_BuildClientFrame
@@ -551,6 +869,8 @@ void SV_BuildClientFrame(client_t *client)
     int         max_packet_entities;
     edict_t     *edicts[MAX_EDICTS];
     int         num_edicts;
+    uint16_t    entnums[MAX_EDICTS];
+    int         num_entnums;
     qboolean (*visible)(edict_t *, edict_t *) = NULL;
     qboolean (*customize)(edict_t *, edict_t *, customize_entity_t *) = NULL;
     customize_entity_t temp;
@@ -616,15 +936,25 @@ void SV_BuildClientFrame(client_t *client)
         customize = gex->CustomizeEntityToClient;
     }
 
-    CM_FatPVS(client->cm, &clientpvs, org);
-    BSP_ClusterVis(client->cm->cache, &clientphs, clientcluster, DVIS_PHS);
+    // build up the list of candidate entities
+    if (frame_vis_usable(client)) {
+        frame_fat_pvs(&clientpvs, org);
+        frame_cluster_vis(&clientphs, clientcluster, DVIS_PHS);
+        num_entnums = frame_vis_entities(&clientpvs, &clientphs, client->number + 1, entnums);
+    } else {
+        CM_FatPVS(client->cm, &clientpvs, org);
+        BSP_ClusterVis(client->cm->cache, &clientphs, clientcluster, DVIS_PHS);
+        for (e = 1, num_entnums = 0; e < client->ge->num_edicts; e++)
+            entnums[num_entnums++] = e;
+    }
 
     // build up the list of visible entities
     frame->num_entities = 0;
     frame->first_entity = client->next_entity;
 
     num_edicts = 0;
-    for (e = 1; e < client->ge->num_edicts; e++) {
+    for (i = 0; i < num_entnums; i++) {
+        e = entnums[i];
         ent = EDICT_NUM2(client->ge, e);
 
         // ignore entities not in use
@@ -700,11 +1030,8 @@ void SV_BuildClientFrame(client_t *client)
     // prioritize entities on overflow
     if (num_edicts > max_packet_entities) {
         VectorCopy(org, clientorg);
-        sv_client = client;
-        sv_player = client->edict;
+        prioclient = client;
         qsort(edicts, num_edicts, sizeof(edicts[0]), entpriocmp);
-        sv_client = NULL;
-        sv_player = NULL;
         num_edicts = max_packet_entities;
         qsort(edicts, num_edicts, sizeof(edicts[0]), entnumcmp);
     }
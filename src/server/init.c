@@ -125,15 +125,21 @@ void SV_SpawnServer(const mapcmd_t *cmd)
     SV_SendAsyncPackets();
 
     // free current level
+    SV_FreeFrameVis();
     CM_FreeMap(&sv.cm);
 
     // wipe the entire per-level structure
     memset(&sv, 0, sizeof(sv));
+
+    // start or stop capture, seed RNG for replay
+    SV_CaptureSpawn(cmd->server);
+
     sv.spawncount = Q_rand() & INT_MAX;
 
     // set legacy spawncounts
     FOR_EACH_CLIENT(client) {
         client->spawncount = sv.spawncount;
+        client->leaf = NULL;
     }
 
     // set framerate parameters
@@ -388,6 +394,7 @@ void SV_InitGame(unsigned mvd_spawn)
         SCR_BeginLoadingPlaque();
         R_ClearDebugLines();
 
+        SV_FreeFrameVis();
         CM_FreeMap(&sv.cm);
         memset(&sv, 0, sizeof(sv));
 
@@ -449,6 +456,11 @@ void SV_InitGame(unsigned mvd_spawn)
 
     svs.maxclients = sv_maxclients->integer;
     svs.client_pool = SV_Mallocz(sizeof(svs.client_pool[0]) * svs.maxclients);
+    SV_InitClientMap();
+
+    // generate secret for stateless challenges
+    if (!Sys_GetRandomBytes(svs.challenge_key, sizeof(svs.challenge_key)))
+        Com_Error(ERR_FATAL, "Couldn't generate challenge secret");
 
 #if USE_ZLIB
     svs.z.zalloc = SV_zalloc;
@@ -457,6 +469,7 @@ void SV_InitGame(unsigned mvd_spawn)
              -MAX_WBITS, 9, Z_DEFAULT_STRATEGY) == Z_OK);
     svs.z_buffer_size = ZPACKET_HEADER + deflateBound(&svs.z, MAX_MSGLEN);
     svs.z_buffer = SV_Malloc(svs.z_buffer_size);
+    svs.z_source = SV_Malloc(MAX_MSGLEN);
 #endif
 
     svs.csr = cs_remap_old;
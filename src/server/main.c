@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "server.h"
 #include "client/input.h"
+#include "common/mdfour.h"
 
 master_t    sv_masters[MAX_MASTERS];   // address of group servers
 
@@ -80,6 +81,11 @@ cvar_t  *sv_max_download_size;
 cvar_t  *sv_max_packet_entities;
 cvar_t  *sv_trunc_packet_entities;
 cvar_t  *sv_prioritize_entities;
+cvar_t  *sv_send_threads;
+#if USE_TESTS
+cvar_t  *sv_send_fault;
+#endif
+cvar_t  *sv_broadphase;
 
 cvar_t  *sv_strafejump_hack;
 cvar_t  *sv_waterjump_hack;
@@ -94,6 +100,7 @@ cvar_t  *sv_recycle;
 cvar_t  *sv_enhanced_setplayer;
 
 cvar_t  *sv_iplimit;
+cvar_t  *sv_challenge_cookies;
 cvar_t  *sv_status_limit;
 cvar_t  *sv_status_show;
 cvar_t  *sv_uptime;
@@ -111,18 +118,175 @@ static bool     sv_registered;
 
 //============================================================================
 
+/*
+Connected clients are indexed by remote IP address and the value that
+identifies them in sequenced packets: qport for clients that send it, UDP
+port otherwise. Qport keyed entries don't depend on UDP port and stay
+valid when NAT port is fixed up.
+*/
+
+typedef enum {
+    CK_PORT,        // no qport, match by UDP port
+    CK_QPORT8,      // 8-bit qport (R1Q2, Q2PRO)
+    CK_QPORT16,     // 16-bit qport (vanilla)
+} client_key_kind_t;
+
+typedef struct {
+    netadrip_t  ip;
+    uint8_t     type;
+    uint8_t     kind;
+    uint16_t    id;
+} client_key_t;
+
+static uint32_t client_key_hash(const void *const val)
+{
+    const client_key_t *key = val;
+    uint32_t h = HashInt32(&key->ip.u32[0]);
+
+    h = HashCombine(h, HashInt64(&key->ip.u64[1]));
+    h = HashCombine(h, key->ip.u32[1]);
+    return HashCombine(h, key->type | key->kind << 8 | (uint32_t)key->id << 16);
+}
+
+static void make_client_key(client_key_t *key, const netadr_t *adr,
+                            client_key_kind_t kind, int id)
+{
+    memset(key, 0, sizeof(*key));
+    key->type = adr->type;
+    key->kind = kind;
+    key->id = id;
+
+    switch (adr->type) {
+    case NA_IP:
+        key->ip.u32[0] = adr->ip.u32[0];
+        break;
+    case NA_IP6:
+        key->ip = adr->ip;
+        break;
+    default:
+        break;
+    }
+}
+
+static void client_key_for(client_key_t *key, const client_t *client)
+{
+    const netchan_t *netchan = &client->netchan;
+
+    if (client->protocol == PROTOCOL_VERSION_DEFAULT)
+        make_client_key(key, &netchan->remote_address, CK_QPORT16, netchan->qport);
+    else if (netchan->qport)
+        make_client_key(key, &netchan->remote_address, CK_QPORT8, netchan->qport);
+    else
+        make_client_key(key, &netchan->remote_address, CK_PORT, netchan->remote_address.port);
+}
+
+// returns true if `a' comes before `b' in client list
+static bool client_precedes(const client_t *a, const client_t *b)
+{
+    client_t *cl;
+
+    FOR_EACH_CLIENT(cl) {
+        if (cl == a)
+            return true;
+        if (cl == b)
+            return false;
+    }
+
+    return false;
+}
+
+// if several clients share the same key, index the one that comes first in
+// client list, like the linear search used to do
+static void add_client_key(const client_key_t *key, client_t *client)
+{
+    client_t **cur = HashMap_Lookup(client_t *, svs.client_map, key);
+
+    if (cur && !client_precedes(client, *cur))
+        return;
+
+    HashMap_Insert(svs.client_map, key, &client);
+}
+
+void SV_InitClientMap(void)
+{
+    svs.client_map = HashMap_TagCreate(client_key_t, client_t *,
+                                       client_key_hash, NULL, TAG_SERVER);
+    HashMap_Reserve(svs.client_map, svs.maxclients);
+}
+
+static void SV_AddClientMap(client_t *client)
+{
+    client_key_t key;
+
+    client_key_for(&key, client);
+    add_client_key(&key, client);
+}
+
+static void SV_RemoveClientMap(client_t *client)
+{
+    client_key_t key, other_key;
+    client_t **cur, *other;
+
+    if (!svs.client_map)
+        return;
+
+    client_key_for(&key, client);
+    cur = HashMap_Lookup(client_t *, svs.client_map, &key);
+    if (!cur || *cur != client)
+        return;
+
+    HashMap_Erase(svs.client_map, &key);
+
+    // fall back to another client with the same key, if any
+    FOR_EACH_CLIENT(other) {
+        if (other == client)
+            continue;
+        client_key_for(&other_key, other);
+        if (!memcmp(&key, &other_key, sizeof(key)))
+            add_client_key(&key, other);
+    }
+}
+
+static client_t *SV_FindClientMap(void)
+{
+    client_key_t key;
+    client_t **cur, *client = NULL;
+
+    if (msg_read.cursize >= PACKET_HEADER) {
+        make_client_key(&key, &net_from, CK_QPORT16, RL16(&msg_read.data[8]));
+        if ((cur = HashMap_Lookup(client_t *, svs.client_map, &key)))
+            client = *cur;
+    }
+
+    if (msg_read.cursize >= PACKET_HEADER - 1) {
+        make_client_key(&key, &net_from, CK_QPORT8, msg_read.data[8]);
+        if ((cur = HashMap_Lookup(client_t *, svs.client_map, &key)))
+            if (!client || client_precedes(*cur, client))
+                client = *cur;
+    }
+
+    make_client_key(&key, &net_from, CK_PORT, net_from.port);
+    if ((cur = HashMap_Lookup(client_t *, svs.client_map, &key)))
+        if (!client || client_precedes(*cur, client))
+            client = *cur;
+
+    return client;
+}
+
 void SV_RemoveClient(client_t *client)
 {
     if (client->msg_pool) {
         SV_ShutdownClientSend(client);
     }
 
-    Netchan_Close(&client->netchan);
-
     // unlink them from active client list, but don't clear the list entry
     // itself to make code that traverses client list in a loop happy!
     List_Remove(&client->entry);
 
+    SV_RemoveClientMap(client);
+
+    Netchan_Close(&client->netchan);
+
 #if USE_MVD_CLIENT
     // unlink them from MVD client list
     if (sv.state == ss_broadcast) {
@@ -559,16 +723,29 @@ static void SVC_Ping(void)
 
 /*
 =================
-SVC_GetChallenge
+challenge_cookie
 
-Returns a challenge number that can be used
-in a subsequent client_connect command.
-We do this to prevent denial of service attacks that
-flood the server with invalid connection IPs.  With a
-challenge, they must give a valid IP address.
+Stateless challenge is a keyed hash of client address, port and time epoch.
+It is verified by recomputing, so flood of getchallenge packets from spoofed
+addresses can't evict challenges of legitimate clients.
 =================
 */
-static void SVC_GetChallenge(void)
+static unsigned challenge_cookie(const netadr_t *adr, uint64_t epoch)
+{
+    struct mdfour md;
+    uint32_t digest[4];
+
+    mdfour_begin(&md);
+    mdfour_update(&md, (const uint8_t *)svs.challenge_key, sizeof(svs.challenge_key));
+    mdfour_update(&md, (const uint8_t *)&epoch, sizeof(epoch));
+    mdfour_update(&md, adr->ip.u8, adr->type == NA_IP6 ? 16 : 4);
+    mdfour_update(&md, (const uint8_t *)&adr->port, sizeof(adr->port));
+    mdfour_result(&md, (uint8_t *)digest);
+
+    return digest[0] & INT_MAX;
+}
+
+static unsigned alloc_challenge(void)
 {
     int         i, oldest;
     unsigned    challenge;
@@ -601,6 +778,29 @@ static void SVC_GetChallenge(void)
         svs.challenges[i].time = com_eventTime;
     }
 
+    return challenge;
+}
+
+/*
+=================
+SVC_GetChallenge
+
+Returns a challenge number that can be used
+in a subsequent client_connect command.
+We do this to prevent denial of service attacks that
+flood the server with invalid connection IPs.  With a
+challenge, they must give a valid IP address.
+=================
+*/
+static void SVC_GetChallenge(void)
+{
+    unsigned    challenge;
+
+    if (sv_challenge_cookies->integer)
+        challenge = challenge_cookie(&net_from, Sys_Microseconds() / CHALLENGE_EPOCH);
+    else
+        challenge = alloc_challenge();
+
     // send it back
     Netchan_OutOfBand(NS_SERVER, &net_from,
                       "challenge %u p=34,35,36", challenge);
@@ -654,18 +854,25 @@ static bool parse_basic_params(conn_params_t *p)
     return true;
 }
 
-static bool permit_connection(conn_params_t *p)
+static bool check_challenge(const conn_params_t *p)
 {
-    addrmatch_t *match;
-    int i, count;
-    client_t *cl;
-    const char *s;
+    uint64_t epoch;
+    int i;
 
-    // loopback clients are permitted without any checks
-    if (NET_IsLocalAddress(&net_from))
+    // captured challenges can't be reproduced
+    if (SV_ReplayActive())
         return true;
 
-    // see if the challenge is valid
+    if (sv_challenge_cookies->integer) {
+        // accept challenges from previous epoch too
+        epoch = Sys_Microseconds() / CHALLENGE_EPOCH;
+        if (p->challenge == challenge_cookie(&net_from, epoch) ||
+            p->challenge == challenge_cookie(&net_from, epoch - 1))
+            return true;
+
+        return reject("Bad challenge.\n");
+    }
+
     for (i = 0; i < MAX_CHALLENGES; i++) {
         if (!svs.challenges[i].challenge)
             continue;
@@ -682,6 +889,23 @@ static bool permit_connection(conn_params_t *p)
         return reject("No challenge for address.\n");
 
     svs.challenges[i].challenge = 0;
+    return true;
+}
+
+static bool permit_connection(conn_params_t *p)
+{
+    addrmatch_t *match;
+    int count;
+    client_t *cl;
+    const char *s;
+
+    // loopback clients are permitted without any checks
+    if (NET_IsLocalAddress(&net_from))
+        return true;
+
+    // see if the challenge is valid
+    if (!check_challenge(p))
+        return false;
 
     // check for banned address
     if ((match = SV_MatchAddress(&sv_banlist, &net_from)) != NULL) {
@@ -1175,6 +1399,7 @@ static void SVC_DirectConnect(void)
 
     // add them to the linked list of connected clients
     List_SeqAdd(&sv_clientlist, &newcl->entry);
+    SV_AddClientMap(newcl);
 
     Com_DPrintf("Going from cs_free to cs_assigned for %s\n", newcl->name);
     newcl->state = cs_assigned;
@@ -1498,7 +1723,8 @@ static void SV_PacketEvent(void)
 {
     client_t    *client;
     netchan_t   *netchan;
-    int         qport;
+
+    SV_CapturePacket();
 
     if (msg_read.cursize < 4) {
         return;
@@ -1516,59 +1742,34 @@ static void SV_PacketEvent(void)
     }
 
     // check for packets from connected clients
-    FOR_EACH_CLIENT(client) {
-        netchan = &client->netchan;
-        if (!NET_IsEqualBaseAdr(&net_from, &netchan->remote_address)) {
-            continue;
-        }
-
-        // read the qport out of the message so we can fix up
-        // stupid address translating routers
-        if (client->protocol == PROTOCOL_VERSION_DEFAULT) {
-            if (msg_read.cursize < PACKET_HEADER) {
-                continue;
-            }
-            qport = RL16(&msg_read.data[8]);
-            if (netchan->qport != qport) {
-                continue;
-            }
-        } else if (netchan->qport) {
-            if (msg_read.cursize < PACKET_HEADER - 1) {
-                continue;
-            }
-            qport = msg_read.data[8];
-            if (netchan->qport != qport) {
-                continue;
-            }
-        } else {
-            if (netchan->remote_address.port != net_from.port) {
-                continue;
-            }
-        }
+    client = SV_FindClientMap();
+    if (!client) {
+        return;
+    }
 
-        if (netchan->remote_address.port != net_from.port) {
-            Com_DPrintf("Fixing up a translated port for %s: %d --> %d\n",
-                        client->name, netchan->remote_address.port, net_from.port);
-            netchan->remote_address.port = net_from.port;
-        }
+    // fix up stupid address translating routers
+    netchan = &client->netchan;
+    if (netchan->remote_address.port != net_from.port) {
+        Com_DPrintf("Fixing up a translated port for %s: %d --> %d\n",
+                    client->name, netchan->remote_address.port, net_from.port);
+        netchan->remote_address.port = net_from.port;
+    }
 
-        if (!Netchan_Process(netchan))
-            break;
+    if (!Netchan_Process(netchan))
+        return;
 
-        if (client->state == cs_zombie)
-            break;
+    if (client->state == cs_zombie)
+        return;
 
-        // this is a valid, sequenced packet, so process it
-        client->lastmessage = svs.realtime;    // don't timeout
+    // this is a valid, sequenced packet, so process it
+    client->lastmessage = svs.realtime;    // don't timeout
 #if USE_ICMP
-        client->unreachable = false; // don't drop
+    client->unreachable = false; // don't drop
 #endif
-        if (netchan->dropped > 0)
-            client->frameflags |= FF_CLIENTDROP;
+    if (netchan->dropped > 0)
+        client->frameflags |= FF_CLIENTDROP;
 
-        SV_ExecuteClientMessage(client);
-        break;
-    }
+    SV_ExecuteClientMessage(client);
 }
 
 #if USE_PMTUDISC
@@ -1916,35 +2117,47 @@ Returns amount of extra frametime available for sleeping on IO.
 */
 unsigned SV_Frame(unsigned msec)
 {
+    bool ran = false;
+
 #if USE_CLIENT
     time_before_game = time_after_game = 0;
 #endif
 
+    SV_ProfileStart();
+
     // advance local server time
+    msec = SV_ReplayFrameTime(msec);
     svs.realtime += msec;
 
     if (COM_DEDICATED) {
         // process console commands if not running a client
         Cbuf_Execute(&cmd_buffer);
+        SV_ProfilePhase(SV_PHASE_COMMANDS);
     }
 
 #if USE_MVD_CLIENT
     // run connections to MVD/GTV servers
     MVD_Frame();
+    SV_ProfilePhase(SV_PHASE_MVD_CLIENT);
 #endif
 
-    // read packets from UDP clients
-    NET_GetPackets(NS_SERVER, SV_PacketEvent);
+    // read packets from UDP clients, or from capture file
+    if (!SV_ReplayPackets(SV_PacketEvent))
+        NET_GetPackets(NS_SERVER, SV_PacketEvent);
+    SV_ProfilePhase(SV_PHASE_PACKETS);
 
     if (svs.initialized) {
         // run connection to the anticheat server
         AC_Run();
+        SV_ProfilePhase(SV_PHASE_ANTICHEAT);
 
         // run connections from MVD/GTV clients
         SV_MvdRunClients();
+        SV_ProfilePhase(SV_PHASE_MVD_SERVER);
 
         // deliver fragments and reliable messages for connecting clients
         SV_SendAsyncPackets();
+        SV_ProfilePhase(SV_PHASE_ASYNC);
     }
 
     // move autonomous things around if enough time has passed
@@ -1956,38 +2169,51 @@ unsigned SV_Frame(unsigned msec)
     if (svs.initialized && !check_paused()) {
         // check timeouts
         SV_CheckTimeouts();
+        SV_ProfilePhase(SV_PHASE_TIMEOUTS);
 
         // update ping based on the last known frame from all clients
         SV_CalcPings();
+        SV_ProfilePhase(SV_PHASE_PINGS);
 
         // give the clients some timeslices
         SV_GiveMsec();
+        SV_ProfilePhase(SV_PHASE_GIVEMSEC);
 
         // let everything in the world think and move
         SV_RunGameFrame();
+        SV_ProfilePhase(SV_PHASE_GAME);
 
         // send messages back to the UDP clients
         SV_SendClientMessages();
+        SV_ProfilePhase(SV_PHASE_SEND);
 
         // send a heartbeat to the master if needed
         SV_MasterHeartbeat();
+        SV_ProfilePhase(SV_PHASE_HEARTBEAT);
 
         // clear teleport flags, etc for next frame
         SV_PrepWorldFrame();
+        SV_ProfilePhase(SV_PHASE_PREPWORLD);
 
         // advance for next frame
         sv.framenum++;
+        ran = true;
     }
 
+    // record timings of this frame along with everything
+    // that ran since the previous one
+    SV_ProfileEndFrame(ran);
+
     if (COM_DEDICATED) {
         // run cmd buffer in dedicated mode
         Cbuf_Frame(&cmd_buffer);
+        SV_ProfilePhase(SV_PHASE_COMMANDS);
     }
 
     // decide how long to sleep next frame
     sv.frameresidual -= SV_FRAMETIME;
     if (sv.frameresidual < SV_FRAMETIME) {
-        return SV_FRAMETIME - sv.frameresidual;
+        return SV_ReplaySleepTime(SV_FRAMETIME - sv.frameresidual);
     }
 
     // don't accumulate bogus residual
@@ -2117,6 +2343,11 @@ static void sv_rate_changed(cvar_t *self)
     Cvar_ClampInteger(sv_min_rate, 1500, Cvar_ClampInteger(sv_max_rate, 1500, INT_MAX));
 }
 
+static void sv_send_threads_changed(cvar_t *self)
+{
+    Cvar_ClampInteger(self, 0, MAX_SEND_THREADS);
+}
+
 void sv_sec_timeout_changed(cvar_t *self)
 {
     self->integer = 1000 * Cvar_ClampValue(self, 0, 24 * 24 * 60 * 60);
@@ -2176,6 +2407,12 @@ void SV_Init(void)
 
     SV_RegisterSavegames();
 
+    SV_RegisterProfile();
+
+    SV_RegisterCapture();
+
+    SV_RegisterDownloads();
+
     Cvar_Get("protocol", STRINGIFY(PROTOCOL_VERSION_DEFAULT), CVAR_SERVERINFO | CVAR_ROM);
 
     Cvar_Get("skill", "1", CVAR_LATCH);
@@ -2242,6 +2479,13 @@ void SV_Init(void)
     sv_max_packet_entities = Cvar_Get("sv_max_packet_entities", "0", 0);
     sv_trunc_packet_entities = Cvar_Get("sv_trunc_packet_entities", "1", 0);
     sv_prioritize_entities = Cvar_Get("sv_prioritize_entities", "0", 0);
+    sv_send_threads = Cvar_Get("sv_send_threads", "0", 0);
+    sv_send_threads->changed = sv_send_threads_changed;
+    sv_send_threads_changed(sv_send_threads);
+#if USE_TESTS
+    sv_send_fault = Cvar_Get("sv_send_fault", "0", 0);
+#endif
+    sv_broadphase = Cvar_Get("sv_broadphase", "0", 0);
 
     sv_strafejump_hack = Cvar_Get("sv_strafejump_hack", "1", CVAR_LATCH);
     sv_waterjump_hack = Cvar_Get("sv_waterjump_hack", "1", CVAR_LATCH);
@@ -2260,6 +2504,7 @@ void SV_Init(void)
     sv_enhanced_setplayer = Cvar_Get("sv_enhanced_setplayer", "0", 0);
 
     sv_iplimit = Cvar_Get("sv_iplimit", "3", 0);
+    sv_challenge_cookies = Cvar_Get("sv_challenge_cookies", "1", 0);
 
     sv_status_show = Cvar_Get("sv_status_show", "2", 0);
 
@@ -2385,6 +2630,10 @@ void SV_Shutdown(const char *finalmsg, error_type_t type)
 
     AC_Disconnect();
 
+    SV_CaptureShutdown();
+
+    SV_ShutdownSendThreads();
+
     SV_MvdShutdown(type);
 
     SV_FinalMessage(finalmsg, type);
@@ -2392,14 +2641,21 @@ void SV_Shutdown(const char *finalmsg, error_type_t type)
     SV_ShutdownGameProgs();
 
     // free current level
+    SV_FreeFrameVis();
     CM_FreeMap(&sv.cm);
     memset(&sv, 0, sizeof(sv));
 
+    // free cached downloads
+    SV_ShutdownDownloads();
+
     // free server static data
     Z_Free(svs.client_pool);
+    if (svs.client_map)
+        HashMap_Destroy(svs.client_map);
 #if USE_ZLIB
     deflateEnd(&svs.z);
     Z_Free(svs.z_buffer);
+    Z_Free(svs.z_source);
 #endif
     memset(&svs, 0, sizeof(svs));
 
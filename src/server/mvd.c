@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "server.h"
 #include "server/mvd/protocol.h"
+#include "system/pthread.h"
 
 #define FOR_EACH_GTV(client) \
     LIST_FOR_EACH(gtv_client_t, client, &gtv_client_list, entry)
@@ -35,14 +36,16 @@ typedef struct {
     clstate_t   state;
     netstream_t stream;
 #if USE_ZLIB
-    z_stream    z;
+    z_stream    z;          // raw deflate stream for private data
+    uLong       z_adler;    // checksum of all data sent
+    bool        z_dirty;    // private data not flushed yet
+    bool        z_started;  // zlib header sent
 #endif
     unsigned    msglen;
     unsigned    lastmessage;
 
     unsigned    flags;
     unsigned    maxbuf;
-    unsigned    bufcount;
 
     byte        buffer[MAX_GTC_MSGLEN + 4]; // recv buffer
     byte        *data; // send buffer
@@ -76,10 +79,19 @@ typedef struct {
     qhandle_t       recording;
     int             numlevels; // stop after that many levels
     int             numframes; // stop after that many frames
+    int64_t         recsize;   // bytes queued for writing
 
     // TCP client pool
     int             maxclients;
     gtv_client_t    *clients; // [sv_mvd_maxclients]
+
+#if USE_ZLIB
+    // raw deflate stream for data common to all active clients
+    z_stream        z;
+    bool            z_dirty;    // has input since last full flush
+    bool            z_busy;     // output is being appended to clients
+    unsigned        z_bufcount; // frames since last output
+#endif
 } mvd_server_t;
 
 static mvd_server_t     mvd;
@@ -114,16 +126,22 @@ static bool     mvd_enable(void);
 static void     mvd_disable(void);
 static void     mvd_error(const char *reason);
 
+static void     drop_client(gtv_client_t *client, const char *error);
 static void     write_stream(gtv_client_t *client, void *data, size_t len);
 static void     write_message(gtv_client_t *client, gtv_serverop_t op);
+static void     write_shared(void *data, size_t len);
+static void     write_shared_message(gtv_serverop_t op);
 #if USE_ZLIB
 static void     flush_stream(gtv_client_t *client, int flush);
+static void     flush_shared(int flush);
 #endif
 
 static void     rec_stop(void);
 static bool     rec_allowed(void);
 static void     rec_start(qhandle_t demofile);
 static void     rec_write(void);
+static int      rec_queue(const void *data, size_t len);
+static void     rec_status(void);
 
 
 /*
@@ -810,12 +828,13 @@ static void suspend_streams(void)
 {
     gtv_client_t *client;
 
-    FOR_EACH_ACTIVE_GTV(client) {
-        // send stream suspend marker
-        write_message(client, GTS_STREAM_DATA);
+    // send stream suspend marker
+    write_shared_message(GTS_STREAM_DATA);
 #if USE_ZLIB
-        flush_stream(client, Z_SYNC_FLUSH);
+    flush_shared(Z_SYNC_FLUSH);
 #endif
+
+    FOR_EACH_ACTIVE_GTV(client) {
         NET_UpdateStream(&client->stream);
     }
 
@@ -838,12 +857,13 @@ static void resume_streams(void)
         return;
     }
 
-    FOR_EACH_ACTIVE_GTV(client) {
-        // send gamestate
-        write_message(client, GTS_STREAM_DATA);
+    // send gamestate
+    write_shared_message(GTS_STREAM_DATA);
 #if USE_ZLIB
-        flush_stream(client, Z_SYNC_FLUSH);
+    flush_shared(Z_SYNC_FLUSH);
 #endif
+
+    FOR_EACH_ACTIVE_GTV(client) {
         NET_UpdateStream(&client->stream);
     }
 
@@ -957,20 +977,20 @@ static void rec_frame(size_t total)
         return;
 
     msglen = LittleShort(total);
-    ret = FS_Write(&msglen, 2, mvd.recording);
-    if (ret != 2)
+    ret = rec_queue(&msglen, 2);
+    if (ret < 0)
         goto fail;
-    ret = FS_Write(mvd.message.data, mvd.message.cursize, mvd.recording);
-    if (ret != mvd.message.cursize)
+    ret = rec_queue(mvd.message.data, mvd.message.cursize);
+    if (ret < 0)
         goto fail;
-    ret = FS_Write(msg_write.data, msg_write.cursize, mvd.recording);
-    if (ret != msg_write.cursize)
+    ret = rec_queue(msg_write.data, msg_write.cursize);
+    if (ret < 0)
         goto fail;
-    ret = FS_Write(mvd.datagram.data, mvd.datagram.cursize, mvd.recording);
-    if (ret != mvd.datagram.cursize)
+    ret = rec_queue(mvd.datagram.data, mvd.datagram.cursize);
+    if (ret < 0)
         goto fail;
 
-    if (sv_mvd_maxsize->integer > 0 && FS_Tell(mvd.recording) > sv_mvd_maxsize->integer) {
+    if (sv_mvd_maxsize->integer > 0 && mvd.recsize > sv_mvd_maxsize->integer) {
         Com_Printf("Stopping MVD recording, maximum size reached.\n");
         rec_stop();
         return;
@@ -1013,6 +1033,9 @@ void SV_MvdEndFrame(void)
     gtv_client_t *client;
     size_t total;
     byte header[3];
+#if USE_ZLIB
+    unsigned maxbuf;
+#endif
 
     if (!SV_FRAMESYNC)
         return;
@@ -1062,16 +1085,24 @@ void SV_MvdEndFrame(void)
     header[2] = GTS_STREAM_DATA;
 
     // send frame to clients
-    FOR_EACH_ACTIVE_GTV(client) {
-        write_stream(client, header, sizeof(header));
-        write_stream(client, mvd.message.data, mvd.message.cursize);
-        write_stream(client, msg_write.data, msg_write.cursize);
-        write_stream(client, mvd.datagram.data, mvd.datagram.cursize);
+    write_shared(header, sizeof(header));
+    write_shared(mvd.message.data, mvd.message.cursize);
+    write_shared(msg_write.data, msg_write.cursize);
+    write_shared(mvd.datagram.data, mvd.datagram.cursize);
+
 #if USE_ZLIB
-        if (++client->bufcount > client->maxbuf) {
-            flush_stream(client, Z_SYNC_FLUSH);
-        }
+    // flush often enough for the client with the smallest buffer
+    maxbuf = UINT_MAX;
+    FOR_EACH_ACTIVE_GTV(client) {
+        if (client->z.state)
+            maxbuf = min(maxbuf, client->maxbuf);
+    }
+    if (++mvd.z_bufcount > maxbuf) {
+        flush_shared(Z_SYNC_FLUSH);
+    }
 #endif
+
+    FOR_EACH_ACTIVE_GTV(client) {
         NET_UpdateStream(&client->stream);
     }
 
@@ -1320,7 +1351,30 @@ static void remove_client(gtv_client_t *client)
 }
 
 #if USE_ZLIB
-static void flush_stream(gtv_client_t *client, int flush)
+/*
+Clients that request compression receive a single zlib stream, but it is
+built from two raw deflate streams. Data specific to one client (replies,
+initial gamestate) is compressed by the client's own stream. Data common to
+all active clients (frames, gamestate on map change) is compressed once by
+the shared stream and the output is copied to each client. Streams are
+spliced at full flush points, where output is byte aligned and doesn't
+reference any previous data. Zlib header and checksum are written by hand.
+*/
+
+static const byte zlib_header[2] = { 0x78, 0x9c };
+
+// zlib header is delayed until the first compressed data, because client
+// parses the rest of data received along with hello message uncompressed
+static void start_stream(gtv_client_t *client)
+{
+    if (!client->z_started) {
+        FIFO_Write(&client->stream.send, zlib_header, sizeof(zlib_header));
+        client->z_started = true;
+    }
+}
+
+// returns false if client send buffer overflowed
+static bool deflate_stream(gtv_client_t *client, int flush)
 {
     fifo_t *fifo = &client->stream.send;
     z_streamp z = &client->z;
@@ -1328,34 +1382,121 @@ static void flush_stream(gtv_client_t *client, int flush)
     size_t len;
     int ret;
 
-    if (client->state <= cs_zombie) {
-        return;
-    }
-    if (!z->state) {
-        return;
-    }
-
-    z->next_in = NULL;
-    z->avail_in = 0;
+    start_stream(client);
 
     do {
         data = FIFO_Reserve(fifo, &len);
         if (!len) {
-            // FIXME: this is not an error when flushing
-            return;
+            return false;
         }
 
         z->next_out = data;
         z->avail_out = (uInt)len;
 
         ret = deflate(z, flush);
+        Q_assert(ret != Z_STREAM_ERROR);
 
-        len -= z->avail_out;
-        if (len) {
-            FIFO_Commit(fifo, len);
-            client->bufcount = 0;
+        FIFO_Commit(fifo, len - z->avail_out);
+    } while (!z->avail_out || z->avail_in);
+
+    return true;
+}
+
+static void flush_stream(gtv_client_t *client, int flush)
+{
+    byte trailer[4];
+
+    if (client->state <= cs_zombie) {
+        return;
+    }
+    if (!client->z.state) {
+        return;
+    }
+    if (flush != Z_FINISH && !client->z_dirty) {
+        return;
+    }
+
+    client->z.next_in = NULL;
+    client->z.avail_in = 0;
+
+    // not an error when finishing
+    if (!deflate_stream(client, flush)) {
+        if (flush != Z_FINISH)
+            drop_client(client, "overflowed");
+        return;
+    }
+
+    client->z_dirty = false;
+
+    if (flush == Z_FINISH) {
+        trailer[0] = client->z_adler >> 24;
+        trailer[1] = client->z_adler >> 16;
+        trailer[2] = client->z_adler >> 8;
+        trailer[3] = client->z_adler;
+        FIFO_Write(&client->stream.send, trailer, sizeof(trailer));
+    }
+}
+
+// copies shared stream output to each compressed client
+static void append_shared(const byte *data, size_t len)
+{
+    gtv_client_t *client;
+
+    if (!len) {
+        return;
+    }
+
+    mvd.z_bufcount = 0;
+
+    FOR_EACH_ACTIVE_GTV(client) {
+        if (!client->z.state) {
+            continue;
+        }
+        flush_stream(client, Z_FULL_FLUSH);
+        if (client->state <= cs_zombie) {
+            continue;
+        }
+        start_stream(client);
+        if (FIFO_Write(&client->stream.send, data, len) != len) {
+            drop_client(client, "overflowed");
         }
-    } while (ret == Z_OK);
+    }
+}
+
+static void deflate_shared(void *data, size_t len, int flush)
+{
+    static byte buffer[0x4000];
+    z_streamp z = &mvd.z;
+    int ret;
+
+    z->next_in = data;
+    z->avail_in = (uInt)len;
+
+    mvd.z_busy = true;
+    do {
+        z->next_out = buffer;
+        z->avail_out = sizeof(buffer);
+
+        ret = deflate(z, flush);
+        Q_assert(ret != Z_STREAM_ERROR);
+
+        append_shared(buffer, sizeof(buffer) - z->avail_out);
+    } while (!z->avail_out);
+    mvd.z_busy = false;
+}
+
+static void flush_shared(int flush)
+{
+    if (!mvd.z_dirty) {
+        return;
+    }
+
+    // after full flush, new clients can join the shared stream
+    if (flush == Z_FULL_FLUSH) {
+        mvd.z_dirty = false;
+    }
+
+    deflate_shared(NULL, 0, flush);
 }
 #endif
 
@@ -1373,8 +1514,21 @@ static void drop_client(gtv_client_t *client, const char *error)
 
 #if USE_ZLIB
     if (client->z.state) {
-        // finish zlib stream
-        flush_stream(client, Z_FINISH);
+        // if client overflowed while shared stream output was being appended,
+        // its stream is cut in the middle of a block and can't be finished
+        if (!mvd.z_busy) {
+            // shared stream must be at full flush point before the final
+            // block and checksum can be written
+            if (client->state == cs_spawned) {
+                flush_shared(Z_FULL_FLUSH);
+                if (client->state <= cs_zombie) {
+                    return;
+                }
+            }
+
+            // finish zlib stream
+            flush_stream(client, Z_FINISH);
+        }
         deflateEnd(&client->z);
     }
 #endif
@@ -1399,32 +1553,23 @@ static void write_stream(gtv_client_t *client, void *data, size_t len)
 
 #if USE_ZLIB
     if (client->z.state) {
-        z_streamp z = &client->z;
-
-        z->next_in = data;
-        z->avail_in = (uInt)len;
-
-        do {
-            data = FIFO_Reserve(fifo, &len);
-            if (!len) {
-                drop_client(client, "overflowed");
+        // shared stream must be at full flush point before private data
+        // can be inserted into it
+        if (client->state == cs_spawned) {
+            flush_shared(Z_FULL_FLUSH);
+            if (client->state <= cs_zombie) {
                 return;
             }
+        }
 
-            z->next_out = data;
-            z->avail_out = (uInt)len;
-
-            if (deflate(z, Z_NO_FLUSH) != Z_OK) {
-                drop_client(client, "deflate() failed");
-                return;
-            }
+        client->z_adler = adler32(client->z_adler, data, len);
+        client->z_dirty = true;
+        client->z.next_in = data;
+        client->z.avail_in = (uInt)len;
 
-            len -= z->avail_out;
-            if (len) {
-                FIFO_Commit(fifo, len);
-                client->bufcount = 0;
-            }
-        } while (z->avail_in);
+        if (!deflate_stream(client, Z_NO_FLUSH)) {
+            drop_client(client, "overflowed");
+        }
     } else
 #endif
     if (FIFO_Write(fifo, data, len) != len) {
@@ -1443,6 +1588,60 @@ static void write_message(gtv_client_t *client, gtv_serverop_t op)
     write_stream(client, msg_write.data, msg_write.cursize);
 }
 
+// writes data common to all active clients
+static void write_shared(void *data, size_t len)
+{
+    gtv_client_t *client;
+#if USE_ZLIB
+    bool deflated = false;
+    uLong adler = 0;
+#endif
+
+    if (!len) {
+        return;
+    }
+
+    FOR_EACH_ACTIVE_GTV(client) {
+#if USE_ZLIB
+        if (client->z.state) {
+            if (!deflated) {
+                adler = adler32(1, data, len);
+                deflated = true;
+            }
+            client->z_adler = adler32_combine(client->z_adler, adler, len);
+            continue;
+        }
+#endif
+        if (FIFO_Write(&client->stream.send, data, len) != len) {
+            drop_client(client, "overflowed");
+        }
+    }
+
+#if USE_ZLIB
+    if (deflated) {
+        if (!mvd.z.state) {
+            mvd.z.zalloc = SV_zalloc;
+            mvd.z.zfree = SV_zfree;
+            Q_assert(deflateInit2(&mvd.z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+        }
+        mvd.z_dirty = true;
+        deflate_shared(data, len, Z_NO_FLUSH);
+    }
+#endif
+}
+
+static void write_shared_message(gtv_serverop_t op)
+{
+    byte header[3];
+
+    WL16(header, msg_write.cursize + 1);
+    header[2] = op;
+    write_shared(header, sizeof(header));
+
+    write_shared(msg_write.data, msg_write.cursize);
+}
+
 static bool auth_client(const gtv_client_t *client, const char *password)
 {
     if (SV_MatchAddress(&gtv_white_list, &client->stream.address))
@@ -1525,10 +1724,12 @@ static void parse_hello(gtv_client_t *client)
     if (flags & GTF_DEFLATE) {
         client->z.zalloc = SV_zalloc;
         client->z.zfree = SV_zfree;
-        if (deflateInit(&client->z, Z_DEFAULT_COMPRESSION) != Z_OK) {
-            drop_client(client, "deflateInit failed");
+        if (deflateInit2(&client->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                         -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            drop_client(client, "deflateInit2 failed");
             return;
         }
+        client->z_adler = adler32(0, NULL, 0);
     }
 #endif
 
@@ -1546,7 +1747,7 @@ static void parse_ping(gtv_client_t *client)
     write_message(client, GTS_PONG);
 
 #if USE_ZLIB
-    flush_stream(client, Z_SYNC_FLUSH);
+    flush_stream(client, Z_FULL_FLUSH);
 #endif
 }
 
@@ -1567,6 +1768,12 @@ static void parse_stream_start(gtv_client_t *client)
 
     maxbuf = MSG_ReadShort();
     client->maxbuf = max(maxbuf, 10);
+
+#if USE_ZLIB
+    // join shared stream at full flush point
+    flush_shared(Z_FULL_FLUSH);
+#endif
+
     client->state = cs_spawned;
 
     List_Append(&gtv_active_list, &client->active);
@@ -1590,7 +1797,7 @@ static void parse_stream_start(gtv_client_t *client)
     }
 
 #if USE_ZLIB
-    flush_stream(client, Z_SYNC_FLUSH);
+    flush_stream(client, Z_FULL_FLUSH);
 #endif
 }
 
@@ -1601,6 +1808,14 @@ static void parse_stream_stop(gtv_client_t *client)
         return;
     }
 
+#if USE_ZLIB
+    // leave shared stream at full flush point
+    flush_shared(Z_FULL_FLUSH);
+    if (client->state <= cs_zombie) {
+        return;
+    }
+#endif
+
     client->state = cs_primed;
 
     List_Delete(&client->active);
@@ -1608,7 +1823,7 @@ static void parse_stream_stop(gtv_client_t *client)
     // send ack to client
     write_message(client, GTS_STREAM_STOP);
 #if USE_ZLIB
-    flush_stream(client, Z_SYNC_FLUSH);
+    flush_stream(client, Z_FULL_FLUSH);
 #endif
 }
 
@@ -1924,6 +2139,7 @@ void SV_MvdStatus_f(void)
             dump_clients();
         }
     }
+    rec_status();
     Com_Printf("\n");
 }
 
@@ -2027,8 +2243,8 @@ void SV_MvdMapChanged(void)
         }
 
         // send gamestate to all MVD clients
+        write_shared_message(GTS_STREAM_DATA);
         FOR_EACH_ACTIVE_GTV(client) {
-            write_message(client, GTS_STREAM_DATA);
             NET_UpdateStream(&client->stream);
         }
     }
@@ -2181,6 +2397,11 @@ void SV_MvdShutdown(error_type_t type)
     Z_Free(mvd.entities);
     Z_Free(mvd.clients);
 
+#if USE_ZLIB
+    if (mvd.z.state)
+        deflateEnd(&mvd.z);
+#endif
+
     // close server TCP socket
     NET_Listen(false);
 
@@ -2193,9 +2414,160 @@ void SV_MvdShutdown(error_type_t type)
 
 LOCAL MVD RECORDER
 
+Data is queued into a ring buffer and written to file (and compressed,
+if recording with gzip) by a dedicated writer thread, so that slow disk
+doesn't stall server frames. Frames are never dropped, because that would
+corrupt the demo. If the buffer fills up, server waits for writer thread
+to catch up.
+
 ==============================================================================
 */
 
+#define REC_BUFSIZE     0x100000
+
+static struct {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  work_cond;
+    pthread_cond_t  done_cond;
+    bool            terminate;
+
+    qhandle_t       file;
+    fifo_t          fifo;
+    int             error;
+
+    // main thread only
+    size_t          peak;       // maximum backlog
+    unsigned        stalls;     // times server waited for writer
+} rec;
+
+static void *rec_thread_func(void *arg)
+{
+    void *data;
+    size_t len;
+    int ret;
+
+    Com_SetWorkerThread();
+
+    pthread_mutex_lock(&rec.lock);
+    while (1) {
+        data = FIFO_Peek(&rec.fifo, &len);
+        if (!len) {
+            // finish all queued data before exiting
+            if (rec.terminate)
+                break;
+            pthread_cond_wait(&rec.work_cond, &rec.lock);
+            continue;
+        }
+
+        // main thread only appends to free space, so peeked data can be
+        // accessed without holding the lock
+        pthread_mutex_unlock(&rec.lock);
+        ret = FS_Write(data, len, rec.file);
+        pthread_mutex_lock(&rec.lock);
+
+        if (ret < 0 && !rec.error)
+            rec.error = ret;
+
+        FIFO_Decommit(&rec.fifo, len);
+        pthread_cond_signal(&rec.done_cond);
+    }
+    pthread_mutex_unlock(&rec.lock);
+
+    return NULL;
+}
+
+static bool rec_start_thread(qhandle_t demofile)
+{
+    rec.file = demofile;
+    rec.fifo.data = SV_Malloc(REC_BUFSIZE);
+    rec.fifo.size = REC_BUFSIZE;
+
+    pthread_mutex_init(&rec.lock, NULL);
+    pthread_cond_init(&rec.work_cond, NULL);
+    pthread_cond_init(&rec.done_cond, NULL);
+
+    if (pthread_create(&rec.thread, NULL, rec_thread_func, NULL)) {
+        pthread_mutex_destroy(&rec.lock);
+        pthread_cond_destroy(&rec.work_cond);
+        pthread_cond_destroy(&rec.done_cond);
+        Z_Free(rec.fifo.data);
+        memset(&rec, 0, sizeof(rec));
+        return false;
+    }
+
+    return true;
+}
+
+// waits for writer thread to write all queued data
+static void rec_stop_thread(void)
+{
+    pthread_mutex_lock(&rec.lock);
+    rec.terminate = true;
+    pthread_mutex_unlock(&rec.lock);
+
+    pthread_cond_signal(&rec.work_cond);
+
+    Q_assert(!pthread_join(rec.thread, NULL));
+
+    pthread_mutex_destroy(&rec.lock);
+    pthread_cond_destroy(&rec.work_cond);
+    pthread_cond_destroy(&rec.done_cond);
+
+    Z_Free(rec.fifo.data);
+    memset(&rec, 0, sizeof(rec));
+
+    Com_FlushWorkerPrints();
+}
+
+// queues data for writer thread, returns error from previous writes
+static int rec_queue(const void *data, size_t len)
+{
+    size_t ret, usage;
+    bool stalled = false;
+    int error;
+
+    mvd.recsize += len;
+
+    pthread_mutex_lock(&rec.lock);
+    while (len && !rec.error) {
+        ret = FIFO_Write(&rec.fifo, data, len);
+        data = (const byte *)data + ret;
+        len -= ret;
+        if (len) {
+            pthread_cond_signal(&rec.work_cond);
+            pthread_cond_wait(&rec.done_cond, &rec.lock);
+            stalled = true;
+        }
+    }
+    usage = FIFO_Usage(&rec.fifo);
+    error = rec.error;
+    pthread_mutex_unlock(&rec.lock);
+
+    pthread_cond_signal(&rec.work_cond);
+
+    rec.peak = max(rec.peak, usage);
+    rec.stalls += stalled;
+
+    return error;
+}
+
+static void rec_status(void)
+{
+    size_t usage;
+
+    if (!mvd.recording) {
+        return;
+    }
+
+    pthread_mutex_lock(&rec.lock);
+    usage = FIFO_Usage(&rec.fifo);
+    pthread_mutex_unlock(&rec.lock);
+
+    Com_Printf("Recording local MVD: %"PRId64" bytes, %zu backlog, "
+               "%zu peak, %u stalls\n", mvd.recsize, usage, rec.peak, rec.stalls);
+}
+
 static void rec_write(void)
 {
     uint16_t msglen;
@@ -2205,11 +2577,11 @@ static void rec_write(void)
         return;
 
     msglen = LittleShort(msg_write.cursize);
-    ret = FS_Write(&msglen, 2, mvd.recording);
-    if (ret != 2)
+    ret = rec_queue(&msglen, 2);
+    if (ret < 0)
         goto fail;
-    ret = FS_Write(msg_write.data, msg_write.cursize, mvd.recording);
-    if (ret == msg_write.cursize)
+    ret = rec_queue(msg_write.data, msg_write.cursize);
+    if (ret == 0)
         return;
 
 fail:
@@ -2228,7 +2600,9 @@ static void rec_stop(void)
 
     // write demo EOF marker
     msglen = 0;
-    FS_Write(&msglen, 2, mvd.recording);
+    rec_queue(&msglen, 2);
+
+    rec_stop_thread();
 
     FS_CloseFile(mvd.recording);
     mvd.recording = 0;
@@ -2253,13 +2627,20 @@ static void rec_start(qhandle_t demofile)
 {
     uint32_t magic;
 
+    if (!rec_start_thread(demofile)) {
+        Com_EPrintf("Couldn't create MVD writer thread\n");
+        FS_CloseFile(demofile);
+        return;
+    }
+
     mvd.recording = demofile;
     mvd.numlevels = 0;
     mvd.numframes = 0;
+    mvd.recsize = 0;
     mvd.clients_active = svs.realtime;
 
     magic = MVD_MAGIC;
-    FS_Write(&magic, 4, demofile);
+    rec_queue(&magic, 4);
 
     if (!mvd.active)
         return;
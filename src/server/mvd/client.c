@@ -79,6 +79,8 @@ typedef struct gtv_s {
     int64_t         demosize, demoofs;
     float           demoprogress;
     bool            demowait;
+    demoinfo_t      demoindex;      // valid if index is being built
+    int             demonumindexed; // number of snapshots in index file
 } gtv_t;
 
 static const char *const gtv_states[GTV_NUM_STATES] = {
@@ -120,6 +122,10 @@ static cvar_t  *mvd_buffer_size;
 static cvar_t  *mvd_username;
 static cvar_t  *mvd_password;
 static cvar_t  *mvd_snaps;
+static cvar_t  *mvd_demoindex;
+
+static void demo_finish_index(gtv_t *gtv);
+static bool demo_seek(mvd_t *mvd, int64_t dest, bool byte_seek, bool back_seek, bool wait);
 
 // ====================================================================
 
@@ -180,6 +186,7 @@ static void MVD_Destroy(mvd_t *mvd)
 
     // destroy any existing GTV connection
     if (mvd->gtv) {
+        demo_finish_index(mvd->gtv);
         mvd->gtv->mvd = NULL; // don't double destroy
         mvd->gtv->destroy(mvd->gtv);
     }
@@ -541,14 +548,11 @@ static int demo_read_first(qhandle_t f)
     return read ? read : Q_ERR_UNEXPECTED_EOF;
 }
 
-#define MIN_SNAPSHOTS   64
-#define MAX_SNAPSHOTS   250000000
-
 // periodically builds a fake demo packet used to reconstruct delta compression
 // state, configstrings and layouts at the given server frame.
 static void demo_emit_snapshot(mvd_t *mvd)
 {
-    mvd_snap_t *snap;
+    demosnap_t *snap;
     gtv_t *gtv;
     int64_t pos;
     char *from, *to;
@@ -649,7 +653,7 @@ static void demo_emit_snapshot(mvd_t *mvd)
     mvd->last_snapshot = mvd->framenum;
 }
 
-static mvd_snap_t *demo_find_snapshot(mvd_t *mvd, int64_t dest, bool byte_seek)
+static demosnap_t *demo_find_snapshot(mvd_t *mvd, int64_t dest, bool byte_seek)
 {
     int l = 0;
     int r = mvd->numsnapshots - 1;
@@ -659,7 +663,7 @@ static mvd_snap_t *demo_find_snapshot(mvd_t *mvd, int64_t dest, bool byte_seek)
 
     do {
         int m = (l + r) / 2;
-        mvd_snap_t *snap = mvd->snapshots[m];
+        demosnap_t *snap = mvd->snapshots[m];
         int64_t pos = byte_seek ? snap->filepos : snap->framenum;
         if (pos < dest)
             l = m + 1;
@@ -732,7 +736,8 @@ static bool demo_read_frame(mvd_t *mvd)
 
     demo_update(gtv);
 
-    MVD_ParseMessage(mvd);
+    if (MVD_ParseMessage(mvd))
+        demo_finish_index(gtv);
     demo_emit_snapshot(mvd);
     return true;
 
@@ -741,6 +746,56 @@ next:
     return true;
 }
 
+// saves snapshots built for the first map of demo file into index
+static void demo_save_index(gtv_t *gtv)
+{
+    mvd_t *mvd = gtv->mvd;
+
+    if (gtv->demoindex.filelen && mvd && mvd->numsnapshots > gtv->demonumindexed &&
+        Com_SaveDemoIndex(gtv->demoentry->string, &gtv->demoindex,
+                          mvd->snapshots, mvd->numsnapshots) == 0)
+        gtv->demonumindexed = mvd->numsnapshots;
+}
+
+static void demo_finish_index(gtv_t *gtv)
+{
+    demo_save_index(gtv);
+
+    memset(&gtv->demoindex, 0, sizeof(gtv->demoindex));
+    gtv->demonumindexed = 0;
+}
+
+static void demo_load_index(gtv_t *gtv)
+{
+    mvd_t *mvd = gtv->mvd;
+    demosnap_t **snapshots;
+    int i, count;
+
+    // snapshots from previous file are useless
+    for (i = 0; i < mvd->numsnapshots; i++)
+        Z_Free(mvd->snapshots[i]);
+    Z_Freep(&mvd->snapshots);
+    mvd->numsnapshots = 0;
+
+    if (!mvd_demoindex->integer || !gtv->demosize)
+        return;
+
+    if (Com_GetDemoInfo(gtv->demoplayback, gtv->demoofs + gtv->demosize,
+                        gtv->demoofs, &gtv->demoindex) < 0) {
+        memset(&gtv->demoindex, 0, sizeof(gtv->demoindex));
+        return;
+    }
+
+    count = Com_LoadDemoIndex(gtv->demoentry->string, &gtv->demoindex, &snapshots, TAG_MVD);
+    if (count > 0) {
+        Com_DPrintf("[%s] Loaded %d snapshots from index\n", gtv->name, count);
+        mvd->snapshots = snapshots;
+        mvd->numsnapshots = count;
+        mvd->last_snapshot = snapshots[count - 1]->framenum;
+        gtv->demonumindexed = count;
+    }
+}
+
 static void demo_play_next(gtv_t *gtv, string_entry_t *entry)
 {
     int64_t len, ofs;
@@ -757,6 +812,7 @@ static void demo_play_next(gtv_t *gtv, string_entry_t *entry)
 
     // close previous file
     if (gtv->demoplayback) {
+        demo_finish_index(gtv);
         FS_CloseFile(gtv->demoplayback);
         gtv->demoplayback = 0;
     }
@@ -805,6 +861,7 @@ static void demo_play_next(gtv_t *gtv, string_entry_t *entry)
         gtv->demosize = gtv->demoofs = 0;
     }
 
+    demo_load_index(gtv);
     demo_emit_snapshot(gtv->mvd);
 }
 
@@ -826,6 +883,7 @@ static void demo_destroy(gtv_t *gtv)
 
     // destroy any associated MVD channel
     if (mvd) {
+        demo_finish_index(gtv);
         mvd->gtv = NULL;
         MVD_Destroy(mvd);
     }
@@ -2233,13 +2291,10 @@ static void MVD_Seek_f(void)
 {
     mvd_t *mvd;
     gtv_t *gtv;
-    mvd_client_t *client;
-    mvd_snap_t *snap;
-    int i, j, ret, index, frames;
+    int i, frames;
     int64_t dest;
-    char *from, *to;
-    edict_t *ent;
-    bool gamestate, back_seek, byte_seek;
+    char *to;
+    bool back_seek, byte_seek;
 
     if (Cmd_Argc() < 2) {
         Com_Printf("Usage: %s [+-]<timespec|percent>[%%] [chanid]\n", Cmd_Argv(0));
@@ -2310,8 +2365,31 @@ static void MVD_Seek_f(void)
         back_seek = frames < 0;
     }
 
+    demo_seek(mvd, dest, byte_seek, back_seek, false);
+}
+
+/*
+==============
+demo_seek
+
+Seeks to destination frame or file position. If `wait' is true, stops at
+the end of the first map instead of finishing it. Returns false if seek was
+aborted or channel moved on to the next map or file.
+==============
+*/
+static bool demo_seek(mvd_t *mvd, int64_t dest, bool byte_seek, bool back_seek, bool wait)
+{
+    gtv_t *gtv = mvd->gtv;
+    mvd_client_t *client;
+    demosnap_t *snap;
+    int i, j, ret, index;
+    int64_t pos;
+    char *from, *to;
+    edict_t *ent;
+    bool gamestate, result = false;
+
     if (setjmp(mvd_jmpbuf))
-        return;
+        return false;
 
     // disable effects processing
     mvd->demoseeking = true;
@@ -2363,17 +2441,32 @@ static void MVD_Seek_f(void)
 
     // skip forward to destination frame/position
     while (1) {
-        int64_t pos = byte_seek ? FS_Tell(gtv->demoplayback) : mvd->framenum;
+        pos = byte_seek ? FS_Tell(gtv->demoplayback) : mvd->framenum;
         if (pos >= dest)
             break;
 
+        pos = FS_Tell(gtv->demoplayback);
         ret = demo_read_message(gtv->demoplayback);
+        if (ret == 0 && wait)
+            break;
         if (ret <= 0) {
             demo_finish(gtv, ret);
-            return;
+            return false;
+        }
+
+        // stay on this map, next read will hit the gamestate again
+        if (wait && (msg_read.data[0] & SVCMD_MASK) == mvd_serverdata) {
+            ret = FS_Seek(gtv->demoplayback, pos, SEEK_SET);
+            if (ret < 0) {
+                Com_EPrintf("[%s] Couldn't seek demo: %s\n", mvd->name, Q_ErrorString(ret));
+                goto done;
+            }
+            break;
         }
 
         gamestate = MVD_ParseMessage(mvd);
+        if (gamestate)
+            demo_finish_index(gtv);
 
         demo_emit_snapshot(mvd);
 
@@ -2443,9 +2536,61 @@ static void MVD_Seek_f(void)
     gtv->demowait = true;
 
     demo_update(gtv);
+    result = true;
 
 done:
     mvd->demoseeking = false;
+    return result;
+}
+
+/*
+==============
+MVD_Index_f
+
+Parses the rest of the first map of the demo to build all snapshots, saves
+them into index file and returns to the current frame.
+==============
+*/
+static void MVD_Index_f(void)
+{
+    mvd_t *mvd;
+    gtv_t *gtv;
+    int frame;
+
+    mvd = MVD_SetChannel(1);
+    if (!mvd) {
+        return;
+    }
+
+    gtv = mvd->gtv;
+    if (!gtv || !gtv->demoplayback) {
+        Com_Printf("[%s] Indexing is only supported on demo channels.\n", mvd->name);
+        return;
+    }
+
+    if (mvd->demorecording) {
+        Com_Printf("[%s] Indexing is not supported during demo recording.\n", mvd->name);
+        return;
+    }
+
+    if (!gtv->demoindex.filelen) {
+        Com_Printf("[%s] This demo can't be indexed.\n", mvd->name);
+        return;
+    }
+
+    if (mvd_snaps->integer <= 0) {
+        Com_Printf("[%s] Demo snapshots are disabled.\n", mvd->name);
+        return;
+    }
+
+    frame = mvd->framenum;
+    if (!demo_seek(mvd, INT64_MAX, false, false, true))
+        return;
+
+    demo_save_index(gtv);
+    Com_Printf("[%s] %d snapshots in demo index.\n", mvd->name, gtv->demonumindexed);
+
+    demo_seek(mvd, frame, false, true, false);
 }
 
 static void MVD_Control_f(void)
@@ -2608,6 +2753,7 @@ static void MVD_Play_f(void)
 
     if (gtv) {
         // free existing playlist
+        demo_finish_index(gtv);
         demo_free_playlist(gtv);
     } else {
         // create new connection
@@ -2654,6 +2800,7 @@ void MVD_Shutdown(void)
     // kill all MVD channels (including demo GTVs)
     LIST_FOR_EACH_SAFE(mvd_t, mvd, mvd_next, &mvd_channel_list, entry) {
         if (mvd->gtv) {
+            demo_finish_index(mvd->gtv);
             mvd->gtv->mvd = NULL; // don't double destroy
             mvd->gtv->destroy(mvd->gtv);
         }
@@ -2685,6 +2832,7 @@ static const cmdreg_t c_mvd[] = {
     { "mvdpause", MVD_Pause_f },
     { "mvdskip", MVD_Skip_f },
     { "mvdseek", MVD_Seek_f },
+    { "mvdindex", MVD_Index_f },
 
     { NULL }
 };
@@ -2718,6 +2866,7 @@ void MVD_Register(void)
     mvd_username = Cvar_Get("mvd_username", "unnamed", 0);
     mvd_password = Cvar_Get("mvd_password", "", CVAR_PRIVATE);
     mvd_snaps = Cvar_Get("mvd_snaps", "10", 0);
+    mvd_demoindex = Cvar_Get("mvd_demoindex", "1", 0);
 
     Cmd_Register(c_mvd);
 }
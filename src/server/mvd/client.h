@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include "../server.h"
+#include "common/demoindex.h"
 #include <setjmp.h>
 
 #define MVD_Malloc(size)    Z_TagMalloc(size, TAG_MVD)
@@ -116,13 +117,6 @@ typedef enum {
     MVD_NUM_STATES
 } mvd_state_t;
 
-typedef struct {
-    int framenum;
-    unsigned msglen;
-    int64_t filepos;
-    byte data[1];
-} mvd_snap_t;
-
 struct gtv_s;
 
 // FIXME: entire struct is > 500 kB in size!
@@ -142,7 +136,7 @@ typedef struct mvd_s {
     char        *demoname;
     bool        demoseeking;
     int         last_snapshot;
-    mvd_snap_t  **snapshots;
+    demosnap_t  **snapshots;
     int         numsnapshots;
 
     // delay buffer
@@ -0,0 +1,306 @@
+/*
+Copyright (C) 2023 Andrey Nazarov
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+// profile.c -- server frame phase profiler
+//
+
+#include "server.h"
+
+// log-linear histogram: values below 2 * PROF_SUB_COUNT are stored exactly,
+// each power of 2 above that is split into PROF_SUB_COUNT buckets, which
+// keeps relative error within 1 / PROF_SUB_COUNT
+#define PROF_SUB_BITS   4
+#define PROF_SUB_COUNT  (1 << PROF_SUB_BITS)
+#define PROF_MAX_BITS   27      // about 2 minutes in usec
+#define PROF_BUCKETS    ((PROF_MAX_BITS - PROF_SUB_BITS + 1) * PROF_SUB_COUNT)
+
+typedef struct {
+    unsigned    count;
+    unsigned    max;
+    uint64_t    total;
+    unsigned    buckets[PROF_BUCKETS];
+} profhist_t;
+
+typedef struct {
+    profhist_t  hist[SV_PHASE_MAX];
+    unsigned    overruns;
+    unsigned    worst[SV_PHASE_MAX];    // breakdown of the slowest frame
+} profset_t;
+
+enum {
+    PROF_TOTAL,     // since start or last reset
+    PROF_WINDOW,    // since last dump
+    PROF_NUM_SETS
+};
+
+static const char phase_names[SV_PHASE_MAX][12] = {
+    [SV_PHASE_COMMANDS]     = "commands",
+    [SV_PHASE_MVD_CLIENT]   = "mvdclient",
+    [SV_PHASE_PACKETS]      = "packets",
+    [SV_PHASE_ANTICHEAT]    = "anticheat",
+    [SV_PHASE_MVD_SERVER]   = "mvdserver",
+    [SV_PHASE_ASYNC]        = "async",
+    [SV_PHASE_TIMEOUTS]     = "timeouts",
+    [SV_PHASE_PINGS]        = "pings",
+    [SV_PHASE_GIVEMSEC]     = "givemsec",
+    [SV_PHASE_GAME]         = "game",
+    [SV_PHASE_SEND]         = "send",
+    [SV_PHASE_HEARTBEAT]    = "heartbeat",
+    [SV_PHASE_PREPWORLD]    = "prepworld",
+    [SV_PHASE_FRAME]        = "frame",
+};
+
+static cvar_t   *sv_profile_dump;
+static cvar_t   *sv_profile_file;
+static cvar_t   *sv_profile_overrun;
+
+static struct {
+    uint64_t    last;
+    unsigned    phases[SV_PHASE_MAX];
+    unsigned    last_dump;
+    profset_t   sets[PROF_NUM_SETS];
+} prof;
+
+static int bucket_for_value(unsigned value)
+{
+    int shift;
+
+    if (value < PROF_SUB_COUNT * 2)
+        return value;
+
+    value = min(value, BIT(PROF_MAX_BITS) - 1);
+    shift = Q_log2(value) - PROF_SUB_BITS;
+    return (shift + 1) * PROF_SUB_COUNT + (value >> shift) - PROF_SUB_COUNT;
+}
+
+// returns the largest value that falls into bucket
+static unsigned value_for_bucket(int bucket)
+{
+    int shift;
+
+    if (bucket < PROF_SUB_COUNT * 2)
+        return bucket;
+
+    shift = bucket / PROF_SUB_COUNT - 1;
+    return ((bucket % PROF_SUB_COUNT + PROF_SUB_COUNT + 1) << shift) - 1;
+}
+
+static void add_value(profhist_t *h, unsigned value)
+{
+    h->count++;
+    h->total += value;
+    h->max = max(h->max, value);
+    h->buckets[bucket_for_value(value)]++;
+}
+
+static unsigned percentile(const profhist_t *h, unsigned frac)
+{
+    uint64_t target = ((uint64_t)h->count * frac + 999) / 1000;
+    unsigned sum = 0;
+
+    for (int i = 0; i < PROF_BUCKETS; i++) {
+        sum += h->buckets[i];
+        if (sum >= target)
+            return min(value_for_bucket(i), h->max);
+    }
+
+    return h->max;
+}
+
+/*
+==================
+SV_ProfileStart
+
+Called at the start of each server frame.
+==================
+*/
+void SV_ProfileStart(void)
+{
+    prof.last = Sys_Microseconds();
+}
+
+/*
+==================
+SV_ProfilePhase
+
+Charges time elapsed since the previous call to the given phase.
+Phases run outside of game frames are accumulated until the next frame.
+==================
+*/
+void SV_ProfilePhase(sv_phase_t phase)
+{
+    uint64_t now = Sys_Microseconds();
+
+    prof.phases[phase] += now - prof.last;
+    prof.last = now;
+}
+
+static void dump_set(qhandle_t f, const profset_t *set)
+{
+    const profhist_t *h;
+    int i, j;
+
+    FS_FPrintf(f, "# time %lld, overruns %u\n", (long long)time(NULL), set->overruns);
+    for (i = 0; i < SV_PHASE_MAX; i++) {
+        h = &set->hist[i];
+        if (!h->count)
+            continue;
+        FS_FPrintf(f, "%s count %u mean %"PRIu64" p50 %u p90 %u p99 %u p999 %u max %u worst %u\n",
+                   phase_names[i], h->count, h->total / h->count, percentile(h, 500),
+                   percentile(h, 900), percentile(h, 990), percentile(h, 999), h->max,
+                   set->worst[i]);
+        FS_FPrintf(f, "%s hist", phase_names[i]);
+        for (j = 0; j < PROF_BUCKETS; j++)
+            if (h->buckets[j])
+                FS_FPrintf(f, " %u:%u", value_for_bucket(j), h->buckets[j]);
+        FS_FPrintf(f, "\n");
+    }
+}
+
+static void dump_window(void)
+{
+    profset_t *set = &prof.sets[PROF_WINDOW];
+    char buffer[MAX_OSPATH];
+    qhandle_t f;
+
+    if (!set->hist[SV_PHASE_FRAME].count)
+        return;
+
+    f = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_APPEND | FS_FLAG_TEXT,
+                        "logs/", sv_profile_file->string, ".log");
+    if (!f) {
+        Cvar_Set("sv_profile_dump", "0");
+        return;
+    }
+
+    dump_set(f, set);
+    FS_CloseFile(f);
+
+    memset(set, 0, sizeof(*set));
+}
+
+/*
+==================
+SV_ProfileEndFrame
+
+Records phase timings if game frame was run, otherwise discards them.
+==================
+*/
+void SV_ProfileEndFrame(bool ran)
+{
+    unsigned total, now;
+    int i, j;
+
+    if (!ran) {
+        memset(prof.phases, 0, sizeof(prof.phases));
+        return;
+    }
+
+    for (i = total = 0; i < SV_PHASE_FRAME; i++)
+        total += prof.phases[i];
+    prof.phases[SV_PHASE_FRAME] = total;
+
+    for (i = 0; i < PROF_NUM_SETS; i++) {
+        profset_t *set = &prof.sets[i];
+
+        if (total > set->hist[SV_PHASE_FRAME].max)
+            memcpy(set->worst, prof.phases, sizeof(set->worst));
+        if (sv_profile_overrun->integer > 0 && total > sv_profile_overrun->integer * 1000)
+            set->overruns++;
+
+        for (j = 0; j < SV_PHASE_MAX; j++)
+            add_value(&set->hist[j], prof.phases[j]);
+    }
+
+    memset(prof.phases, 0, sizeof(prof.phases));
+
+    if (sv_profile_dump->integer > 0) {
+        now = Sys_Milliseconds();
+        if (!prof.last_dump) {
+            prof.last_dump = now;
+        } else if (now - prof.last_dump >= sv_profile_dump->integer * 1000) {
+            dump_window();
+            prof.last_dump = now;
+        }
+    } else {
+        prof.last_dump = 0;
+    }
+}
+
+void SV_ProfileReset(void)
+{
+    memset(prof.sets, 0, sizeof(prof.sets));
+}
+
+void SV_ProfileReport(void)
+{
+    const profset_t *set = &prof.sets[PROF_TOTAL];
+    const profhist_t *h;
+    int i;
+
+    h = &set->hist[SV_PHASE_FRAME];
+    if (!h->count) {
+        Com_Printf("No frames profiled.\n");
+        return;
+    }
+
+    Com_Printf("phase         mean    p50    p99    max  worst\n"
+               "---------- ------ ------ ------ ------ ------\n");
+    for (i = 0; i < SV_PHASE_MAX; i++) {
+        h = &set->hist[i];
+        Com_Printf("%-10s %6"PRIu64" %6u %6u %6u %6u\n", phase_names[i],
+                   h->total / h->count, percentile(h, 500), percentile(h, 990),
+                   h->max, set->worst[i]);
+    }
+    Com_Printf("%u frames, %u over %d msec (times in usec)\n",
+               h->count, set->overruns, sv_profile_overrun->integer);
+}
+
+static void SV_Profile_f(void)
+{
+    if (Cmd_Argc() > 1) {
+        if (!strcmp(Cmd_Argv(1), "reset")) {
+            SV_ProfileReset();
+            return;
+        }
+        if (!strcmp(Cmd_Argv(1), "dump")) {
+            dump_window();
+            return;
+        }
+        Com_Printf("Usage: %s [reset|dump]\n", Cmd_Argv(0));
+        return;
+    }
+
+    SV_ProfileReport();
+}
+
+static const cmdreg_t c_profile[] = {
+    { "sv_profile", SV_Profile_f },
+
+    { NULL }
+};
+
+void SV_RegisterProfile(void)
+{
+    sv_profile_dump = Cvar_Get("sv_profile_dump", "0", 0);
+    sv_profile_file = Cvar_Get("sv_profile_file", "profile", 0);
+    sv_profile_overrun = Cvar_Get("sv_profile_overrun", "10", 0);
+
+    Cmd_Register(c_profile);
+}
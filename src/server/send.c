@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // sv_send.c
 
 #include "server.h"
+#include "system/pthread.h"
 
 /*
 =============================================================================
@@ -239,6 +240,19 @@ void SV_BroadcastCommand(const char *fmt, ...)
 }
 
 
+// client origins don't change between most multicasts
+static const mleaf_t *client_leaf(client_t *client)
+{
+    const vec_t *org = client->edict->s.origin;
+
+    if (!client->leaf || !VectorCompare(client->leaf_origin, org)) {
+        client->leaf = CM_PointLeaf(&sv.cm, org);
+        VectorCopy(org, client->leaf_origin);
+    }
+
+    return client->leaf;
+}
+
 /*
 =================
 SV_Multicast
@@ -295,13 +309,13 @@ void SV_Multicast(const vec3_t origin, multicast_t to)
         }
 
         if (to) {
-            const mleaf_t *leaf2 = CM_PointLeaf(&sv.cm, client->edict->s.origin);
-            if (!CM_AreasConnected(&sv.cm, leaf1->area, leaf2->area))
-                continue;
+            const mleaf_t *leaf2 = client_leaf(client);
             if (leaf2->cluster == -1)
                 continue;
             if (!Q_IsBitSet(mask.b, leaf2->cluster))
                 continue;
+            if (!CM_AreasConnected(&sv.cm, leaf1->area, leaf2->area))
+                continue;
         }
 
         SV_ClientAddMessage(client, flags);
@@ -343,6 +357,15 @@ static int compress_message(const client_t *client)
     if (!client->has_zlib)
         return 0;
 
+    // the same message is often sent to many clients in a row (broadcasts,
+    // intermission layouts, gamestate), reuse previous result if possible
+    if (svs.z_source_size == msg_write.cursize &&
+        !memcmp(svs.z_source, msg_write.data, msg_write.cursize)) {
+        return RL16(&svs.z_buffer[1]) + ZPACKET_HEADER;
+    }
+
+    svs.z_source_size = 0;
+
     svs.z.next_in = msg_write.data;
     svs.z.avail_in = msg_write.cursize;
     svs.z.next_out = svs.z_buffer + ZPACKET_HEADER;
@@ -366,6 +389,9 @@ static int compress_message(const client_t *client)
     WL16(&hdr[1], len);
     WL16(&hdr[3], msg_write.cursize);
 
+    memcpy(svs.z_source, msg_write.data, msg_write.cursize);
+    svs.z_source_size = msg_write.cursize;
+
     return len + ZPACKET_HEADER;
 }
 
@@ -710,13 +736,12 @@ static void repack_unreliables(client_t *client, unsigned maxsize)
     }
 }
 
-static void write_datagram_old(client_t *client)
+// determine how much space is left for unreliable data
+static unsigned datagram_maxsize_old(const client_t *client)
 {
-    message_packet_t *msg;
-    unsigned maxsize, cursize;
-    bool ret;
+    const message_packet_t *msg;
+    unsigned maxsize;
 
-    // determine how much space is left for unreliable data
     maxsize = client->netchan.maxpacketlen;
     if (client->netchan.reliable_length) {
         // there is still unacked reliable message pending
@@ -731,12 +756,27 @@ static void write_datagram_old(client_t *client)
     }
     Q_assert(maxsize <= client->netchan.maxpacketlen);
 
+    return maxsize;
+}
+
+static bool write_frame_old(client_t *client)
+{
+    unsigned maxsize = datagram_maxsize_old(client);
+
     // send over all the relevant entity_state_t
     // and the player_state_t
     if (client->protocol == PROTOCOL_VERSION_DEFAULT)
-        ret = SV_WriteFrameToClient_Default(client, maxsize);
-    else
-        ret = SV_WriteFrameToClient_Enhanced(client, maxsize);
+        return SV_WriteFrameToClient_Default(client, maxsize);
+
+    return SV_WriteFrameToClient_Enhanced(client, maxsize);
+}
+
+// frame has already been written to msg_write
+static void write_datagram_old(client_t *client, bool ret)
+{
+    unsigned maxsize, cursize;
+
+    maxsize = datagram_maxsize_old(client);
     if (!ret) {
         SV_DPrintf(1, "Frame %d overflowed for %s\n", client->framenum, client->name);
         SZ_Clear(&msg_write);
@@ -800,13 +840,19 @@ static void add_message_new(client_t *client, const byte *data,
     }
 }
 
-static void write_datagram_new(client_t *client)
+static bool write_frame_new(client_t *client)
 {
-    int cursize;
-
     // send over all the relevant entity_state_t
     // and the player_state_t
-    if (!SV_WriteFrameToClient_Enhanced(client, msg_write.maxsize)) {
+    return SV_WriteFrameToClient_Enhanced(client, msg_write.maxsize);
+}
+
+// frame has already been written to msg_write
+static void write_datagram_new(client_t *client, bool ret)
+{
+    int cursize;
+
+    if (!ret) {
         // should never really happen
         Com_WPrintf("Frame overflowed for %s\n", client->name);
         SZ_Clear(&msg_write);
@@ -880,18 +926,27 @@ static void check_key_sync(const client_t *client)
 }
 #endif
 
-/*
-=======================
-SV_SendClientMessages
+static bool write_frame(client_t *client)
+{
+    if (client->netchan.type == NETCHAN_NEW)
+        return write_frame_new(client);
 
-Called each game frame, sends svc_frame messages to spawned clients only.
-Clients in earlier connection state are handled in SV_SendAsyncPackets.
-=======================
-*/
-void SV_SendClientMessages(void)
+    return write_frame_old(client);
+}
+
+static void write_datagram(client_t *client, bool ret)
+{
+    if (client->netchan.type == NETCHAN_NEW)
+        write_datagram_new(client, ret);
+    else
+        write_datagram_old(client, ret);
+}
+
+static void send_client_messages(void)
 {
     client_t    *client;
     int         cursize;
+    bool        ret;
 
     // send a message to each connected client
     FOR_EACH_CLIENT(client) {
@@ -928,11 +983,8 @@ void SV_SendClientMessages(void)
 
         // build the new frame and write it
         SV_BuildClientFrame(client);
-
-        if (client->netchan.type == NETCHAN_NEW)
-            write_datagram_new(client);
-        else
-            write_datagram_old(client);
+        ret = write_frame(client);
+        write_datagram(client, ret);
 
 advance:
         // advance for next frame
@@ -944,6 +996,372 @@ finish:
     }
 }
 
+/*
+===============================================================================
+
+PARALLEL FRAME BUILDING
+
+Client frames are built and delta compressed by worker threads into
+separate buffers. The rest of datagram is then written and transmitted
+by main thread in client list order, so the output is exactly the same
+as with serial code. Errors raised while building frames are trapped and
+raised again by main thread once the batch is done.
+
+===============================================================================
+*/
+
+typedef enum {
+    SEND_FINISH,        // not active, clear unreliables only
+    SEND_ADVANCE,       // rate dropped
+    SEND_FRAGMENT,      // transmit next fragment
+    SEND_FRAME          // build and write new frame
+} send_action_t;
+
+typedef struct {
+    client_t        *client;
+    send_action_t   action;
+    bool            ret;
+    bool            overflowed;
+    unsigned        cursize;
+    byte            *data;
+} send_job_t;
+
+static struct {
+    int             numthreads;
+    pthread_t       threads[MAX_SEND_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t  work_cond;
+    pthread_cond_t  done_cond;
+    unsigned        batch;
+    bool            terminate;
+
+    send_job_t      *jobs;          // [maxclients]
+    send_job_t      **frames;       // [maxclients]
+    byte            *data;          // [maxframes * MAX_MSGLEN]
+    int             maxframes;
+
+    int             numframes;
+    int             nextframe;
+    int             numdone;
+
+    send_job_t      *errorjob;      // first job in client order that failed
+    errortrap_t     error;
+} send_pool;
+
+#if USE_TESTS
+// make frame building fail the way it does on corrupted server state
+static void break_frame(client_t *client)
+{
+    client_frame_t *frame = &client->frames[client->framenum & UPDATE_MASK];
+
+    if (sv_send_fault->integer == 2)
+        Com_Error(ERR_DROP, "%s: forced error", __func__);
+
+    if (frame->num_entities) {
+        unsigned i = frame->first_entity + frame->num_entities - 1;
+        client->entities[i & (client->num_entities - 1)].number = MAX_EDICTS;
+    }
+}
+#endif
+
+static void save_error(send_job_t *job, const errortrap_t *trap)
+{
+    pthread_mutex_lock(&send_pool.lock);
+    if (!send_pool.errorjob || job < send_pool.errorjob) {
+        send_pool.errorjob = job;
+        send_pool.error.code = trap->code;
+        Q_strlcpy(send_pool.error.msg, trap->msg, sizeof(send_pool.error.msg));
+    }
+    pthread_mutex_unlock(&send_pool.lock);
+}
+
+static void build_frame(send_job_t *job)
+{
+    sizebuf_t saved = msg_write;
+    errortrap_t trap;
+
+    SZ_Init(&msg_write, job->data, MAX_MSGLEN, "msg_write");
+    msg_write.allowoverflow = true;
+
+    if (setjmp(trap.jmpbuf)) {
+        msg_write = saved;
+        save_error(job, &trap);
+        return;
+    }
+
+    Com_SetErrorTrap(&trap);
+
+    SV_BuildClientFrame(job->client);
+#if USE_TESTS
+    if (sv_send_fault->integer)
+        break_frame(job->client);
+#endif
+    job->ret = write_frame(job->client);
+
+    Com_SetErrorTrap(NULL);
+
+    job->overflowed = msg_write.overflowed;
+    job->cursize = msg_write.cursize;
+
+    msg_write = saved;
+}
+
+// called with lock held
+static void build_frames(void)
+{
+    while (send_pool.nextframe < send_pool.numframes && !send_pool.terminate) {
+        send_job_t *job = send_pool.frames[send_pool.nextframe++];
+
+        pthread_mutex_unlock(&send_pool.lock);
+        build_frame(job);
+        pthread_mutex_lock(&send_pool.lock);
+
+        if (++send_pool.numdone == send_pool.numframes)
+            pthread_cond_signal(&send_pool.done_cond);
+    }
+}
+
+static void *send_thread_func(void *arg)
+{
+    unsigned batch = 0;
+
+    Com_SetWorkerThread();
+
+    pthread_mutex_lock(&send_pool.lock);
+    while (1) {
+        while (send_pool.batch == batch && !send_pool.terminate)
+            pthread_cond_wait(&send_pool.work_cond, &send_pool.lock);
+        if (send_pool.terminate)
+            break;
+        batch = send_pool.batch;
+        build_frames();
+    }
+    pthread_mutex_unlock(&send_pool.lock);
+
+    return NULL;
+}
+
+void SV_ShutdownSendThreads(void)
+{
+    int i;
+
+    if (!send_pool.numthreads)
+        return;
+
+    pthread_mutex_lock(&send_pool.lock);
+    send_pool.terminate = true;
+    pthread_mutex_unlock(&send_pool.lock);
+
+    pthread_cond_broadcast(&send_pool.work_cond);
+
+    for (i = 0; i < send_pool.numthreads; i++)
+        Q_assert(!pthread_join(send_pool.threads[i], NULL));
+
+    pthread_mutex_destroy(&send_pool.lock);
+    pthread_cond_destroy(&send_pool.work_cond);
+    pthread_cond_destroy(&send_pool.done_cond);
+
+    Z_Free(send_pool.jobs);
+    Z_Free(send_pool.frames);
+    Z_Free(send_pool.data);
+    memset(&send_pool, 0, sizeof(send_pool));
+
+    Com_FlushWorkerPrints();
+}
+
+static void start_send_threads(int count)
+{
+    int i;
+
+    pthread_mutex_init(&send_pool.lock, NULL);
+    pthread_cond_init(&send_pool.work_cond, NULL);
+    pthread_cond_init(&send_pool.done_cond, NULL);
+
+    for (i = 0; i < count; i++) {
+        if (pthread_create(&send_pool.threads[i], NULL, send_thread_func, NULL)) {
+            Com_EPrintf("Couldn't create send thread\n");
+            break;
+        }
+        send_pool.numthreads++;
+    }
+
+    if (send_pool.numthreads < count)
+        Cvar_SetInteger(sv_send_threads, send_pool.numthreads, FROM_CODE);
+
+    if (!send_pool.numthreads) {
+        pthread_mutex_destroy(&send_pool.lock);
+        pthread_cond_destroy(&send_pool.work_cond);
+        pthread_cond_destroy(&send_pool.done_cond);
+        return;
+    }
+
+    send_pool.jobs = SV_Malloc(sizeof(send_pool.jobs[0]) * svs.maxclients);
+    send_pool.frames = SV_Malloc(sizeof(send_pool.frames[0]) * svs.maxclients);
+
+    Com_DPrintf("Started %d send threads\n", send_pool.numthreads);
+}
+
+// game may not expect entity visibility callbacks to be called concurrently,
+// and dropping a client can change state of other clients mid-frame
+static bool can_send_parallel(void)
+{
+    client_t *client;
+
+    if (gex && gex->apiversion >= GAME_API_VERSION_EX_ENTITY_VISIBLE &&
+        (gex->EntityVisibleToClient || gex->CustomizeEntityToClient))
+        return false;
+
+    FOR_EACH_CLIENT(client)
+        if (CLIENT_ACTIVE(client) && SV_CLIENTSYNC(client) && client->netchan.message.overflowed)
+            return false;
+
+    return true;
+}
+
+// fix up entity numbers once so that frame building doesn't write to edicts
+static void check_entity_numbers(const game_export_t *game)
+{
+    for (int e = 1; e < game->num_edicts; e++) {
+        edict_t *ent = EDICT_NUM2(game, e);
+        if (!ent->inuse && (g_features->integer & GMF_PROPERINUSE))
+            continue;
+        if (ent->svflags & SVF_NOCLIENT)
+            continue;
+        if (!HAS_EFFECTS(ent))
+            continue;
+        SV_CheckEntityNumber(ent, e);
+    }
+}
+
+static void send_client_messages_parallel(void)
+{
+    client_t            *client;
+    send_job_t          *job;
+    const game_export_t *checked_ge = NULL;
+    int                 i, numjobs, numframes, cursize;
+
+    numjobs = numframes = 0;
+
+    // decide what to do with each client
+    FOR_EACH_CLIENT(client) {
+        job = &send_pool.jobs[numjobs];
+        job->client = client;
+
+        if (!CLIENT_ACTIVE(client)) {
+            job->action = SEND_FINISH;
+        } else if (!SV_CLIENTSYNC(client)) {
+            continue;
+        } else {
+#if USE_DEBUG && USE_FPS
+            if (developer->integer)
+                check_key_sync(client);
+#endif
+            if (SV_RateDrop(client)) {
+                job->action = SEND_ADVANCE;
+            } else if (client->netchan.fragment_pending) {
+                job->action = SEND_FRAGMENT;
+            } else {
+                job->action = SEND_FRAME;
+                send_pool.frames[numframes++] = job;
+                if (client->ge != checked_ge) {
+                    check_entity_numbers(client->ge);
+                    checked_ge = client->ge;
+                }
+            }
+        }
+
+        numjobs++;
+    }
+
+    if (numframes > send_pool.maxframes) {
+        Z_Free(send_pool.data);
+        send_pool.data = SV_Malloc(numframes * MAX_MSGLEN);
+        send_pool.maxframes = numframes;
+    }
+
+    for (i = 0; i < numframes; i++)
+        send_pool.frames[i]->data = send_pool.data + i * MAX_MSGLEN;
+
+    // build frames, main thread helps too
+    if (numframes) {
+        pthread_mutex_lock(&send_pool.lock);
+        send_pool.numframes = numframes;
+        send_pool.nextframe = 0;
+        send_pool.numdone = 0;
+        send_pool.batch++;
+        pthread_mutex_unlock(&send_pool.lock);
+
+        pthread_cond_broadcast(&send_pool.work_cond);
+
+        pthread_mutex_lock(&send_pool.lock);
+        build_frames();
+        while (send_pool.numdone < numframes)
+            pthread_cond_wait(&send_pool.done_cond, &send_pool.lock);
+        // late workers must not pick up frames of the next batch
+        send_pool.numframes = 0;
+        pthread_mutex_unlock(&send_pool.lock);
+
+        Com_FlushWorkerPrints();
+
+        // raise error on main thread, as serial code would
+        if (send_pool.errorjob) {
+            send_pool.errorjob = NULL;
+            Com_Error(send_pool.error.code, "%s", send_pool.error.msg);
+        }
+    }
+
+    // write and transmit datagrams in client order
+    for (i = 0, job = send_pool.jobs; i < numjobs; i++, job++) {
+        client = job->client;
+
+        switch (job->action) {
+        case SEND_FRAGMENT:
+            client->frameflags |= FF_SUPPRESSED;
+            cursize = Netchan_TransmitNextFragment(&client->netchan);
+            SV_CalcSendTime(client, cursize);
+            break;
+        case SEND_FRAME:
+            SZ_Write(&msg_write, job->data, job->cursize);
+            msg_write.overflowed = job->overflowed;
+            write_datagram(client, job->ret);
+            break;
+        default:
+            break;
+        }
+
+        // advance for next frame
+        if (job->action != SEND_FINISH)
+            client->framenum++;
+
+        // clear all unreliable messages still left
+        finish_frame(client);
+    }
+}
+
+/*
+=======================
+SV_SendClientMessages
+
+Called each game frame, sends svc_frame messages to spawned clients only.
+Clients in earlier connection state are handled in SV_SendAsyncPackets.
+=======================
+*/
+void SV_SendClientMessages(void)
+{
+    if (send_pool.numthreads != sv_send_threads->integer) {
+        SV_ShutdownSendThreads();
+        if (sv_send_threads->integer > 0)
+            start_send_threads(sv_send_threads->integer);
+    }
+
+    SV_PrepareFrameVis();
+
+    if (send_pool.numthreads && can_send_parallel())
+        send_client_messages_parallel();
+    else
+        send_client_messages();
+}
+
 static void write_pending_download(client_t *client)
 {
     sizebuf_t   *buf = &client->netchan.message;
@@ -970,7 +1388,7 @@ static void write_pending_download(client_t *client)
     SZ_WriteByte(buf, client->downloadcmd);
     SZ_WriteShort(buf, chunk);
     SZ_WriteByte(buf, client->downloadcount * 100 / client->downloadsize);
-    SZ_Write(buf, client->download + client->downloadcount - chunk, chunk);
+    SZ_Write(buf, client->download->data + client->downloadcount - chunk, chunk);
 
     if (client->downloadcount == client->downloadsize) {
         SV_CloseDownload(client);
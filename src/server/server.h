@@ -31,6 +31,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/cvar.h"
 #include "common/error.h"
 #include "common/files.h"
+#include "common/hash_map.h"
 #include "common/intreadwrite.h"
 #include "common/msg.h"
 #include "common/net/chan.h"
@@ -258,6 +259,23 @@ typedef struct {
     unsigned    cost;
 } ratelimit_t;
 
+// shared file contents for UDP downloads
+typedef struct dlcache_s {
+    list_t              entry;      // LRU order
+    struct dlcache_s    *next;      // hash chain
+    unsigned            hash;
+    int                 refcount;
+    bool                deflate;    // raw deflate stream from .pkz
+    bool                loading;    // still being read by async worker
+    bool                stale;      // removed from hash, freed when unreferenced
+    qhandle_t           f;
+    void                *raw;       // FS_RawFile handle read by worker
+    int                 result;
+    int                 size;
+    byte                *data;
+    char                path[1];
+} dlcache_t;
+
 typedef struct client_s {
     list_t          entry;
 
@@ -266,6 +284,10 @@ typedef struct client_s {
     edict_t         *edict;     // EDICT_NUM(clientnum+1)
     int             number;     // client slot number
 
+    // leaf of edict origin, cached for multicasts
+    const mleaf_t   *leaf;
+    vec3_t          leaf_origin;
+
     // client flags
     bool            reconnected: 1;
     bool            nodata: 1;
@@ -319,7 +341,7 @@ typedef struct client_s {
     unsigned        send_time, send_delta;          // used to rate drop async packets
 
     // current download
-    byte            *download;      // file being downloaded
+    dlcache_t       *download;      // shared contents of file being downloaded
     int             downloadsize;   // total bytes (can't use EOF because of paks)
     int             downloadcount;  // bytes sent
     char            *downloadname;  // name of the file
@@ -397,6 +419,9 @@ typedef struct client_s {
 // out before legitimate users connected
 #define    MAX_CHALLENGES    1024
 
+// stateless challenges are valid for current and previous epoch (in usec)
+#define    CHALLENGE_EPOCH   UINT64_C(30000000)
+
 typedef struct {
     netadr_t    adr;
     unsigned    challenge;
@@ -469,11 +494,14 @@ typedef struct {
     int         maxclients_soft;    // minus reserved slots
     int         maxclients;
     client_t    *client_pool;       // [maxclients]
+    hash_map_t  *client_map;        // client_key_t -> client_t *
 
 #if USE_ZLIB
     z_stream        z;  // for compressing messages at once
     byte            *z_buffer;
     unsigned        z_buffer_size;
+    byte            *z_source;      // uncompressed contents of z_buffer
+    unsigned        z_source_size;  // 0 if z_buffer is not valid
 #endif
 
 #if USE_SAVEGAMES
@@ -493,6 +521,7 @@ typedef struct {
     ratelimit_t     ratelimit_rcon;
 
     challenge_t     challenges[MAX_CHALLENGES]; // to prevent invalid IPs from connecting
+    uint32_t        challenge_key[4];   // secret for stateless challenges
 } server_static_t;
 
 //=============================================================================
@@ -524,6 +553,7 @@ extern cvar_t       *sv_fps;
 #endif
 extern cvar_t       *sv_force_reconnect;
 extern cvar_t       *sv_iplimit;
+extern cvar_t       *sv_challenge_cookies;
 
 #if USE_DEBUG
 extern cvar_t       *sv_debug;
@@ -537,6 +567,11 @@ extern cvar_t       *sv_max_download_size;
 extern cvar_t       *sv_max_packet_entities;
 extern cvar_t       *sv_trunc_packet_entities;
 extern cvar_t       *sv_prioritize_entities;
+extern cvar_t       *sv_send_threads;
+#if USE_TESTS
+extern cvar_t       *sv_send_fault;
+#endif
+extern cvar_t       *sv_broadphase;
 
 extern cvar_t       *sv_strafejump_hack;
 #if USE_PACKETDUP
@@ -574,6 +609,7 @@ extern edict_t      *sv_player;
 //
 void SV_DropClient(client_t *drop, const char *reason);
 void SV_RemoveClient(client_t *client);
+void SV_InitClientMap(void);
 void SV_CleanClient(client_t *client);
 
 void SV_InitOperatorCommands(void);
@@ -609,6 +645,8 @@ void SV_InitGame(unsigned mvd_spawn);
 //
 // sv_send.c
 //
+#define MAX_SEND_THREADS        32
+
 typedef enum {RD_NONE, RD_CLIENT, RD_PACKET} redirect_t;
 #define SV_OUTPUTBUF_LENGTH     (MAX_PACKETLEN_DEFAULT - 16)
 
@@ -623,6 +661,7 @@ extern char sv_outputbuf[SV_OUTPUTBUF_LENGTH];
 void SV_FlushRedirect(int redirected, const char *outputbuf, size_t len);
 
 void SV_SendClientMessages(void);
+void SV_ShutdownSendThreads(void);
 void SV_SendAsyncPackets(void);
 
 void SV_Multicast(const vec3_t origin, multicast_t to);
@@ -762,6 +801,8 @@ static inline void SV_CheckEntityNumber(edict_t *ent, int e, const char *func)
 
 #define SV_CheckEntityNumber(ent, e) SV_CheckEntityNumber(ent, e, __func__)
 
+void SV_PrepareFrameVis(void);
+void SV_FreeFrameVis(void);
 void SV_BuildClientFrame(client_t *client);
 bool SV_WriteFrameToClient_Default(client_t *client, unsigned maxsize);
 bool SV_WriteFrameToClient_Enhanced(client_t *client, unsigned maxsize);
@@ -794,6 +835,55 @@ void SV_RegisterSavegames(void);
 #define SV_RegisterSavegames()          (void)0
 #endif
 
+//
+// profile.c
+//
+typedef enum {
+    SV_PHASE_COMMANDS,
+    SV_PHASE_MVD_CLIENT,
+    SV_PHASE_PACKETS,
+    SV_PHASE_ANTICHEAT,
+    SV_PHASE_MVD_SERVER,
+    SV_PHASE_ASYNC,
+    SV_PHASE_TIMEOUTS,
+    SV_PHASE_PINGS,
+    SV_PHASE_GIVEMSEC,
+    SV_PHASE_GAME,
+    SV_PHASE_SEND,
+    SV_PHASE_HEARTBEAT,
+    SV_PHASE_PREPWORLD,
+    SV_PHASE_FRAME,     // sum of all above
+
+    SV_PHASE_MAX
+} sv_phase_t;
+
+void SV_ProfileStart(void);
+void SV_ProfilePhase(sv_phase_t phase);
+void SV_ProfileEndFrame(bool ran);
+void SV_ProfileReset(void);
+void SV_ProfileReport(void);
+void SV_RegisterProfile(void);
+
+//
+// download.c
+//
+dlcache_t *SV_AcquireDownload(const char *path, bool deflate, qhandle_t f, int size);
+void SV_ReleaseDownload(dlcache_t *dl);
+void SV_ShutdownDownloads(void);
+void SV_RegisterDownloads(void);
+
+//
+// capture.c
+//
+void SV_CapturePacket(void);
+void SV_CaptureSpawn(const char *mapname);
+void SV_CaptureShutdown(void);
+bool SV_ReplayActive(void);
+bool SV_ReplayPackets(void (*packet_cb)(void));
+unsigned SV_ReplayFrameTime(unsigned msec);
+unsigned SV_ReplaySleepTime(unsigned msec);
+void SV_RegisterCapture(void);
+
 //
 // ugly gclient_(old|new)_t accessors
 //
@@ -862,6 +952,8 @@ int SV_AreaEdicts(const vec3_t mins, const vec3_t maxs, edict_t **list, int maxc
 // returns the number of pointers filled in
 // ??? does this always return the world?
 
+void SV_AreaStats_f(void);
+
 //===================================================================
 
 //
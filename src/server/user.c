@@ -554,7 +554,10 @@ void SV_Begin_f(void)
 
 void SV_CloseDownload(client_t *client)
 {
-    Z_Freep(&client->download);
+    if (client->download) {
+        SV_ReleaseDownload(client->download);
+        client->download = NULL;
+    }
     Z_Freep(&client->downloadname);
     client->downloadsize = 0;
     client->downloadcount = 0;
@@ -569,7 +572,7 @@ SV_NextDownload_f
 */
 static void SV_NextDownload_f(void)
 {
-    if (!sv_client->download)
+    if (!sv_client->download || sv_client->download->loading)
         return;
 
     sv_client->downloadpending = true;
@@ -583,10 +586,9 @@ SV_BeginDownload_f
 static void SV_BeginDownload_f(void)
 {
     char    name[MAX_QPATH];
-    byte    *download;
     int     downloadcmd;
     int64_t downloadsize;
-    int     maxdownloadsize, result, offset = 0;
+    int     maxdownloadsize, offset = 0;
     cvar_t  *allow;
     size_t  len;
     qhandle_t f;
@@ -711,27 +713,20 @@ static void SV_BeginDownload_f(void)
         return;
     }
 
-    download = SV_Malloc(downloadsize);
-    result = FS_Read(download, downloadsize, f);
-    if (result != downloadsize) {
-        Com_DPrintf("Couldn't download %s to %s\n", name, sv_client->name);
-        goto fail3;
-    }
-
-    FS_CloseFile(f);
+    // file is read by async worker, or shared with other clients
+    sv_client->download = SV_AcquireDownload(name, downloadcmd == svc_zdownload, f, downloadsize);
+    if (!sv_client->download)
+        goto fail1;
 
-    sv_client->download = download;
     sv_client->downloadsize = downloadsize;
     sv_client->downloadcount = offset;
     sv_client->downloadname = SV_CopyString(name);
     sv_client->downloadcmd = downloadcmd;
-    sv_client->downloadpending = true;
+    sv_client->downloadpending = !sv_client->download->loading;
 
     Com_DPrintf("Downloading %s to %s\n", name, sv_client->name);
     return;
 
-fail3:
-    Z_Free(download);
 fail2:
     FS_CloseFile(f);
 fail1:
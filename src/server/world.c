@@ -47,6 +47,391 @@ static edict_t      **area_list;
 static int          area_count, area_maxcount;
 static int          area_type;
 
+static struct {
+    uint64_t    queries;
+    uint64_t    nodes;      // nodes visited
+    uint64_t    tested;     // entity boxes tested
+    uint64_t    found;      // entities returned
+    uint64_t    links;
+    uint64_t    inserts;    // tree leafs (re)inserted
+    uint64_t    removes;
+} sv_areastats;
+
+/*
+===============================================================================
+
+DYNAMIC AREA TREE
+
+Incrementally updated AABB tree used instead of area nodes when
+sv_broadphase is 1. Each linked entity owns a leaf holding its absolute
+box expanded by AREA_TREE_MARGIN, so entities moving a little don't
+cause tree updates. Solids and triggers are kept in separate trees that
+share the node pool. Tree is kept balanced by AVL style rotations.
+===============================================================================
+*/
+
+#define AREA_TREE_NODES     (MAX_EDICTS * 2)
+#define AREA_TREE_MARGIN    8
+#define AREA_TREE_STACK     128
+#define AREA_TREE_NULL      -1
+
+typedef struct {
+    vec3_t      mins, maxs;
+    int         parent;         // next free node if unused
+    int         children[2];    // AREA_TREE_NULL for leafs
+    int         height;         // 0 for leafs, -1 if unused
+    int         tree;           // leafs only
+    edict_t     *ent;           // leafs only
+} areatree_node_t;
+
+static struct {
+    bool            active;
+    list_t          linked;     // keeps ent->area valid for the game
+    int             roots[2];   // solid and trigger trees
+    int             freenode;
+    int             numnodes;
+    int             proxies[MAX_EDICTS];    // leaf node + 1
+    areatree_node_t nodes[AREA_TREE_NODES];
+} sv_areatree;
+
+static void SV_InitAreaTree(void)
+{
+    areatree_node_t *node;
+    int i;
+
+    for (i = 0, node = sv_areatree.nodes; i < AREA_TREE_NODES; i++, node++) {
+        node->parent = i + 1;
+        node->height = -1;
+    }
+    sv_areatree.nodes[AREA_TREE_NODES - 1].parent = AREA_TREE_NULL;
+
+    sv_areatree.freenode = 0;
+    sv_areatree.numnodes = 0;
+    sv_areatree.roots[0] = sv_areatree.roots[1] = AREA_TREE_NULL;
+    memset(sv_areatree.proxies, 0, sizeof(sv_areatree.proxies));
+    List_Init(&sv_areatree.linked);
+}
+
+static int alloc_node(void)
+{
+    int index = sv_areatree.freenode;
+    areatree_node_t *node;
+
+    Q_assert(index != AREA_TREE_NULL);
+    node = &sv_areatree.nodes[index];
+    sv_areatree.freenode = node->parent;
+    sv_areatree.numnodes++;
+
+    node->parent = AREA_TREE_NULL;
+    node->children[0] = node->children[1] = AREA_TREE_NULL;
+    node->height = 0;
+    node->ent = NULL;
+    return index;
+}
+
+static void free_node(int index)
+{
+    areatree_node_t *node = &sv_areatree.nodes[index];
+
+    node->parent = sv_areatree.freenode;
+    node->height = -1;
+    sv_areatree.freenode = index;
+    sv_areatree.numnodes--;
+}
+
+// half of the surface area, good enough as insertion cost
+static float box_cost(const vec3_t mins, const vec3_t maxs)
+{
+    vec3_t size;
+
+    VectorSubtract(maxs, mins, size);
+    return size[0] * size[1] + size[1] * size[2] + size[2] * size[0];
+}
+
+static float union_cost(const areatree_node_t *a, const areatree_node_t *b)
+{
+    vec3_t mins, maxs;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        mins[i] = min(a->mins[i], b->mins[i]);
+        maxs[i] = max(a->maxs[i], b->maxs[i]);
+    }
+
+    return box_cost(mins, maxs);
+}
+
+// recomputes box and height of internal node from its children
+static void refit_node(areatree_node_t *node)
+{
+    const areatree_node_t *a = &sv_areatree.nodes[node->children[0]];
+    const areatree_node_t *b = &sv_areatree.nodes[node->children[1]];
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        node->mins[i] = min(a->mins[i], b->mins[i]);
+        node->maxs[i] = max(a->maxs[i], b->maxs[i]);
+    }
+
+    node->height = 1 + max(a->height, b->height);
+}
+
+static void replace_child(int tree, int parent, int oldchild, int newchild)
+{
+    areatree_node_t *node;
+
+    if (parent == AREA_TREE_NULL) {
+        sv_areatree.roots[tree] = newchild;
+        return;
+    }
+
+    node = &sv_areatree.nodes[parent];
+    if (node->children[0] == oldchild)
+        node->children[0] = newchild;
+    else
+        node->children[1] = newchild;
+}
+
+// rotates taller child of unbalanced node up, returns new subtree root
+static int balance_node(int tree, int index)
+{
+    areatree_node_t *nodes = sv_areatree.nodes;
+    areatree_node_t *a = &nodes[index], *c;
+    int side, diff, up, taller, shorter;
+
+    if (a->height < 2)
+        return index;
+
+    diff = nodes[a->children[1]].height - nodes[a->children[0]].height;
+    if (diff > 1)
+        side = 1;
+    else if (diff < -1)
+        side = 0;
+    else
+        return index;
+
+    up = a->children[side];
+    c = &nodes[up];
+    if (nodes[c->children[0]].height > nodes[c->children[1]].height) {
+        taller = c->children[0];
+        shorter = c->children[1];
+    } else {
+        taller = c->children[1];
+        shorter = c->children[0];
+    }
+
+    // swap node with its child
+    c->children[0] = index;
+    c->children[1] = taller;
+    c->parent = a->parent;
+    a->parent = up;
+    replace_child(tree, c->parent, index, up);
+
+    // node adopts the shorter grandchild
+    a->children[side] = shorter;
+    nodes[shorter].parent = index;
+
+    refit_node(a);
+    refit_node(c);
+    return up;
+}
+
+static void refit_upwards(int tree, int index)
+{
+    while (index != AREA_TREE_NULL) {
+        index = balance_node(tree, index);
+        refit_node(&sv_areatree.nodes[index]);
+        index = sv_areatree.nodes[index].parent;
+    }
+}
+
+static void insert_leaf(int tree, int leaf)
+{
+    areatree_node_t *nodes = sv_areatree.nodes;
+    areatree_node_t *node, *child, *newnode;
+    const areatree_node_t *l = &nodes[leaf];
+    float cost, inherit, childcost[2];
+    int i, index, oldparent, newparent;
+
+    if (sv_areatree.roots[tree] == AREA_TREE_NULL) {
+        sv_areatree.roots[tree] = leaf;
+        nodes[leaf].parent = AREA_TREE_NULL;
+        return;
+    }
+
+    // descend to the sibling that grows the tree the least
+    index = sv_areatree.roots[tree];
+    while (nodes[index].height > 0) {
+        node = &nodes[index];
+        cost = union_cost(node, l);
+        inherit = cost - box_cost(node->mins, node->maxs);
+        cost *= 2;
+        inherit *= 2;
+
+        for (i = 0; i < 2; i++) {
+            child = &nodes[node->children[i]];
+            childcost[i] = union_cost(child, l) + inherit;
+            if (child->height > 0)
+                childcost[i] -= box_cost(child->mins, child->maxs);
+        }
+
+        if (cost < childcost[0] && cost < childcost[1])
+            break;
+
+        index = node->children[childcost[1] < childcost[0]];
+    }
+
+    // create new parent for the sibling and the leaf
+    oldparent = nodes[index].parent;
+    newparent = alloc_node();
+    newnode = &nodes[newparent];
+    newnode->parent = oldparent;
+    newnode->children[0] = index;
+    newnode->children[1] = leaf;
+    refit_node(newnode);
+    replace_child(tree, oldparent, index, newparent);
+    nodes[index].parent = newparent;
+    nodes[leaf].parent = newparent;
+
+    refit_upwards(tree, oldparent);
+}
+
+static void remove_leaf(int tree, int leaf)
+{
+    areatree_node_t *nodes = sv_areatree.nodes;
+    int parent, grandparent, sibling;
+
+    if (sv_areatree.roots[tree] == leaf) {
+        sv_areatree.roots[tree] = AREA_TREE_NULL;
+        return;
+    }
+
+    parent = nodes[leaf].parent;
+    grandparent = nodes[parent].parent;
+    sibling = nodes[parent].children[nodes[parent].children[0] == leaf];
+
+    // replace parent with the sibling
+    replace_child(tree, grandparent, parent, sibling);
+    nodes[sibling].parent = grandparent;
+    free_node(parent);
+
+    refit_upwards(tree, grandparent);
+}
+
+static void SV_UnlinkAreaTree(edict_t *ent)
+{
+    int entnum = NUM_FOR_EDICT(ent);
+    int leaf = sv_areatree.proxies[entnum] - 1;
+
+    if (leaf == AREA_TREE_NULL)
+        return;
+
+    remove_leaf(sv_areatree.nodes[leaf].tree, leaf);
+    free_node(leaf);
+    sv_areatree.proxies[entnum] = 0;
+    sv_areastats.removes++;
+}
+
+static void SV_LinkAreaTree(edict_t *ent, int tree)
+{
+    int entnum = NUM_FOR_EDICT(ent);
+    int leaf = sv_areatree.proxies[entnum] - 1;
+    areatree_node_t *node;
+    int i;
+
+    if (leaf == AREA_TREE_NULL) {
+        leaf = alloc_node();
+        sv_areatree.proxies[entnum] = leaf + 1;
+    } else {
+        node = &sv_areatree.nodes[leaf];
+
+        // still fits the expanded box?
+        if (node->tree == tree &&
+            node->mins[0] <= ent->absmin[0] && node->maxs[0] >= ent->absmax[0] &&
+            node->mins[1] <= ent->absmin[1] && node->maxs[1] >= ent->absmax[1] &&
+            node->mins[2] <= ent->absmin[2] && node->maxs[2] >= ent->absmax[2])
+            goto link;
+
+        remove_leaf(node->tree, leaf);
+    }
+
+    node = &sv_areatree.nodes[leaf];
+    node->ent = ent;
+    node->tree = tree;
+    node->height = 0;
+    node->children[0] = node->children[1] = AREA_TREE_NULL;
+    for (i = 0; i < 3; i++) {
+        node->mins[i] = ent->absmin[i] - AREA_TREE_MARGIN;
+        node->maxs[i] = ent->absmax[i] + AREA_TREE_MARGIN;
+    }
+    insert_leaf(tree, leaf);
+    sv_areastats.inserts++;
+
+link:
+    List_Append(&sv_areatree.linked, &ent->area);
+}
+
+static void SV_AreaTreeEdicts(int tree)
+{
+    const areatree_node_t *node;
+    int stack[AREA_TREE_STACK], top;
+    edict_t *check;
+
+    if (sv_areatree.roots[tree] == AREA_TREE_NULL)
+        return;
+
+    stack[0] = sv_areatree.roots[tree];
+    top = 1;
+
+    while (top) {
+        node = &sv_areatree.nodes[stack[--top]];
+        sv_areastats.nodes++;
+
+        if (node->mins[0] > area_maxs[0]
+            || node->mins[1] > area_maxs[1]
+            || node->mins[2] > area_maxs[2]
+            || node->maxs[0] < area_mins[0]
+            || node->maxs[1] < area_mins[1]
+            || node->maxs[2] < area_mins[2])
+            continue;
+
+        if (node->height > 0) {
+            Q_assert(top + 2 <= AREA_TREE_STACK);
+            stack[top++] = node->children[1];
+            stack[top++] = node->children[0];
+            continue;
+        }
+
+        check = node->ent;
+        sv_areastats.tested++;
+        if (check->solid == SOLID_NOT)
+            continue;        // deactivated
+        if (check->absmin[0] > area_maxs[0]
+            || check->absmin[1] > area_maxs[1]
+            || check->absmin[2] > area_maxs[2]
+            || check->absmax[0] < area_mins[0]
+            || check->absmax[1] < area_mins[1]
+            || check->absmax[2] < area_mins[2])
+            continue;        // not touching
+
+        if (area_count == area_maxcount) {
+            Com_WPrintf("SV_AreaEdicts: MAXCOUNT\n");
+            return;
+        }
+
+        area_list[area_count] = check;
+        area_count++;
+    }
+}
+
+static int tree_height(int tree)
+{
+    int root = sv_areatree.roots[tree];
+
+    return root == AREA_TREE_NULL ? 0 : sv_areatree.nodes[root].height + 1;
+}
+
+
 /*
 ===============
 SV_CreateAreaNode
@@ -108,6 +493,12 @@ void SV_ClearWorld(void)
         SV_CreateAreaNode(0, cm->mins, cm->maxs);
     }
 
+    sv_areatree.active = sv.cm.cache && sv_broadphase->integer;
+    if (sv_areatree.active)
+        SV_InitAreaTree();
+
+    memset(&sv_areastats, 0, sizeof(sv_areastats));
+
     // make sure all entities are unlinked
     for (int i = 0; i < ge->max_edicts; i++) {
         edict_t *ent = EDICT_NUM(i);
@@ -217,14 +608,21 @@ void SV_LinkEdict(const cm_t *cm, edict_t *ent)
     }
 }
 
+static void SV_UnlinkArea(edict_t *ent)
+{
+    List_Remove(&ent->area);
+    ent->area.next = ent->area.prev = NULL;
+}
+
 void PF_UnlinkEdict(edict_t *ent)
 {
     if (!ent)
         Com_Error(ERR_DROP, "%s: NULL", __func__);
     if (!ent->area.next)
         return;        // not linked in anywhere
-    List_Remove(&ent->area);
-    ent->area.next = ent->area.prev = NULL;
+    SV_UnlinkArea(ent);
+    if (sv_areatree.active)
+        SV_UnlinkAreaTree(ent);
 }
 
 static uint32_t SV_PackSolid32(const edict_t *ent)
@@ -269,14 +667,17 @@ void PF_LinkEdict(edict_t *ent)
     if (!ent)
         Com_Error(ERR_DROP, "%s: NULL", __func__);
 
+    // unlink from old position, but keep tree leaf, it may still fit
     if (ent->area.next)
-        PF_UnlinkEdict(ent);     // unlink from old position
+        SV_UnlinkArea(ent);
 
     if (ent == ge->edicts)
         return;        // don't add the world
 
     if (!ent->inuse) {
         Com_DPrintf("%s: entity %d is not in use\n", __func__, NUM_FOR_EDICT(ent));
+        if (sv_areatree.active)
+            SV_UnlinkAreaTree(ent);
         return;
     }
 
@@ -329,8 +730,18 @@ void PF_LinkEdict(edict_t *ent)
     sent->history[i].framenum = sv.framenum;
 #endif
 
-    if (ent->solid == SOLID_NOT)
+    if (ent->solid == SOLID_NOT) {
+        if (sv_areatree.active)
+            SV_UnlinkAreaTree(ent);
         return;
+    }
+
+    sv_areastats.links++;
+
+    if (sv_areatree.active) {
+        SV_LinkAreaTree(ent, ent->solid == SOLID_TRIGGER);
+        return;
+    }
 
 // find the first node that the ent's box crosses
     node = sv_areanodes;
@@ -364,6 +775,8 @@ static void SV_AreaEdicts_r(areanode_t *node)
     list_t      *start;
     edict_t     *check;
 
+    sv_areastats.nodes++;
+
     // touch linked edicts
     if (area_type == AREA_SOLID)
         start = &node->solid_edicts;
@@ -371,6 +784,7 @@ static void SV_AreaEdicts_r(areanode_t *node)
         start = &node->trigger_edicts;
 
     LIST_FOR_EACH(edict_t, check, start, area) {
+        sv_areastats.tested++;
         if (check->solid == SOLID_NOT)
             continue;        // deactivated
         if (check->absmin[0] > area_maxs[0]
@@ -415,11 +829,48 @@ int SV_AreaEdicts(const vec3_t mins, const vec3_t maxs,
     area_maxcount = maxcount;
     area_type = areatype;
 
-    SV_AreaEdicts_r(sv_areanodes);
+    if (sv_areatree.active)
+        SV_AreaTreeEdicts(areatype != AREA_SOLID);
+    else
+        SV_AreaEdicts_r(sv_areanodes);
+
+    sv_areastats.queries++;
+    sv_areastats.found += area_count;
 
     return area_count;
 }
 
+/*
+================
+SV_AreaStats_f
+================
+*/
+void SV_AreaStats_f(void)
+{
+    uint64_t queries = max(sv_areastats.queries, 1);
+
+    if (!sv.cm.cache) {
+        Com_Printf("No map loaded.\n");
+        return;
+    }
+
+    if (sv_areatree.active) {
+        Com_Printf("Dynamic area tree: %d nodes, %d/%d solid/trigger height\n",
+                   sv_areatree.numnodes, tree_height(0), tree_height(1));
+    } else {
+        Com_Printf("Static area nodes: %d nodes, %d depth\n",
+                   sv_numareanodes, AREA_DEPTH);
+    }
+
+    Com_Printf("%"PRIu64" links, %"PRIu64" tree inserts, %"PRIu64" tree removes\n",
+               sv_areastats.links, sv_areastats.inserts, sv_areastats.removes);
+    Com_Printf("%"PRIu64" queries, per query: %.1f nodes visited, "
+               "%.1f entities tested, %.1f found\n", sv_areastats.queries,
+               (double)sv_areastats.nodes / queries,
+               (double)sv_areastats.tested / queries,
+               (double)sv_areastats.found / queries);
+}
+
 
 //===========================================================================
 
@@ -37,6 +37,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <dirent.h>
 #include <dlfcn.h>
 #include <errno.h>
+#ifdef HAVE_GETRANDOM
+#include <sys/random.h>
+#endif
 
 #if USE_SDL
 #include <SDL.h>
@@ -85,6 +88,56 @@ unsigned Sys_Milliseconds(void)
     return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000UL;
 }
 
+uint64_t Sys_Microseconds(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * UINT64_C(1000000) + ts.tv_nsec / 1000;
+}
+
+bool Sys_GetRandomBytes(void *buf, size_t len)
+{
+    byte *p = buf;
+    ssize_t ret;
+    int fd;
+
+#ifdef HAVE_GETRANDOM
+    while (len) {
+        ret = getrandom(p, len, 0);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        p += ret;
+        len -= ret;
+    }
+    if (!len)
+        return true;
+#endif
+
+    // fall back to device for older kernels
+    fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    while (len) {
+        ret = read(fd, p, len);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (ret == 0)
+            break;
+        p += ret;
+        len -= ret;
+    }
+
+    close(fd);
+    return !len;
+}
+
 /*
 =================
 Sys_Quit
@@ -133,6 +186,21 @@ void Sys_Sleep(int msec)
     nanosleep(&req, NULL);
 }
 
+void *Sys_MapFile(FILE *fp, size_t size)
+{
+    void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(fp), 0);
+
+    if (data == MAP_FAILED)
+        return NULL;
+
+    return data;
+}
+
+void Sys_UnmapFile(void *data, size_t size)
+{
+    munmap(data, size);
+}
+
 const char *Sys_ErrorString(int err)
 {
     return strerror(err);
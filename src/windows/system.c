@@ -22,6 +22,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/prompt.h"
 #include "shared/atomic.h"
 
+#include <io.h>
+#include <bcrypt.h>
+
 #if USE_WINSVC
 #include <winsvc.h>
 #include <setjmp.h>
@@ -868,6 +871,21 @@ unsigned Sys_Milliseconds(void)
     return tm.QuadPart * 1000ULL / timer_freq.QuadPart;
 }
 
+uint64_t Sys_Microseconds(void)
+{
+    LARGE_INTEGER tm;
+    QueryPerformanceCounter(&tm);
+    // split to avoid overflow with high frequency counters
+    return tm.QuadPart / timer_freq.QuadPart * 1000000ULL +
+           tm.QuadPart % timer_freq.QuadPart * 1000000ULL / timer_freq.QuadPart;
+}
+
+bool Sys_GetRandomBytes(void *buf, size_t len)
+{
+    return len <= ULONG_MAX && BCRYPT_SUCCESS(BCryptGenRandom(NULL, buf, len,
+                                              BCRYPT_USE_SYSTEM_PREFERRED_RNG));
+}
+
 void Sys_AddDefaultConfig(void)
 {
 }
@@ -877,6 +895,30 @@ void Sys_Sleep(int msec)
     Sleep(msec);
 }
 
+void *Sys_MapFile(FILE *fp, size_t size)
+{
+    HANDLE file = (HANDLE)_get_osfhandle(_fileno(fp));
+    HANDLE mapping;
+    void *data;
+
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping)
+        return NULL;
+
+    // view keeps reference to mapping object
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size);
+    CloseHandle(mapping);
+    return data;
+}
+
+void Sys_UnmapFile(void *data, size_t size)
+{
+    UnmapViewOfFile(data);
+}
+
 const char *Sys_ErrorString(int err)
 {
     static char buf[256];